@@ -5,19 +5,40 @@
 #include <pybind11/stl.h>
 #include <vector>
 
+#include "../include/addressing.hpp"
+#include "../include/any_multiprobe.hpp"
+#include "../include/hamming_rank.hpp"
 #include "../include/lsh.hpp"
+#include "../include/lsh_forest.hpp"
 #include "../include/lsh_multi.hpp"
+#include "../include/mapped_file.hpp"
+#include "../include/multi_index_hashing.hpp"
 #include "../include/nr_gen.hpp"
 #include "../include/nr_multiprobe.hpp"
 #include "../include/p_stable_lsh.hpp"
+#include "../include/probe_result.hpp"
+#include "../include/query_context.hpp"
 #include "../include/sign_lsh.hpp"
 #include "../include/simple_lsh.hpp"
 #include "../include/stats/stats.hpp"
+#include "../include/vecs_io.hpp"
 
 namespace py = pybind11;
 using namespace nr;
 using namespace Eigen;
 
+template <typename Component>
+using ProbeOut = std::pair<ProbeResult<Component>, StatTracker>;
+template <typename Component>
+using RowMatrix = Matrix<Component, Dynamic, Dynamic, RowMajor>;
+
+// py::overload_cast deduces the class and return type, which fails when the
+// overloads include member templates. Here every type is spelled out.
+template <typename Class, typename Return, typename... Args>
+constexpr auto member(Return (Class::*pmf)(Args...)) {
+  return pmf;
+}
+
 PYBIND11_MODULE(nr_binding, m) {
   // hello
 
@@ -50,7 +71,8 @@ PYBIND11_MODULE(nr_binding, m) {
       .def_readonly("comps", &Tracked::comparisons)
       .def_readonly("bucks", &Tracked::buckets_probed)
       .def_readonly("parts", &Tracked::partitions_probed)
-      .def_readonly("tables", &Tracked::tables_probed);
+      .def_readonly("tables", &Tracked::tables_probed)
+      .def_readonly("dups", &Tracked::duplicates_skipped);
 
   // binding for StatTracker so Python users have access to it!
   py::class_<StatTracker>(m, "StatTracker")
@@ -58,50 +80,213 @@ PYBIND11_MODULE(nr_binding, m) {
       .def("get_stats", &StatTracker::get_stats)
       .def("tracked_stats", &StatTracker::tracked_stats);
 
+  // lightweight probe output: ids and scores, no vector copies.
+  py::class_<ProbeResult<float>>(m, "ProbeResultFloat")
+      .def(py::init<>())
+      .def_readonly("ids", &ProbeResult<float>::ids)
+      .def_readonly("scores", &ProbeResult<float>::scores)
+      .def("__len__", &ProbeResult<float>::size);
+
+  py::class_<ProbeResult<double>>(m, "ProbeResultDouble")
+      .def(py::init<>())
+      .def_readonly("ids", &ProbeResult<double>::ids)
+      .def_readonly("scores", &ProbeResult<double>::scores)
+      .def("__len__", &ProbeResult<double>::size);
+
+  // a query hashed once by a table, to be passed back to its probe functions.
+  py::class_<QueryContext<VectorXf>>(m, "QueryContextFloat");
+  py::class_<QueryContext<VectorXd>>(m, "QueryContextDouble");
+
+  // how hash codes are reduced to buckets.
+  py::enum_<Addressing>(m, "Addressing")
+      .value("Modulo", Addressing::Modulo)
+      .value("LowBits", Addressing::LowBits);
+
+  py::enum_<Partitioning>(m, "Partitioning")
+      .value("EqualCount", Partitioning::EqualCount)
+      .value("LogNorm", Partitioning::LogNorm);
+
   // double tables.
   py::class_<NR_MultiProbe<VectorXd>>(m, "MultiProbeDouble")
       .def(py::init<int64_t, int64_t, int64_t, int64_t, int64_t>())
+      .def(py::init<int64_t, int64_t, int64_t, int64_t, int64_t, Addressing>())
+      .def("fill",
+           [](NR_MultiProbe<VectorXd> &self, const Ref<const RowMatrix<double>> &rows,
+              bool is_normalized) { self.fill(rows, is_normalized); })
       .def("fill", &NR_MultiProbe<VectorXd>::fill<std::vector<VectorXd>>)
       .def("probe", &NR_MultiProbe<VectorXd>::probe)
       .def("k_probe", &NR_MultiProbe<VectorXd>::k_probe)
       .def("probe_approx", &NR_MultiProbe<VectorXd>::probe_approx)
       .def("k_probe_approx", &NR_MultiProbe<VectorXd>::k_probe_approx)
+      .def("context",
+           member<NR_MultiProbe<VectorXd>, QueryContext<VectorXd>, const VectorXd &, int64_t>(&NR_MultiProbe<VectorXd>::context))
+      .def("probe_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, const VectorXd &, int64_t>(&NR_MultiProbe<VectorXd>::probe_ids))
+      .def("probe_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, const QueryContext<VectorXd> &>(&NR_MultiProbe<VectorXd>::probe_ids))
+      .def("k_probe_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, int64_t, const VectorXd &, size_t>(&NR_MultiProbe<VectorXd>::k_probe_ids))
+      .def("k_probe_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, int64_t, const QueryContext<VectorXd> &>(&NR_MultiProbe<VectorXd>::k_probe_ids))
+      .def("probe_approx_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, const VectorXd &, double, int64_t>(&NR_MultiProbe<VectorXd>::probe_approx_ids))
+      .def("probe_approx_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, const QueryContext<VectorXd> &, double>(&NR_MultiProbe<VectorXd>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, int64_t, const VectorXd &, double, size_t>(&NR_MultiProbe<VectorXd>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<NR_MultiProbe<VectorXd>, ProbeOut<double>, int64_t, const QueryContext<VectorXd> &, double>(&NR_MultiProbe<VectorXd>::k_probe_approx_ids))
+      .def("lookup", &NR_MultiProbe<VectorXd>::lookup)
+      .def("set_bucket_cap", &NR_MultiProbe<VectorXd>::set_bucket_cap)
+      .def("set_partitioning", &NR_MultiProbe<VectorXd>::set_partitioning,
+           py::arg("how"), py::arg("parallel") = false)
+      .def("set_bucket_occupancy", &NR_MultiProbe<VectorXd>::set_bucket_occupancy)
+      .def("k_probe_ids_batch",
+           py::overload_cast<int64_t, const std::vector<VectorXd> &, size_t>(&NR_MultiProbe<VectorXd>::k_probe_ids_batch))
+      .def("k_probe_ids_by_bucket",
+           py::overload_cast<int64_t, const std::vector<VectorXd> &, size_t>(&NR_MultiProbe<VectorXd>::k_probe_ids_by_bucket))
+      .def("set_batch_width", &NR_MultiProbe<VectorXd>::set_batch_width)
+      .def("set_parallelism", &NR_MultiProbe<VectorXd>::set_parallelism)
       .def("stats", &NR_MultiProbe<VectorXd>::print_stats);
 
+  // dataset files. The rows stay in the mapped file. array() is a read only
+  // numpy view of them that keeps the file mapped while it is alive.
+  py::class_<MappedRows<VectorXf>>(m, "MappedRows")
+      .def("size", &MappedRows<VectorXf>::size)
+      .def("dimension", &MappedRows<VectorXf>::dimension)
+      .def("array", &MappedRows<VectorXf>::matrix,
+           py::return_value_policy::reference_internal);
+  py::class_<MappedRows<VectorXi>>(m, "MappedIntRows")
+      .def("size", &MappedRows<VectorXi>::size)
+      .def("dimension", &MappedRows<VectorXi>::dimension)
+      .def("array", &MappedRows<VectorXi>::matrix,
+           py::return_value_policy::reference_internal);
+  m.def("read_fvecs", &read_fvecs<VectorXf>);
+  m.def("read_ivecs", &read_ivecs);
+  m.def("read_f32_matrix", &read_f32_matrix<VectorXf>);
+  m.def("write_fvecs", &write_fvecs<std::vector<VectorXf>>);
+  m.def("write_ivecs", &write_ivecs<std::vector<std::vector<int>>>);
+  m.def("write_f32_matrix", &write_f32_matrix<std::vector<VectorXf>>,
+        py::arg("path"), py::arg("rows"), py::arg("dim") = 0);
+
   // float tables.
   py::class_<NR_MultiProbe<VectorXf>>(m, "MultiProbeFloat")
       .def(py::init<int64_t, int64_t, int64_t, int64_t, int64_t>())
+      .def(py::init<int64_t, int64_t, int64_t, int64_t, int64_t, Addressing>())
+      .def("fill",
+           [](NR_MultiProbe<VectorXf> &self, const Ref<const RowMatrix<float>> &rows,
+              bool is_normalized) { self.fill(rows, is_normalized); })
       .def("fill", &NR_MultiProbe<VectorXf>::fill<std::vector<VectorXf>>)
+      .def("fill", &NR_MultiProbe<VectorXf>::fill<MappedRows<VectorXf>>)
+      .def("fill_streaming", &NR_MultiProbe<VectorXf>::fill_streaming,
+           py::arg("rows"), py::arg("dir"), py::arg("is_normalized"),
+           py::arg("chunk_size") = 4096)
       .def("probe", &NR_MultiProbe<VectorXf>::probe)
       .def("k_probe", &NR_MultiProbe<VectorXf>::k_probe)
       .def("probe_approx", &NR_MultiProbe<VectorXf>::probe_approx)
       .def("k_probe_approx", &NR_MultiProbe<VectorXf>::k_probe_approx)
+      .def("context",
+           member<NR_MultiProbe<VectorXf>, QueryContext<VectorXf>, const VectorXf &, int64_t>(&NR_MultiProbe<VectorXf>::context))
+      .def("probe_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, const VectorXf &, int64_t>(&NR_MultiProbe<VectorXf>::probe_ids))
+      .def("probe_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, const QueryContext<VectorXf> &>(&NR_MultiProbe<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, int64_t, const VectorXf &, size_t>(&NR_MultiProbe<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, int64_t, const QueryContext<VectorXf> &>(&NR_MultiProbe<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, const VectorXf &, float, int64_t>(&NR_MultiProbe<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, const QueryContext<VectorXf> &, float>(&NR_MultiProbe<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, int64_t, const VectorXf &, float, size_t>(&NR_MultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<NR_MultiProbe<VectorXf>, ProbeOut<float>, int64_t, const QueryContext<VectorXf> &, float>(&NR_MultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &NR_MultiProbe<VectorXf>::lookup)
+      .def("set_bucket_cap", &NR_MultiProbe<VectorXf>::set_bucket_cap)
+      .def("set_partitioning", &NR_MultiProbe<VectorXf>::set_partitioning,
+           py::arg("how"), py::arg("parallel") = false)
+      .def("set_bucket_occupancy", &NR_MultiProbe<VectorXf>::set_bucket_occupancy)
+      .def("k_probe_ids_batch",
+           py::overload_cast<int64_t, const std::vector<VectorXf> &, size_t>(&NR_MultiProbe<VectorXf>::k_probe_ids_batch))
+      .def("k_probe_ids_batch",
+           [](NR_MultiProbe<VectorXf> &self, int64_t k,
+              const MappedRows<VectorXf> &queries, size_t adj) {
+             return self.k_probe_ids_batch(k, self.contexts(queries, adj));
+           })
+      .def("k_probe_ids_by_bucket",
+           py::overload_cast<int64_t, const std::vector<VectorXf> &, size_t>(&NR_MultiProbe<VectorXf>::k_probe_ids_by_bucket))
+      .def("set_batch_width", &NR_MultiProbe<VectorXf>::set_batch_width)
+      .def("set_parallelism", &NR_MultiProbe<VectorXf>::set_parallelism)
       .def("stats", &NR_MultiProbe<VectorXf>::print_stats);
 
   // double lsh
   py::class_<LSH_MultiProbe<VectorXd>>(m, "LSHProbeDouble")
       .def(py::init<int64_t, int64_t, size_t>())
+      .def(py::init<int64_t, int64_t, size_t, Addressing>())
       .def("fill", &LSH_MultiProbe<VectorXd>::fill<std::vector<VectorXd>>)
       .def("probe", &LSH_MultiProbe<VectorXd>::probe)
       .def("k_probe", &LSH_MultiProbe<VectorXd>::k_probe)
       .def("probe_approx", &LSH_MultiProbe<VectorXd>::probe_approx)
       .def("k_probe_approx", &LSH_MultiProbe<VectorXd>::k_probe_approx)
+      .def("context", &LSH_MultiProbe<VectorXd>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXd &, int64_t>(&LSH_MultiProbe<VectorXd>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXd> &>(&LSH_MultiProbe<VectorXd>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXd &, size_t>(&LSH_MultiProbe<VectorXd>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &>(&LSH_MultiProbe<VectorXd>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXd &, double, int64_t>(&LSH_MultiProbe<VectorXd>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXd> &, double>(&LSH_MultiProbe<VectorXd>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXd &, double, size_t>(&LSH_MultiProbe<VectorXd>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &, double>(&LSH_MultiProbe<VectorXd>::k_probe_approx_ids))
+      .def("lookup", &LSH_MultiProbe<VectorXd>::lookup)
       .def("stats", &LSH_MultiProbe<VectorXd>::print_stats);
 
   // float lsh
   py::class_<LSH_MultiProbe<VectorXf>>(m, "LSHProbeFloat")
       .def(py::init<int64_t, int64_t, size_t>())
+      .def(py::init<int64_t, int64_t, size_t, Addressing>())
       .def(py::init<int64_t, int64_t>())
       .def("fill", &LSH_MultiProbe<VectorXf>::fill<std::vector<VectorXf>>)
       .def("probe", &LSH_MultiProbe<VectorXf>::probe)
       .def("k_probe", &LSH_MultiProbe<VectorXf>::k_probe)
       .def("probe_approx", &LSH_MultiProbe<VectorXf>::probe_approx)
       .def("k_probe_approx", &LSH_MultiProbe<VectorXf>::k_probe_approx)
+      .def("context", &LSH_MultiProbe<VectorXf>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXf &, int64_t>(&LSH_MultiProbe<VectorXf>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXf> &>(&LSH_MultiProbe<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXf &, size_t>(&LSH_MultiProbe<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &>(&LSH_MultiProbe<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXf &, float, int64_t>(&LSH_MultiProbe<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXf> &, float>(&LSH_MultiProbe<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXf &, float, size_t>(&LSH_MultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &, float>(&LSH_MultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &LSH_MultiProbe<VectorXf>::lookup)
       .def("stats", &LSH_MultiProbe<VectorXf>::print_stats);
 
   // double lsh multi tables
   py::class_<LSH_MultiProbe_MultiTable<VectorXd>>(m, "LSHMultiTableProbeDouble")
       .def(py::init<int64_t, int64_t, int64_t, size_t>())
+      .def(py::init<int64_t, int64_t, int64_t, size_t, Addressing>())
+      .def("fill",
+           [](LSH_MultiProbe_MultiTable<VectorXd> &self, const Ref<const RowMatrix<double>> &rows,
+              bool is_normalized) { self.fill(rows, is_normalized); })
       .def("fill",
            &LSH_MultiProbe_MultiTable<VectorXd>::fill<std::vector<VectorXd>>)
       .def("probe", &LSH_MultiProbe_MultiTable<VectorXd>::probe)
@@ -109,11 +294,39 @@ PYBIND11_MODULE(nr_binding, m) {
       .def("probe_approx", &LSH_MultiProbe_MultiTable<VectorXd>::probe_approx)
       .def("k_probe_approx",
            &LSH_MultiProbe_MultiTable<VectorXd>::k_probe_approx)
+      .def("context",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, QueryContext<VectorXd>, const VectorXd &, int64_t>(&LSH_MultiProbe_MultiTable<VectorXd>::context))
+      .def("k_probe_ids_batch",
+           py::overload_cast<int64_t, const std::vector<VectorXd> &, size_t>(&LSH_MultiProbe_MultiTable<VectorXd>::k_probe_ids_batch))
+      .def("set_batch_width", &LSH_MultiProbe_MultiTable<VectorXd>::set_batch_width)
+      .def("set_parallelism",
+           &LSH_MultiProbe_MultiTable<VectorXd>::set_parallelism)
+      .def("probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, const VectorXd &, int64_t>(&LSH_MultiProbe_MultiTable<VectorXd>::probe_ids))
+      .def("probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, const QueryContext<VectorXd> &>(&LSH_MultiProbe_MultiTable<VectorXd>::probe_ids))
+      .def("k_probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, int64_t, const VectorXd &, size_t>(&LSH_MultiProbe_MultiTable<VectorXd>::k_probe_ids))
+      .def("k_probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, int64_t, const QueryContext<VectorXd> &>(&LSH_MultiProbe_MultiTable<VectorXd>::k_probe_ids))
+      .def("probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, const VectorXd &, double, int64_t>(&LSH_MultiProbe_MultiTable<VectorXd>::probe_approx_ids))
+      .def("probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, const QueryContext<VectorXd> &, double>(&LSH_MultiProbe_MultiTable<VectorXd>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, int64_t, const VectorXd &, double, size_t>(&LSH_MultiProbe_MultiTable<VectorXd>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXd>, ProbeOut<double>, int64_t, const QueryContext<VectorXd> &, double>(&LSH_MultiProbe_MultiTable<VectorXd>::k_probe_approx_ids))
+      .def("lookup", &LSH_MultiProbe_MultiTable<VectorXd>::lookup)
       .def("stats", &LSH_MultiProbe_MultiTable<VectorXd>::print_stats);
 
   // float lsh multi table
   py::class_<LSH_MultiProbe_MultiTable<VectorXf>>(m, "LSHMultiTableProbeFloat")
       .def(py::init<int64_t, int64_t, int64_t, size_t>())
+      .def(py::init<int64_t, int64_t, int64_t, size_t, Addressing>())
+      .def("fill",
+           [](LSH_MultiProbe_MultiTable<VectorXf> &self, const Ref<const RowMatrix<float>> &rows,
+              bool is_normalized) { self.fill(rows, is_normalized); })
       .def("fill",
            &LSH_MultiProbe_MultiTable<VectorXf>::fill<std::vector<VectorXf>>)
       .def("probe", &LSH_MultiProbe_MultiTable<VectorXf>::probe)
@@ -121,5 +334,211 @@ PYBIND11_MODULE(nr_binding, m) {
       .def("probe_approx", &LSH_MultiProbe_MultiTable<VectorXf>::probe_approx)
       .def("k_probe_approx",
            &LSH_MultiProbe_MultiTable<VectorXf>::k_probe_approx)
+      .def("context",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, QueryContext<VectorXf>, const VectorXf &, int64_t>(&LSH_MultiProbe_MultiTable<VectorXf>::context))
+      .def("k_probe_ids_batch",
+           py::overload_cast<int64_t, const std::vector<VectorXf> &, size_t>(&LSH_MultiProbe_MultiTable<VectorXf>::k_probe_ids_batch))
+      .def("set_batch_width", &LSH_MultiProbe_MultiTable<VectorXf>::set_batch_width)
+      .def("set_parallelism",
+           &LSH_MultiProbe_MultiTable<VectorXf>::set_parallelism)
+      .def("probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, const VectorXf &, int64_t>(&LSH_MultiProbe_MultiTable<VectorXf>::probe_ids))
+      .def("probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, const QueryContext<VectorXf> &>(&LSH_MultiProbe_MultiTable<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, int64_t, const VectorXf &, size_t>(&LSH_MultiProbe_MultiTable<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, int64_t, const QueryContext<VectorXf> &>(&LSH_MultiProbe_MultiTable<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, const VectorXf &, float, int64_t>(&LSH_MultiProbe_MultiTable<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, const QueryContext<VectorXf> &, float>(&LSH_MultiProbe_MultiTable<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, int64_t, const VectorXf &, float, size_t>(&LSH_MultiProbe_MultiTable<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           member<LSH_MultiProbe_MultiTable<VectorXf>, ProbeOut<float>, int64_t, const QueryContext<VectorXf> &, float>(&LSH_MultiProbe_MultiTable<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &LSH_MultiProbe_MultiTable<VectorXf>::lookup)
       .def("stats", &LSH_MultiProbe_MultiTable<VectorXf>::print_stats);
+
+  // hamming ranking, no buckets.
+  py::class_<HammingRankIndex<VectorXd>>(m, "HammingRankDouble")
+      .def(py::init<int64_t, int64_t>())
+      .def("fill", &HammingRankIndex<VectorXd>::fill<std::vector<VectorXd>>)
+      .def("probe", &HammingRankIndex<VectorXd>::probe)
+      .def("k_probe", &HammingRankIndex<VectorXd>::k_probe)
+      .def("probe_approx", &HammingRankIndex<VectorXd>::probe_approx)
+      .def("k_probe_approx", &HammingRankIndex<VectorXd>::k_probe_approx)
+      .def("context", &HammingRankIndex<VectorXd>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXd &, int64_t>(&HammingRankIndex<VectorXd>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXd> &>(&HammingRankIndex<VectorXd>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXd &, size_t>(&HammingRankIndex<VectorXd>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &>(&HammingRankIndex<VectorXd>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXd &, double, int64_t>(&HammingRankIndex<VectorXd>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXd> &, double>(&HammingRankIndex<VectorXd>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXd &, double, size_t>(&HammingRankIndex<VectorXd>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &, double>(&HammingRankIndex<VectorXd>::k_probe_approx_ids))
+      .def("lookup", &HammingRankIndex<VectorXd>::lookup)
+      .def("stats", &HammingRankIndex<VectorXd>::print_stats);
+
+  py::class_<HammingRankIndex<VectorXf>>(m, "HammingRankFloat")
+      .def(py::init<int64_t, int64_t>())
+      .def("fill", &HammingRankIndex<VectorXf>::fill<std::vector<VectorXf>>)
+      .def("probe", &HammingRankIndex<VectorXf>::probe)
+      .def("k_probe", &HammingRankIndex<VectorXf>::k_probe)
+      .def("probe_approx", &HammingRankIndex<VectorXf>::probe_approx)
+      .def("k_probe_approx", &HammingRankIndex<VectorXf>::k_probe_approx)
+      .def("context", &HammingRankIndex<VectorXf>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXf &, int64_t>(&HammingRankIndex<VectorXf>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXf> &>(&HammingRankIndex<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXf &, size_t>(&HammingRankIndex<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &>(&HammingRankIndex<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXf &, float, int64_t>(&HammingRankIndex<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXf> &, float>(&HammingRankIndex<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXf &, float, size_t>(&HammingRankIndex<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &, float>(&HammingRankIndex<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &HammingRankIndex<VectorXf>::lookup)
+      .def("stats", &HammingRankIndex<VectorXf>::print_stats);
+
+  // exact Hamming search on long codes.
+  py::class_<MultiIndexHashing<VectorXd>>(m, "MultiIndexDouble")
+      .def(py::init<int64_t, int64_t, int64_t>())
+      .def("fill", &MultiIndexHashing<VectorXd>::fill<std::vector<VectorXd>>)
+      .def("hash_code", &MultiIndexHashing<VectorXd>::hash_code)
+      .def("radius_search",
+           py::overload_cast<const VectorXd &, size_t>(&MultiIndexHashing<VectorXd>::radius_search))
+      .def("k_nearest",
+           py::overload_cast<int64_t, const VectorXd &>(&MultiIndexHashing<VectorXd>::k_nearest))
+      .def("k_probe_ids", &MultiIndexHashing<VectorXd>::k_probe_ids)
+      .def("lookup", &MultiIndexHashing<VectorXd>::lookup);
+
+  py::class_<MultiIndexHashing<VectorXf>>(m, "MultiIndexFloat")
+      .def(py::init<int64_t, int64_t, int64_t>())
+      .def("fill", &MultiIndexHashing<VectorXf>::fill<std::vector<VectorXf>>)
+      .def("hash_code", &MultiIndexHashing<VectorXf>::hash_code)
+      .def("radius_search",
+           py::overload_cast<const VectorXf &, size_t>(&MultiIndexHashing<VectorXf>::radius_search))
+      .def("k_nearest",
+           py::overload_cast<int64_t, const VectorXf &>(&MultiIndexHashing<VectorXf>::k_nearest))
+      .def("k_probe_ids", &MultiIndexHashing<VectorXf>::k_probe_ids)
+      .def("lookup", &MultiIndexHashing<VectorXf>::lookup);
+
+  // prefix trees, no bucket count to tune.
+  py::class_<LSH_Forest<VectorXd>>(m, "LSHForestDouble")
+      .def(py::init<int64_t, int64_t, int64_t>())
+      .def("fill", &LSH_Forest<VectorXd>::fill<std::vector<VectorXd>>)
+      .def("probe", &LSH_Forest<VectorXd>::probe)
+      .def("k_probe", &LSH_Forest<VectorXd>::k_probe)
+      .def("probe_approx", &LSH_Forest<VectorXd>::probe_approx)
+      .def("k_probe_approx", &LSH_Forest<VectorXd>::k_probe_approx)
+      .def("context", &LSH_Forest<VectorXd>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXd &, int64_t>(&LSH_Forest<VectorXd>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXd> &>(&LSH_Forest<VectorXd>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXd &, size_t>(&LSH_Forest<VectorXd>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &>(&LSH_Forest<VectorXd>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXd &, double, int64_t>(&LSH_Forest<VectorXd>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXd> &, double>(&LSH_Forest<VectorXd>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXd &, double, size_t>(&LSH_Forest<VectorXd>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXd> &, double>(&LSH_Forest<VectorXd>::k_probe_approx_ids))
+      .def("lookup", &LSH_Forest<VectorXd>::lookup)
+      .def("stats", &LSH_Forest<VectorXd>::print_stats);
+
+  py::class_<LSH_Forest<VectorXf>>(m, "LSHForestFloat")
+      .def(py::init<int64_t, int64_t, int64_t>())
+      .def("fill", &LSH_Forest<VectorXf>::fill<std::vector<VectorXf>>)
+      .def("probe", &LSH_Forest<VectorXf>::probe)
+      .def("k_probe", &LSH_Forest<VectorXf>::k_probe)
+      .def("probe_approx", &LSH_Forest<VectorXf>::probe_approx)
+      .def("k_probe_approx", &LSH_Forest<VectorXf>::k_probe_approx)
+      .def("context", &LSH_Forest<VectorXf>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXf &, int64_t>(&LSH_Forest<VectorXf>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXf> &>(&LSH_Forest<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXf &, size_t>(&LSH_Forest<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &>(&LSH_Forest<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXf &, float, int64_t>(&LSH_Forest<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXf> &, float>(&LSH_Forest<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXf &, float, size_t>(&LSH_Forest<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &, float>(&LSH_Forest<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &LSH_Forest<VectorXf>::lookup)
+      .def("stats", &LSH_Forest<VectorXf>::print_stats);
+
+  // any float table behind one type, for code that picks the table at run
+  // time. The classes above call the tables directly.
+  py::class_<AnyMultiProbe<VectorXf>>(m, "IndexFloat")
+      .def_static("nr",
+                  [](int64_t num_tables, int64_t num_partitions, int64_t bits,
+                     int64_t dim, size_t num_buckets) {
+                    return AnyMultiProbe<VectorXf>::make<NR_MultiProbe<VectorXf>>(
+                        num_tables, num_partitions, bits, dim, num_buckets);
+                  })
+      .def_static("lsh_multi",
+                  [](int64_t num_tables, int64_t bits, int64_t dim,
+                     size_t num_buckets) {
+                    return AnyMultiProbe<VectorXf>::make<
+                        LSH_MultiProbe_MultiTable<VectorXf>>(num_tables, bits,
+                                                             dim, num_buckets);
+                  })
+      .def_static("hamming_rank",
+                  [](int64_t bits, int64_t dim) {
+                    return AnyMultiProbe<VectorXf>::make<
+                        HammingRankIndex<VectorXf>>(bits, dim);
+                  })
+      .def_static("lsh_forest",
+                  [](int64_t num_trees, int64_t bits, int64_t dim) {
+                    return AnyMultiProbe<VectorXf>::make<LSH_Forest<VectorXf>>(
+                        num_trees, bits, dim);
+                  })
+      .def("fill", &AnyMultiProbe<VectorXf>::fill)
+      .def("context", &AnyMultiProbe<VectorXf>::context)
+      .def("probe_ids",
+           py::overload_cast<const VectorXf &, int64_t>(&AnyMultiProbe<VectorXf>::probe_ids))
+      .def("probe_ids",
+           py::overload_cast<const QueryContext<VectorXf> &>(&AnyMultiProbe<VectorXf>::probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const VectorXf &, size_t>(&AnyMultiProbe<VectorXf>::k_probe_ids))
+      .def("k_probe_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &>(&AnyMultiProbe<VectorXf>::k_probe_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const VectorXf &, float, int64_t>(&AnyMultiProbe<VectorXf>::probe_approx_ids))
+      .def("probe_approx_ids",
+           py::overload_cast<const QueryContext<VectorXf> &, float>(&AnyMultiProbe<VectorXf>::probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const VectorXf &, float, size_t>(&AnyMultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("k_probe_approx_ids",
+           py::overload_cast<int64_t, const QueryContext<VectorXf> &, float>(&AnyMultiProbe<VectorXf>::k_probe_approx_ids))
+      .def("lookup", &AnyMultiProbe<VectorXf>::lookup)
+      .def("contains", &AnyMultiProbe<VectorXf>::contains)
+      .def("num_tables", &AnyMultiProbe<VectorXf>::num_tables)
+      .def("stats", &AnyMultiProbe<VectorXf>::print_stats);
 }
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/*
+ * How a hash code is reduced to a bucket index.
+ * Modulo: bucket = code % num_buckets. Works for any number of buckets, but
+ *   unless num_buckets is a power of two, buckets that are close in index
+ *   space are unrelated in code space, so probing by flipping bits of the
+ *   bucket index visits essentially random buckets.
+ * LowBits: bucket = the low log2(num_buckets) bits of the code.
+ *   num_buckets must be a power of two no larger than 2^bits. Flipping bits
+ *   of the bucket index flips bits of the code, so Hamming based probing
+ *   visits the buckets nearest the query's code. code % num_buckets is the
+ *   low bits when num_buckets is a power of two, so hashing is unchanged.
+ */
+
+namespace nr {
+
+enum class Addressing { Modulo, LowBits };
+
+inline bool is_power_of_two(size_t n) { return n != 0 && (n & (n - 1)) == 0; }
+
+inline size_t address_bits(size_t num_buckets, Addressing addressing) {
+  /*
+   * number of low bits of a bucket index that the probe ranking compares.
+   */
+  if (addressing == Addressing::LowBits) {
+    size_t bits = 0;
+    while ((size_t(1) << bits) < num_buckets) {
+      ++bits;
+    }
+    return bits;
+  }
+  // Modulo indices are not code bits, so compare one bit more than the
+  // largest index needs.
+  return std::floor(std::log2(num_buckets)) + 1;
+}
+
+inline void check_addressing(size_t num_buckets, int64_t bits,
+                             Addressing addressing, const std::string &who) {
+  /*
+   * throws if num_buckets can't be addressed with the low bits of a code.
+   */
+  if (addressing != Addressing::LowBits)
+    return;
+  if (!is_power_of_two(num_buckets)) {
+    throw std::runtime_error(
+        who + ", LowBits addressing needs a power of two num_buckets");
+  }
+  if (address_bits(num_buckets, addressing) > static_cast<size_t>(bits)) {
+    throw std::runtime_error(
+        who + ", LowBits addressing needs num_buckets <= 2^bits");
+  }
+}
+
+} // namespace nr
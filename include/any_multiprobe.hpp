@@ -0,0 +1,170 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "multiprobe.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
+#include "stat_tracker.hpp"
+
+/*
+ * Type erased handle to any table with the MultiProbe interface.
+ * The tables themselves are not virtual. This wrapper puts one virtual call
+ * in front of each probe, which is fine where the table type is only known
+ * at run time, like the Python bindings. C++ code that knows its table type
+ * should use the table directly so probes and hashing can be inlined.
+ */
+
+namespace nr {
+
+template <typename Vect> class AnyMultiProbe {
+private:
+  using Component = typename Vect::value_type;
+  using Result = std::pair<ProbeResult<Component>, StatTracker>;
+
+  struct Concept {
+    virtual ~Concept() = default;
+    virtual void fill(const std::vector<Vect> &data, bool is_normalized) = 0;
+    virtual Result probe_ids(const Vect &q, int64_t adj) = 0;
+    virtual Result k_probe_ids(int64_t k, const Vect &q, size_t adj) = 0;
+    virtual Result probe_approx_ids(const Vect &q, Component c,
+                                    int64_t adj) = 0;
+    virtual Result k_probe_approx_ids(int64_t k, const Vect &q, Component c,
+                                      size_t adj) = 0;
+    virtual QueryContext<Vect> context(const Vect &q, int64_t adj) = 0;
+    virtual Result probe_ids(const QueryContext<Vect> &ctx) = 0;
+    virtual Result k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) = 0;
+    virtual Result probe_approx_ids(const QueryContext<Vect> &ctx,
+                                    Component c) = 0;
+    virtual Result k_probe_approx_ids(int64_t k,
+                                      const QueryContext<Vect> &ctx,
+                                      Component c) = 0;
+    virtual const Vect &lookup(int64_t id) const = 0;
+    virtual bool contains(const Vect &q) = 0;
+    virtual void print_stats() = 0;
+    virtual size_t num_tables() const = 0;
+  };
+
+  template <typename Index> struct Model : Concept {
+    Index index;
+
+    template <typename... Args>
+    explicit Model(Args &&... args) : index(std::forward<Args>(args)...) {}
+
+    void fill(const std::vector<Vect> &data, bool is_normalized) {
+      index.fill(data, is_normalized);
+    }
+    Result probe_ids(const Vect &q, int64_t adj) {
+      return index.probe_ids(q, adj);
+    }
+    Result k_probe_ids(int64_t k, const Vect &q, size_t adj) {
+      return index.k_probe_ids(k, q, adj);
+    }
+    Result probe_approx_ids(const Vect &q, Component c, int64_t adj) {
+      return index.probe_approx_ids(q, c, adj);
+    }
+    Result k_probe_approx_ids(int64_t k, const Vect &q, Component c,
+                              size_t adj) {
+      return index.k_probe_approx_ids(k, q, c, adj);
+    }
+    QueryContext<Vect> context(const Vect &q, int64_t adj) {
+      return index.context(q, adj);
+    }
+    Result probe_ids(const QueryContext<Vect> &ctx) {
+      return index.probe_ids(ctx);
+    }
+    Result k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) {
+      return index.k_probe_ids(k, ctx);
+    }
+    Result probe_approx_ids(const QueryContext<Vect> &ctx, Component c) {
+      return index.probe_approx_ids(ctx, c);
+    }
+    Result k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx,
+                              Component c) {
+      return index.k_probe_approx_ids(k, ctx, c);
+    }
+    const Vect &lookup(int64_t id) const { return index.lookup(id); }
+    bool contains(const Vect &q) { return index.contains(q); }
+    void print_stats() { index.print_stats(); }
+    size_t num_tables() const { return index.num_tables(); }
+  };
+
+  std::unique_ptr<Concept> table;
+
+  explicit AnyMultiProbe(std::unique_ptr<Concept> table)
+      : table(std::move(table)) {}
+
+public:
+  template <typename Index, typename... Args>
+  static AnyMultiProbe make(Args &&... args) {
+    /*
+     * constructs an Index from args inside the wrapper, so tables that
+     * can't be copied or moved can still be wrapped.
+     */
+    static_assert(is_multiprobe<Index, Vect>::value,
+                  "AnyMultiProbe needs a table with the MultiProbe interface");
+    return AnyMultiProbe(
+        std::make_unique<Model<Index>>(std::forward<Args>(args)...));
+  }
+
+  template <typename Index> Index *target() {
+    // the wrapped table, or nullptr if it is not an Index.
+    auto *model = dynamic_cast<Model<Index> *>(table.get());
+    return model ? &model->index : nullptr;
+  }
+
+  void fill(const std::vector<Vect> &data, bool is_normalized) {
+    table->fill(data, is_normalized);
+  }
+
+  Result probe_ids(const Vect &q, int64_t adj) {
+    return table->probe_ids(q, adj);
+  }
+
+  Result k_probe_ids(int64_t k, const Vect &q, size_t adj) {
+    return table->k_probe_ids(k, q, adj);
+  }
+
+  Result probe_approx_ids(const Vect &q, Component c, int64_t adj) {
+    return table->probe_approx_ids(q, c, adj);
+  }
+
+  Result k_probe_approx_ids(int64_t k, const Vect &q, Component c,
+                            size_t adj) {
+    return table->k_probe_approx_ids(k, q, c, adj);
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) {
+    return table->context(q, adj);
+  }
+
+  Result probe_ids(const QueryContext<Vect> &ctx) {
+    return table->probe_ids(ctx);
+  }
+
+  Result k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) {
+    return table->k_probe_ids(k, ctx);
+  }
+
+  Result probe_approx_ids(const QueryContext<Vect> &ctx, Component c) {
+    return table->probe_approx_ids(ctx, c);
+  }
+
+  Result k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx,
+                            Component c) {
+    return table->k_probe_approx_ids(k, ctx, c);
+  }
+
+  const Vect &lookup(int64_t id) const { return table->lookup(id); }
+
+  bool contains(const Vect &q) { return table->contains(q); }
+
+  void print_stats() { table->print_stats(); }
+
+  size_t num_tables() const { return table->num_tables(); }
+};
+
+} // namespace nr
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "probe_result.hpp"
+#include "stat_tracker.hpp"
+
+/*
+ * Asynchronous front end for an index with a batched probe path
+ * (NR_MultiProbe, LSH_MultiProbe_MultiTable).
+ * Many threads can submit queries. One dispatcher thread gathers them into
+ * micro batches, hashes each batch with one matrix product per hash
+ * function, and probes it with k_probe_ids_batch. A batch is sent once it
+ * has max_batch queries or its oldest query has waited max_wait.
+ * Only the dispatcher touches the index, so the index does not need to be
+ * thread safe. The index must outlive the prober, and must not be probed
+ * directly while the prober is running.
+ */
+
+namespace nr {
+
+template <typename Index> class AsyncProber {
+private:
+  using Vect =
+      std::decay_t<decltype(std::declval<const Index &>().lookup(0))>;
+  using Component = typename Vect::value_type;
+  using Result = std::pair<ProbeResult<Component>, StatTracker>;
+
+  struct Pending {
+    Vect query;
+    std::promise<Result> promise;
+  };
+
+  Index &index;
+  int64_t k;
+  int64_t adj;
+  size_t max_batch;
+  std::chrono::microseconds max_wait;
+
+  std::deque<Pending> queue;
+  std::mutex lock;
+  std::condition_variable arrived;
+  bool stopping = false;
+  size_t batches = 0;
+  size_t queries = 0; // summed over the batches.
+  std::thread dispatcher;
+
+  std::vector<Pending> next_batch() {
+    /*
+     * waits for a query, then until the batch is full or the first query
+     * has waited max_wait. Returns an empty batch once stopped and drained.
+     */
+    std::unique_lock<std::mutex> guard(lock);
+    arrived.wait(guard, [this] { return stopping || !queue.empty(); });
+    if (queue.empty())
+      return {};
+    const auto deadline = std::chrono::steady_clock::now() + max_wait;
+    arrived.wait_until(guard, deadline, [this] {
+      return stopping || queue.size() >= max_batch;
+    });
+    std::vector<Pending> batch(0);
+    batch.reserve(std::min(queue.size(), max_batch));
+    while (!queue.empty() && batch.size() < max_batch) {
+      batch.push_back(std::move(queue.front()));
+      queue.pop_front();
+    }
+    ++batches;
+    queries += batch.size();
+    return batch;
+  }
+
+  void dispatch() {
+    while (true) {
+      std::vector<Pending> batch = next_batch();
+      if (batch.empty())
+        return;
+      std::vector<Vect> qs(0);
+      qs.reserve(batch.size());
+      for (const Pending &pending : batch) {
+        qs.push_back(pending.query);
+      }
+      try {
+        auto results = index.k_probe_ids_batch(k, index.contexts(qs, adj));
+        for (size_t i = 0; i < batch.size(); ++i) {
+          batch.at(i).promise.set_value(std::move(results.at(i)));
+        }
+      } catch (...) {
+        for (Pending &pending : batch) {
+          pending.promise.set_exception(std::current_exception());
+        }
+      }
+    }
+  }
+
+public:
+  AsyncProber(Index &index, int64_t k, int64_t adj, size_t max_batch = 32,
+              std::chrono::microseconds max_wait =
+                  std::chrono::microseconds(200))
+      : index(index), k(k), adj(adj), max_batch(max_batch),
+        max_wait(max_wait) {
+    if (k < 1)
+      throw std::runtime_error("AsyncProber, k < 1");
+    if (max_batch < 1)
+      throw std::runtime_error("AsyncProber, max_batch < 1");
+    dispatcher = std::thread([this] { dispatch(); });
+  }
+
+  AsyncProber(const AsyncProber &) = delete;
+  AsyncProber &operator=(const AsyncProber &) = delete;
+
+  ~AsyncProber() {
+    // queries already submitted are still answered.
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    arrived.notify_all();
+    dispatcher.join();
+  }
+
+  std::future<Result> submit(const Vect &q) {
+    /*
+     * queues q and returns a future for the ids and inner products (or
+     * distances) of its k best items, as k_probe_ids(k, q, adj) would.
+     */
+    Pending pending{q, std::promise<Result>()};
+    std::future<Result> result = pending.promise.get_future();
+    bool wake;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stopping)
+        throw std::runtime_error("AsyncProber::submit, prober is stopping");
+      queue.push_back(std::move(pending));
+      // the dispatcher only waits for the first query of a batch, or for
+      // the batch to fill up.
+      wake = queue.size() == 1 || queue.size() >= max_batch;
+    }
+    if (wake)
+      arrived.notify_one();
+    return result;
+  }
+
+  size_t batches_sent() {
+    // number of batches probed so far.
+    std::lock_guard<std::mutex> guard(lock);
+    return batches;
+  }
+
+  size_t queries_sent() {
+    // number of queries in those batches.
+    std::lock_guard<std::mutex> guard(lock);
+    return queries;
+  }
+};
+
+} // namespace nr
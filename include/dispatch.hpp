@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Kernels compiled for several instruction sets and picked at load time.
+ * The Makefile builds without -march, so a plain build only uses SSE2.
+ * With GCC on x86-64 Linux, NR_DISPATCH makes the compiler emit one clone
+ * of a kernel per listed target plus a resolver that picks the best one
+ * the CPU supports (function multiversioning), so one binary runs at AVX2
+ * or AVX-512 width wherever it is deployed. Elsewhere, or when built with
+ * -DNR_NO_DISPATCH, the kernels are compiled once for the build target.
+ *
+ * Loops are written with independent partial sums so each clone can keep
+ * them in one vector register without reassociating floating point math.
+ * Fixed size Eigen vectors, such as Matrix<float, 128, 1>, use kernels with
+ * the length as a template argument, so every clone is fully unrolled.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) &&     \
+    defined(__linux__) && !defined(NR_NO_DISPATCH)
+#define NR_DISPATCH(...) __attribute__((target_clones(__VA_ARGS__)))
+#define NR_HAS_DISPATCH 1
+#else
+#define NR_DISPATCH(...)
+#define NR_HAS_DISPATCH 0
+#endif
+
+namespace nr {
+
+inline std::string dispatch_target() {
+  // the instruction set the dispatched kernels run with on this CPU.
+#if NR_HAS_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return "avx512f";
+  if (__builtin_cpu_supports("avx2"))
+    return "avx2";
+#endif
+  return "default";
+}
+
+namespace kernels {
+
+// lanes of partial sums. 16 floats fill an AVX-512 register.
+constexpr size_t lanes = 16;
+
+template <typename T> inline T dot(const T *x, const T *y, size_t n) {
+  T partial[lanes] = {};
+  size_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    for (size_t l = 0; l < lanes; ++l) {
+      partial[l] += x[i + l] * y[i + l];
+    }
+  }
+  T sum = 0;
+  for (size_t l = 0; l < lanes; ++l) {
+    sum += partial[l];
+  }
+  for (; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+template <typename T>
+inline T squared_distance(const T *x, const T *y, size_t n) {
+  T partial[lanes] = {};
+  size_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    for (size_t l = 0; l < lanes; ++l) {
+      const T diff = x[i + l] - y[i + l];
+      partial[l] += diff * diff;
+    }
+  }
+  T sum = 0;
+  for (size_t l = 0; l < lanes; ++l) {
+    sum += partial[l];
+  }
+  for (; i < n; ++i) {
+    const T diff = x[i] - y[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+template <typename T>
+inline void pack_signs(const T *projections, size_t n, uint64_t *out,
+                       size_t words) {
+  // bit i of out is set when projections[i] >= 0.
+  for (size_t w = 0; w < words; ++w) {
+    const size_t begin = w * 64;
+    const size_t end = begin + 64 < n ? begin + 64 : n;
+    uint64_t word = 0;
+    for (size_t i = begin; i < end; ++i) {
+      word |= static_cast<uint64_t>(projections[i] >= 0) << (i - begin);
+    }
+    out[w] = word;
+  }
+}
+
+} // namespace kernels
+
+// the dispatched entry points. Each is cloned for every target listed.
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline float dot(const float *x, const float *y, size_t n) {
+  return kernels::dot(x, y, n);
+}
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline double dot(const double *x, const double *y, size_t n) {
+  return kernels::dot(x, y, n);
+}
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline float squared_distance(const float *x, const float *y, size_t n) {
+  return kernels::squared_distance(x, y, n);
+}
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline double squared_distance(const double *x, const double *y, size_t n) {
+  return kernels::squared_distance(x, y, n);
+}
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline void pack_signs(const float *projections, size_t n, uint64_t *out,
+                       size_t words) {
+  kernels::pack_signs(projections, n, out, words);
+}
+
+NR_DISPATCH("avx512f", "avx2", "default")
+inline void pack_signs(const double *projections, size_t n, uint64_t *out,
+                       size_t words) {
+  kernels::pack_signs(projections, n, out, words);
+}
+
+// kernels for vectors of a length known at compile time.
+
+template <size_t N, typename T>
+NR_DISPATCH("avx512f", "avx2", "default")
+inline T dot(const T *x, const T *y) {
+  return kernels::dot(x, y, N);
+}
+
+template <size_t N, typename T>
+NR_DISPATCH("avx512f", "avx2", "default")
+inline T squared_distance(const T *x, const T *y) {
+  return kernels::squared_distance(x, y, N);
+}
+
+template <typename Vect>
+typename Vect::value_type dot(const Vect &x, const Vect &y) {
+  // x.dot(y) through the dispatched kernel. Like Eigen, sizes are only
+  // checked in debug builds.
+  assert(x.size() == y.size());
+  if constexpr (Vect::SizeAtCompileTime > 0) {
+    return dot<Vect::SizeAtCompileTime>(x.data(), y.data());
+  } else {
+    return dot(x.data(), y.data(), static_cast<size_t>(x.size()));
+  }
+}
+
+template <typename Vect>
+typename Vect::value_type distance(const Vect &x, const Vect &y) {
+  // (x - y).norm() through the dispatched kernel.
+  assert(x.size() == y.size());
+  if constexpr (Vect::SizeAtCompileTime > 0) {
+    return std::sqrt(
+        squared_distance<Vect::SizeAtCompileTime>(x.data(), y.data()));
+  } else {
+    return std::sqrt(
+        squared_distance(x.data(), y.data(), static_cast<size_t>(x.size())));
+  }
+}
+
+} // namespace nr
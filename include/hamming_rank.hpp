@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "multiprobe.hpp"
+#include "popcount.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
+#include "simple_lsh.hpp"
+#include "stat_tracker.hpp"
+
+/*
+ * Hamming ranking index.
+ * Rather than putting items into buckets, every item's full sign code is
+ * stored in one contiguous array. A query is compared to every code with
+ * popcount, and only the adj items with the smallest Hamming distance are
+ * rescored with exact inner products.
+ * Cost per query is the same no matter how the data is distributed, since
+ * there are no buckets to be skewed. Works well for catalogs that are small
+ * enough that scanning all codes is cheap.
+ * Hash must be a sign family (SignLSH or SimpleLSH).
+ */
+
+namespace nr {
+
+template <typename Vect,
+          typename Hash = SimpleLSH<typename Vect::value_type,
+                                    Vect::RowsAtCompileTime>>
+class HammingRankIndex : public MultiProbe<HammingRankIndex<Vect, Hash>, Vect> {
+private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
+  using Component = typename Vect::value_type;
+  using KV = std::pair<Vect, int64_t>;
+  using IdScore = std::pair<int64_t, Component>;
+
+  Hash hash_function;
+  size_t words;                // 64 bit words per code.
+  std::vector<uint64_t> codes; // code of item i starts at codes[i * words].
+  std::vector<Vect> items;     // item i has id i.
+  std::vector<uint32_t> distances; // scratch space for ranking.
+
+  static void sort_best_last(std::vector<IdScore> &found) {
+    // smallest inner product in front, like NR_MultiProbe.
+    std::sort(found.begin(), found.end(),
+              [](const IdScore &x, const IdScore &y) {
+                return x.second < y.second;
+              });
+  }
+
+public:
+  HammingRankIndex(int64_t bits, int64_t dimension)
+      : hash_function(bits, dimension), words(code_words(bits)), codes(0),
+        items(0), distances(0) {}
+
+  template <typename Cont>
+  void fill(const Cont &data, bool is_normalized = false) {
+    /*
+     * stores the code of every item in data. Ids are positions in data.
+     * Unless is_normalized, items are scaled by the largest norm before they
+     * are hashed so SimpleLSH can hash them. The originals are kept for
+     * rescoring.
+     */
+    Component max_norm = 0;
+    if (!is_normalized) {
+      for (const auto &datum : data) {
+        max_norm = std::max(max_norm, datum.norm());
+      }
+    }
+    if (max_norm <= 0)
+      max_norm = 1;
+    items.assign(data.begin(), data.end());
+    codes.assign(items.size() * words, 0);
+    distances.resize(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+      const Vect scaled = items.at(i) / max_norm;
+      pack_signs(hash_function.project(scaled), codes.data() + i * words,
+                 words);
+    }
+  }
+
+  std::vector<int64_t> rank(const std::vector<uint64_t> &query_code,
+                            int64_t adj) {
+    /*
+     * ids of the adj items whose codes are nearest to query_code, nearest
+     * first. Ties are broken by id. Distances are at most bits, so a counting
+     * pass finds the cut off distance without sorting all items.
+     */
+    const size_t n = items.size();
+    const size_t limit =
+        std::min(n, static_cast<size_t>(std::max<int64_t>(adj, 0)));
+    hamming_distances(query_code.data(), codes.data(), words, n,
+                      distances.data());
+
+    std::vector<size_t> counts(words * 64 + 2, 0);
+    for (size_t i = 0; i < n; ++i) {
+      ++counts.at(distances[i] + 1);
+    }
+    // counts[d] becomes the number of items closer than d.
+    for (size_t d = 1; d < counts.size(); ++d) {
+      counts.at(d) += counts.at(d - 1);
+    }
+
+    std::vector<int64_t> ranked(limit, 0);
+    for (size_t i = 0; i < n; ++i) {
+      const size_t pos = counts.at(distances[i])++;
+      if (pos < limit)
+        ranked.at(pos) = static_cast<int64_t>(i);
+    }
+    return ranked;
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) {
+    /*
+     * hashes q and ranks all items by Hamming distance. The probe sequence
+     * holds the ids of the adj nearest items rather than buckets.
+     */
+    QueryContext<Vect> ctx(q);
+    HashedQuery<Vect> hashed = hash_query(hash_function, ctx.normalized(), 1);
+    hashed.probe_sequence = rank(pack_signs(hashed.projections), adj);
+    ctx.hashes.push_back(hashed);
+    return ctx;
+  }
+
+  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q,
+                                                  int64_t adj) {
+    /*
+     * returns the vector with the largest inner product with q among the
+     * adj items nearest q in Hamming distance.
+     */
+    auto found = probe_ids(q, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {std::make_optional(KV{lookup(id), id}), found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) {
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) {
+    StatTracker tracker;
+    ProbeResult<Component> result;
+    int64_t best = -1;
+    Component largest = std::numeric_limits<Component>::lowest();
+    for (const int64_t id : ctx.hashes.at(0).probe_sequence) {
+      tracker.incr_comparisons();
+      const Component inner = ctx.query.dot(items.at(id));
+      if (inner > largest) {
+        best = id;
+        largest = inner;
+      }
+    }
+    if (best >= 0)
+      result.push_back(best, largest);
+    return {result, tracker};
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  k_probe(int64_t k, const Vect &q, size_t adj) {
+    /*
+     * returns the k vectors with the largest inner products with q among the
+     * adj items nearest q in Hamming distance.
+     */
+    return ids_to_kvs(k_probe_ids(k, q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t adj) {
+    /*
+     * ids and inner products of the k best rescored items.
+     * Output is ordered smallest to largest inner product.
+     */
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) {
+    if (k < 1)
+      throw std::runtime_error("HammingRankIndex::k_probe, k < 1");
+    StatTracker tracker;
+    const auto &candidates = ctx.hashes.at(0).probe_sequence;
+    std::vector<IdScore> scored(0);
+    scored.reserve(candidates.size());
+    for (const int64_t id : candidates) {
+      tracker.incr_comparisons();
+      scored.push_back({id, ctx.query.dot(items.at(id))});
+    }
+    const size_t keep = std::min(scored.size(), static_cast<size_t>(k));
+    std::partial_sort(scored.begin(), scored.begin() + keep, scored.end(),
+                      [](const IdScore &x, const IdScore &y) {
+                        return x.second > y.second;
+                      });
+    scored.resize(keep);
+    sort_best_last(scored);
+    return {ProbeResult<Component>::from_pairs(scored), tracker};
+  }
+
+  std::pair<std::optional<KV>, StatTracker>
+  probe_approx(const Vect &q, Component c, int64_t adj) {
+    /*
+     * returns the first of the adj Hamming nearest items that has an inner
+     * product with q greater than c.
+     */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {std::make_optional(KV{lookup(id), id}), found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) {
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) {
+    StatTracker tracker;
+    ProbeResult<Component> result;
+    for (const int64_t id : ctx.hashes.at(0).probe_sequence) {
+      tracker.incr_comparisons();
+      const Component inner = ctx.query.dot(items.at(id));
+      if (inner > c) {
+        result.push_back(id, inner);
+        break;
+      }
+    }
+    return {result, tracker};
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) {
+    /*
+     * returns the first k of the adj Hamming nearest items that have an
+     * inner product with q greater than c.
+     */
+    return ids_to_kvs(k_probe_approx_ids(k, q, c, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c, size_t adj) {
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx, Component c) {
+    if (k < 1)
+      throw std::runtime_error("HammingRankIndex::k_probe_approx, k < 1");
+    StatTracker tracker;
+    std::vector<IdScore> found(0);
+    for (const int64_t id : ctx.hashes.at(0).probe_sequence) {
+      tracker.incr_comparisons();
+      const Component inner = ctx.query.dot(items.at(id));
+      if (inner > c) {
+        found.push_back({id, inner});
+        if (found.size() == static_cast<size_t>(k))
+          break;
+      }
+    }
+    sort_best_last(found);
+    return {ProbeResult<Component>::from_pairs(found), tracker};
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  ids_to_kvs(const std::pair<ProbeResult<Component>, StatTracker> &found) const {
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    return {std::make_optional(result_to_kvs<KV>(
+                found.first, [this](int64_t id) { return lookup(id); })),
+            found.second};
+  }
+
+  const Vect &lookup(int64_t id) const {
+    if (id < 0 || static_cast<size_t>(id) >= items.size())
+      throw std::out_of_range("HammingRankIndex::lookup(id) id not in index.");
+    return items.at(id);
+  }
+
+  bool contains(const Vect &q) {
+    for (const Vect &item : items) {
+      if (item.isApprox(q))
+        return true;
+    }
+    return false;
+  }
+
+  const uint64_t *code(int64_t id) const {
+    // packed code of the item with the given id.
+    return codes.data() + static_cast<size_t>(id) * words;
+  }
+
+  size_t words_per_code() const { return words; }
+
+  size_t size() const { return items.size(); }
+
+  void print_stats() {}
+
+  size_t num_tables() const { return 1; }
+};
+
+} // namespace nr
@@ -7,11 +7,15 @@
 #include <cmath>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <numeric>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include "index_builder.hpp"
 #include "simple_lsh.hpp"
+#include "thread_pool.hpp"
 
 /*
  * Contains operations for "index-building" for NR-LSH
@@ -20,23 +24,35 @@
 namespace mp = boost::multiprecision;
 namespace nr {
 
+/*
+ * How the dataset is cut into partitions by norm.
+ * EqualCount: every partition has n / m items, the largest norms last.
+ * LogNorm: the range of norms is cut into m ranges of equal width in
+ *   log(norm). Partitions can hold very different numbers of items, or none.
+ */
+enum class Partitioning { EqualCount, LogNorm };
+
 struct IndexBuilder {
   template <typename VectCont, typename Hash>
   static auto build(const VectCont &data, int64_t m, int64_t num_buckets,
-                    Hash hash) {
+                    Hash hash,
+                    Partitioning partitioning = Partitioning::EqualCount,
+                    ThreadPool *pool = nullptr) {
     /*
      * The main "building" function. This is really the only one that should
-     * be called.
+     * be called. With a pool, the norms and the partitioning run on it.
      */
-    using Component = typename VectCont::value_type::value_type;
-    auto parts = IndexBuilder::partitioner(data, m);
+    const auto data_norms = IndexBuilder::norms(data, pool);
+    auto parts = partitioning == Partitioning::LogNorm
+                     ? IndexBuilder::log_norm_partitions(data_norms, m)
+                     : IndexBuilder::select_partitions(data_norms, m, pool);
     auto normal_data_and_U = IndexBuilder::normalizer(data, parts);
-    auto normal_data = normal_data_and_U.first;
-    auto normalizers = normal_data_and_U.second;
+    auto normal_data = std::move(normal_data_and_U.first);
+    auto normalizers = std::move(normal_data_and_U.second);
     auto indices =
-        IndexBuilder::simple_LSH_partitions<decltype(normal_data), Component>(
-            normal_data, hash, num_buckets);
-    return std::make_tuple(parts, normal_data, normalizers, indices);
+        IndexBuilder::simple_LSH_partitions(normal_data, hash, num_buckets);
+    return std::make_tuple(std::move(parts), std::move(normal_data),
+                           std::move(normalizers), std::move(indices));
   }
 
   template <typename VectCont, typename IntCont>
@@ -56,9 +72,9 @@ struct IndexBuilder {
     return max;
   }
 
-  template <template <typename Vect> typename VectCont, typename Vect>
-  static std::vector<int64_t> rank_by_norm(const VectCont<Vect> &dataset) {
-    using Component = typename Vect::value_type;
+  template <typename VectCont>
+  static std::vector<int64_t> rank_by_norm(const VectCont &dataset) {
+    using Component = typename VectCont::value_type::value_type;
     std::vector<Component> norms(dataset.size());
     for (size_t i = 0; i < norms.size(); ++i) {
       norms.at(i) = dataset.at(i).norm();
@@ -67,12 +83,139 @@ struct IndexBuilder {
     std::iota(ranking.begin(), ranking.end(), 0);
     // rank the vectors in dataset based on their norms
     // ascending order
-    std::sort(ranking.begin(), ranking.end(), [norms](int64_t x, int64_t y) {
+    std::sort(ranking.begin(), ranking.end(), [&norms](int64_t x, int64_t y) {
       return norms.at(x) < norms.at(y);
     });
     return ranking;
   }
 
+  template <typename VectCont>
+  static auto norms(const VectCont &dataset, ThreadPool *pool = nullptr) {
+    /*
+     * the norm of every item. With a pool, chunks of items are done in
+     * parallel.
+     */
+    using Component = typename VectCont::value_type::value_type;
+    constexpr size_t chunk = 4096;
+    std::vector<Component> result(dataset.size());
+    auto norm_chunk = [&](size_t c) {
+      const size_t end = std::min(result.size(), (c + 1) * chunk);
+      for (size_t i = c * chunk; i < end; ++i) {
+        result[i] = dataset.at(i).norm();
+      }
+    };
+    const size_t num_chunks = (result.size() + chunk - 1) / chunk;
+    if (pool != nullptr) {
+      pool->parallel_for(num_chunks, pool->size() + 1, norm_chunk);
+    } else {
+      for (size_t c = 0; c < num_chunks; ++c) {
+        norm_chunk(c);
+      }
+    }
+    return result;
+  }
+
+  template <typename Component>
+  static std::vector<std::vector<int64_t>>
+  select_partitions(const std::vector<Component> &norms, int64_t m,
+                    ThreadPool *pool = nullptr) {
+    /*
+     * the partitions of partitioner, found by selection rather than sorting.
+     * nth_element puts the middle cut in place, then the ranges on either
+     * side are cut independently, so it takes O(n log m) rather than
+     * O(n log n). Items within a partition are in no particular order.
+     * With a pool, the ranges of each round are cut in parallel.
+     */
+    if (m <= 0)
+      throw std::runtime_error("IndexBuilder::select_partitions, m <= 0");
+    const size_t n = norms.size();
+    std::vector<int64_t> ids(n);
+    std::iota(ids.begin(), ids.end(), 0);
+    // partition p starts at cuts[p]. Any overflow goes in the last one.
+    std::vector<size_t> cuts(m + 1, n);
+    for (int64_t p = 0; p < m; ++p) {
+      cuts.at(p) = p * (n / m);
+    }
+    auto by_norm = [&norms](int64_t x, int64_t y) {
+      return norms[x] < norms[y];
+    };
+
+    // each range is the ids between two cuts that are already in place.
+    std::vector<std::pair<size_t, size_t>> ranges{{0, static_cast<size_t>(m)}};
+    while (!ranges.empty()) {
+      auto cut = [&](size_t r) {
+        const auto [lo, hi] = ranges[r];
+        const size_t mid = (lo + hi) / 2;
+        std::nth_element(ids.begin() + cuts[lo], ids.begin() + cuts[mid],
+                         ids.begin() + cuts[hi], by_norm);
+      };
+      if (pool != nullptr) {
+        pool->parallel_for(ranges.size(), pool->size() + 1, cut);
+      } else {
+        for (size_t r = 0; r < ranges.size(); ++r) {
+          cut(r);
+        }
+      }
+      std::vector<std::pair<size_t, size_t>> next(0);
+      for (const auto &[lo, hi] : ranges) {
+        const size_t mid = (lo + hi) / 2;
+        if (mid - lo > 1)
+          next.push_back({lo, mid});
+        if (hi - mid > 1)
+          next.push_back({mid, hi});
+      }
+      ranges = std::move(next);
+    }
+
+    std::vector<std::vector<int64_t>> partitions(m);
+    for (int64_t p = 0; p < m; ++p) {
+      partitions.at(p).assign(ids.begin() + cuts.at(p),
+                              ids.begin() + cuts.at(p + 1));
+    }
+    return partitions;
+  }
+
+  template <typename Component>
+  static std::vector<std::vector<int64_t>>
+  log_norm_partitions(const std::vector<Component> &norms, int64_t m) {
+    /*
+     * cuts [smallest norm, largest norm] into m ranges of equal width in
+     * log(norm), like the norm ranging in the NR-LSH paper. One pass, no
+     * sorting. Norms with no place in the range go in the first partition:
+     * zero norms, and every norm when there is no range at all, the same rule
+     * as StreamingBuilder's LogNorm boundaries.
+     */
+    if (m <= 0)
+      throw std::runtime_error("IndexBuilder::log_norm_partitions, m <= 0");
+    Component smallest = std::numeric_limits<Component>::max();
+    Component largest = 0;
+    for (const Component norm : norms) {
+      if (norm > 0)
+        smallest = std::min(smallest, norm);
+      largest = std::max(largest, norm);
+    }
+    std::vector<std::vector<int64_t>> partitions(m);
+    // every norm is the same, or zero. There is nothing to range over.
+    if (!(smallest < largest)) {
+      partitions.at(0).resize(norms.size());
+      std::iota(partitions.at(0).begin(), partitions.at(0).end(), 0);
+      return partitions;
+    }
+    const double log_smallest = std::log(static_cast<double>(smallest));
+    const double width =
+        (std::log(static_cast<double>(largest)) - log_smallest) / m;
+    for (size_t i = 0; i < norms.size(); ++i) {
+      int64_t p = 0;
+      if (norms[i] > 0) {
+        p = static_cast<int64_t>(
+            (std::log(static_cast<double>(norms[i])) - log_smallest) / width);
+        p = std::min(p, m - 1);
+      }
+      partitions.at(p).push_back(i);
+    }
+    return partitions;
+  }
+
   template <typename VectCont>
   static std::vector<std::vector<int64_t>> partitioner(const VectCont &dataset,
                                                        int64_t m) {
@@ -114,19 +257,24 @@ struct IndexBuilder {
 
     for (size_t p = 0; p < partitions.size(); ++p) {
       auto Up = IndexBuilder::max_norm(dataset, partitions.at(p));
+      // an empty partition, or one of zero vectors, has nothing to scale.
+      if (!(Up > 0))
+        Up = 1;
       U.at(p) = Up;
+      normalized_dataset.at(p).reserve(partitions.at(p).size());
       for (size_t i = 0; i < partitions.at(p).size(); ++i) {
-        auto normalized = dataset.at(partitions.at(p).at(i)) / Up;
-        normalized_dataset.at(p).push_back(normalized);
+        // evaluated straight into the partition, with no temporary.
+        normalized_dataset.at(p).emplace_back(
+            dataset.at(partitions.at(p).at(i)) / Up);
       }
     }
-    return {normalized_dataset, U};
+    return {std::move(normalized_dataset), std::move(U)};
   }
 
-  template <typename PartCont, typename Component>
+  template <typename PartCont, typename Hash>
   static std::vector<std::vector<int64_t>>
-  simple_LSH_partitions(const PartCont &partitioned_dataset,
-                        SimpleLSH<Component> hash, int64_t num_buckets) {
+  simple_LSH_partitions(const PartCont &partitioned_dataset, const Hash &hash,
+                        int64_t num_buckets) {
     const size_t m = partitioned_dataset.size();
     std::vector<std::vector<int64_t>> indices(m, std::vector<int64_t>(0));
 
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <vector>
+
+/*
+ * Helpers for scanning several queries at once.
+ * A single query scanning ranked buckets stalls on a cache miss at every
+ * bucket, since the next bucket's list nodes and vectors are nowhere near
+ * the last one. Interleaving the scans of several queries (asynchronous
+ * memory access chaining) lets each query prefetch its next bucket, then
+ * step the other queries while the prefetch is in flight.
+ */
+
+namespace nr {
+
+inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address, 0, 3);
+#else
+  (void)address;
+#endif
+}
+
+template <typename KV> void prefetch_nodes(const std::list<KV> &bucket) {
+  // the first list node. Finding its address does not touch the node.
+  if (!bucket.empty())
+    prefetch(&bucket.front());
+}
+
+template <typename KV> void prefetch_items(const std::list<KV> &bucket) {
+  // the first vector's data. Reads the first node, so prefetch_nodes should
+  // have been called on the bucket a while before.
+  if (!bucket.empty())
+    prefetch(bucket.front().first.data());
+}
+
+template <typename It> void prefetch_ahead(It item, It end) {
+  /*
+   * called while scanning item: prefetches the vector data of the next
+   * item and the list node after it, so neither is a miss when reached.
+   */
+  const It next = std::next(item);
+  if (next == end)
+    return;
+  prefetch(next->first.data());
+  const It after = std::next(next);
+  if (after != end)
+    prefetch(&*after);
+}
+
+template <typename Start, typename Step>
+void interleave(size_t num_queries, size_t width, Start start, Step step) {
+  /*
+   * runs the scans of num_queries queries, at most width at a time, round
+   * robin. start(query, slot) sets up a query in one of the width slots, so
+   * per slot scratch space can be reused. step(query, slot) scans one
+   * bucket and returns false once the query is finished, and its slot goes
+   * to the next waiting query.
+   */
+  if (num_queries == 0)
+    return;
+  const size_t slots = std::max<size_t>(1, std::min(width, num_queries));
+  std::vector<size_t> active(0);
+  active.reserve(slots);
+  size_t next_query = 0;
+  for (size_t slot = 0; slot < slots; ++slot) {
+    start(next_query, slot);
+    active.push_back(next_query++);
+  }
+  size_t running = slots;
+  while (running > 0) {
+    for (size_t slot = 0; slot < slots; ++slot) {
+      if (active.at(slot) == num_queries || step(active.at(slot), slot))
+        continue;
+      // the query in slot is done.
+      if (next_query < num_queries) {
+        start(next_query, slot);
+        active.at(slot) = next_query++;
+      } else {
+        active.at(slot) = num_queries;
+        --running;
+      }
+    }
+  }
+}
+
+} // namespace nr
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/*
+ * Small least-recently-used cache. Used to memoize things that are expensive
+ * to compute and are likely to be requested again, like bucket rankings.
+ * Uses std::map so keys only need operator<, which pairs already have.
+ * Even get reorders the entries, so every call takes a lock, and one cache
+ * can be used by several threads.
+ */
+
+namespace nr {
+
+template <typename Key, typename Value> class LRUCache {
+private:
+  using Entry = std::pair<Key, Value>;
+
+  size_t capacity;
+  std::list<Entry> entries; // most recently used in front.
+  std::map<Key, typename std::list<Entry>::iterator> lookup;
+  mutable std::mutex lock;
+
+  void copy_from(const LRUCache &other) {
+    // iterators in lookup can't be copied, so re-insert everything.
+    capacity = other.capacity;
+    for (auto iter = other.entries.rbegin(); iter != other.entries.rend();
+         ++iter) {
+      insert(iter->first, iter->second);
+    }
+  }
+
+  void insert(const Key &key, const Value &value) {
+    if (capacity == 0)
+      return;
+    auto found = lookup.find(key);
+    if (found != lookup.end()) {
+      found->second->second = value;
+      entries.splice(entries.begin(), entries, found->second);
+      return;
+    }
+    if (entries.size() == capacity) {
+      lookup.erase(entries.back().first);
+      entries.pop_back();
+    }
+    entries.emplace_front(key, value);
+    lookup[key] = entries.begin();
+  }
+
+public:
+  explicit LRUCache(size_t capacity = 64) : capacity(capacity) {}
+
+  LRUCache(const LRUCache &other) : capacity(0) {
+    std::lock_guard<std::mutex> guard(other.lock);
+    copy_from(other);
+  }
+
+  LRUCache(LRUCache &&other) : capacity(0) {
+    // moving a list keeps its iterators valid, so lookup can move too.
+    std::lock_guard<std::mutex> guard(other.lock);
+    capacity = other.capacity;
+    entries = std::move(other.entries);
+    lookup = std::move(other.lookup);
+  }
+
+  LRUCache &operator=(const LRUCache &other) {
+    if (this != &other) {
+      std::scoped_lock guard(lock, other.lock);
+      entries.clear();
+      lookup.clear();
+      copy_from(other);
+    }
+    return *this;
+  }
+
+  LRUCache &operator=(LRUCache &&other) {
+    if (this != &other) {
+      std::scoped_lock guard(lock, other.lock);
+      capacity = other.capacity;
+      entries = std::move(other.entries);
+      lookup = std::move(other.lookup);
+    }
+    return *this;
+  }
+
+  std::optional<Value> get(const Key &key) {
+    /*
+     * returns the cached value and marks it most recently used.
+     */
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = lookup.find(key);
+    if (found == lookup.end())
+      return std::nullopt;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->second;
+  }
+
+  void put(const Key &key, const Value &value) {
+    /*
+     * inserts or overwrites key. Evicts the least recently used entry if
+     * the cache is full.
+     */
+    std::lock_guard<std::mutex> guard(lock);
+    insert(key, value);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    lookup.clear();
+  }
+
+  void resize(size_t new_capacity) {
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = new_capacity;
+    while (entries.size() > capacity) {
+      lookup.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+  }
+
+  size_t max_size() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return capacity;
+  }
+};
+
+} // namespace nr
@@ -10,8 +10,12 @@
 #include <utility>
 #include <vector>
 
+#include "addressing.hpp"
+#include "dispatch.hpp"
 #include "kv_comparator.hpp"
 #include "multiprobe.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
 #include "sign_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
@@ -27,59 +31,61 @@
 
 namespace nr {
 
-template <typename Vect, typename Hash = SignLSH<typename Vect::value_type>>
-class LSH_MultiProbe : public MultiProbe<Vect> {
+template <typename Vect, typename Hash = SignLSH<typename Vect::value_type,
+                                                 Vect::RowsAtCompileTime>>
+class LSH_MultiProbe : public MultiProbe<LSH_MultiProbe<Vect, Hash>, Vect> {
 private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
   using Component = typename Vect::value_type;
   using KV = std::pair<Vect, int64_t>;
+  using IdScore = std::pair<int64_t, Component>;
 
   std::vector<std::list<KV>> table;
+  std::vector<size_t> id_buckets; // bucket each id was inserted into.
+  size_t bit_lim; // low bits of a bucket index compared when ranking.
   int64_t dim;
   // defaults to SignLSH, but user can pass in a PStableLSH.
   Hash hash_function;
 
-  static double sim(size_t x, size_t y, size_t num_buckets) {
+  double sim(size_t x, size_t y) const {
     // finds the number of bits in x and y that are the same.
-    return static_cast<double>(
-        stats::same_bits(x, y, std::floor(std::log2(num_buckets)) + 1));
+    return static_cast<double>(stats::same_bits(x, y, bit_lim));
   }
 
-  static std::vector<size_t> probe_ranking(size_t idx, size_t num_buckets) {
+  std::vector<size_t> probe_ranking(size_t idx, size_t num_buckets) const {
     std::vector<size_t> rank(num_buckets, 0);
     std::iota(rank.begin(), rank.end(), 0);
     // sort in descending order. Most similar in the front.
     std::sort(rank.begin(), rank.end(), [&](size_t x, size_t y) {
-      return sim(idx, x, num_buckets) > sim(idx, y, num_buckets);
+      return sim(idx, x) > sim(idx, y);
     });
     return rank;
   }
 
-  std::vector<size_t> rank(const Vect &q, size_t max_hash, int64_t adj) const {
-    // return indices of the top 'adj' ranked buclets.
-    // not static because it uses the hash function.
-    const size_t idx = hash_function.hash_max(q, max_hash);
+  std::vector<int64_t> rank(size_t idx, size_t max_hash, int64_t adj) const {
+    // return indices of the top 'adj' ranked buclets around idx.
     std::vector<size_t> ranks = probe_ranking(idx, max_hash);
-    return std::vector<size_t>(ranks.begin(), ranks.begin() + adj);
+    return std::vector<int64_t>(ranks.begin(), ranks.begin() + adj);
   }
 
-  void manage_topk(std::vector<std::pair<KV, Component>> &topk, int64_t k,
-                   const Vect &query, KV pos) {
+  void manage_topk(std::vector<IdScore> &topk, int64_t k, int64_t id,
+                   Component dist) {
     /*
-     * Clunky function to track the topk vectors closest to q.
+     * Clunky function to track the topk ids closest to q.
      */
     if (k < 1) {
       throw std::runtime_error(
           "LSH_MultiProbe::manage_topk, k must be positive");
     }
-    Component dist = (query - pos.first).norm();
-    topk.push_back(std::make_pair(pos, dist));
+    topk.push_back(std::make_pair(id, dist));
     // sorting by distance should be fast.
     // don't have to recompute distances.
     // sort nearest to most distant. Removing last element should be faster
-    std::sort(topk.begin(), topk.end(),
-              [](std::pair<KV, Component> x, std::pair<KV, Component> y) {
-                return x.second < y.second;
-              });
+    std::sort(topk.begin(), topk.end(), [](const IdScore &x, const IdScore &y) {
+      return x.second < y.second;
+    });
     if (topk.size() >= static_cast<size_t>(k + 1)) {
       // remove most distant element.
       topk.pop_back();
@@ -87,13 +93,19 @@ private:
   }
 
 public:
-  LSH_MultiProbe(int64_t bits, int64_t dimension, size_t num_buckets)
-      : table(num_buckets, std::list<KV>()), dim(dimension),
-        hash_function(bits, dimension) {}
+  LSH_MultiProbe(int64_t bits, int64_t dimension, size_t num_buckets,
+                 Addressing addressing = Addressing::Modulo)
+      : table(num_buckets, std::list<KV>()),
+        bit_lim(address_bits(num_buckets, addressing)), dim(dimension),
+        hash_function(bits, dimension) {
+    check_addressing(num_buckets, bits, addressing, "LSH_MultiProbe");
+  }
 
   LSH_MultiProbe(int64_t bits, int64_t dimension)
       : table(static_cast<size_t>(std::pow(2, bits)), std::list<KV>()),
-        dim(dimension), hash_function(bits, dimension) {}
+        bit_lim(bits), dim(dimension), hash_function(bits, dimension) {
+    // one bucket per code, which is already LowBits addressing.
+  }
 
   LSH_MultiProbe(const LSH_MultiProbe &other) {
     tables(other.tables);
@@ -104,9 +116,11 @@ public:
   template <typename Cont>
   void fill(const Cont &data, bool is_normalized = false) {
     int64_t id = 0;
+    id_buckets.resize(data.size());
     for (const auto &datum : data) {
       const size_t idx = hash_function.hash_max(datum, table.size());
       table.at(idx).push_front(std::make_pair(datum, id));
+      id_buckets.at(id) = idx;
       ++id;
     }
   }
@@ -115,23 +129,41 @@ public:
     /*
      * Probe adj buckets. Return vector closest to q.
      */
+    auto found = probe_ids(q, adj);
+    if (found.first.empty()) {
+      // only probed empty buckets, so min-dist didn't change.
+      return {std::nullopt, found.second};
+    }
+    const int64_t id = found.first.ids.at(0);
+    return {std::make_optional(KV{lookup(id), id}), found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) {
+    /*
+     * Probe adj buckets. Return the id and distance of the vector closest to q.
+     */
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) {
     StatTracker tracker;
-    KV neighbor = KV();
+    int64_t neighbor = -1;
     Component min_dist = std::numeric_limits<Component>::max();
     // search through the highest ranked buckets for neighbor.
-    iter_table(q, adj, tracker,
+    iter_table(ctx, tracker,
                [&neighbor, &min_dist](const Vect &q, const KV &x) {
-                 Component dist = (q - x.first).norm();
+                 Component dist = distance(q, x.first);
                  if (dist < min_dist) {
-                   neighbor = x;
+                   neighbor = x.second;
                    min_dist = dist;
                  }
                });
-    if (min_dist == std::numeric_limits<Component>::max()) {
-      // only probed empty buckets, so min-dist didn't change.
-      return {std::nullopt, tracker};
-    }
-    return {std::make_optional(neighbor), tracker};
+    ProbeResult<Component> result;
+    if (neighbor >= 0)
+      result.push_back(neighbor, min_dist);
+    return {result, tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
@@ -140,14 +172,27 @@ public:
      * probe adj buckets. Return the k probed vectors that are closest to q
      * output is most distant to nearest.
      */
+    return ids_to_kvs(k_probe_ids(k, q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t adj) {
+    /*
+     * probe adj buckets. Return the ids and distances of the k probed vectors
+     * that are closest to q. output is most distant to nearest.
+     */
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) {
     StatTracker tracker;
     // topk is set sorted by distance to query.
-    // distanct objects are at the front. close at at end.
-    std::vector<std::pair<KV, Component>> topk(0);
+    std::vector<IdScore> topk(0);
 
     // sketchy? Passing this allows manage_topk to be called.
-    iter_table(q, adj, tracker, [this, &topk, &k](const Vect &q, const KV &x) {
-      this->manage_topk(topk, k, q, x);
+    iter_table(ctx, tracker, [this, &topk, &k](const Vect &q, const KV &x) {
+      this->manage_topk(topk, k, x.second, distance(q, x.first));
     });
 
     return proc_k_probe_output(topk, tracker);
@@ -159,18 +204,41 @@ public:
      * Probe adj buckets. Return the first vector within distance c of
      * the query q.
      */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty()) {
+      return {std::nullopt, found.second};
+    }
+    const int64_t id = found.first.ids.at(0);
+    return {std::make_optional(KV{lookup(id), id}), found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) {
+    /*
+     * Probe adj buckets. Return the id and distance of the first vector
+     * within distance c of the query q.
+     */
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) {
+    const Vect &q = ctx.query;
     StatTracker tracker;
+    ProbeResult<Component> result;
 
-    for (const size_t &probe_idx : rank(q, table.size(), adj)) {
+    for (const int64_t probe_idx : ctx.hashes.at(0).probe_sequence) {
       tracker.incr_buckets_probed();
       for (const KV &x : table.at(probe_idx)) {
         tracker.incr_comparisons();
-        if ((q - x.first).norm() <= c) {
-          return {std::make_optional(x), tracker};
+        const Component dist = distance(q, x.first);
+        if (dist <= c) {
+          result.push_back(x.second, dist);
+          return {result, tracker};
         }
       }
     }
-    return {std::nullopt, tracker};
+    return {result, tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
@@ -180,80 +248,106 @@ public:
      * the highest ranked buckets.
      * Output is most distant found to nearest
      */
+    return ids_to_kvs(k_probe_approx_ids(k, q, c, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c, size_t adj) {
+    /*
+     * return the ids and distances of the first k neighbors found while
+     * searching through the adj highest ranked buckets.
+     * Output is most distant found to nearest
+     */
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx, Component c) {
     if (k < 1) {
       throw std::runtime_error(
           "LSH_MultiProbe::k_probe_approx, k must be positive");
     }
 
+    const Vect &q = ctx.query;
     StatTracker tracker;
 
-    std::vector<KV> topk(0);
-    for (const size_t &probe_idx : rank(q, table.size(), adj)) {
+    std::vector<IdScore> topk(0);
+    for (const int64_t probe_idx : ctx.hashes.at(0).probe_sequence) {
       tracker.incr_buckets_probed();
       for (const KV &x : table.at(probe_idx)) {
         tracker.incr_comparisons();
-        if ((q - x.first).norm() <= c) {
-          topk.push_back(x);
+        const Component dist = distance(q, x.first);
+        if (dist <= c) {
+          topk.push_back({x.second, dist});
           if (topk.size() == static_cast<size_t>(k)) {
-            return proc_k_probe_approx_output(q, topk, tracker);
+            return proc_k_probe_output(topk, tracker);
           }
         }
       }
     }
-    return proc_k_probe_approx_output(q, topk, tracker);
+    return proc_k_probe_output(topk, tracker);
+  }
+
+  const Vect &lookup(int64_t id) const {
+    /*
+     * returns the vector that was inserted with the given id.
+     */
+    for (const KV &x : table.at(id_buckets.at(id))) {
+      if (x.second == id)
+        return x.first;
+    }
+    throw std::out_of_range("LSH_MultiProbe::lookup(id) id not in bucket.");
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) {
+    /*
+     * hashes q once and ranks the adj buckets to probe. The context can be
+     * passed to any of the probe functions in place of the query and adj.
+     */
+    QueryContext<Vect> ctx(q);
+    HashedQuery<Vect> hashed = hash_query(hash_function, q, table.size());
+    hashed.probe_sequence = rank(hashed.bucket, table.size(), adj);
+    ctx.hashes.push_back(hashed);
+    return ctx;
   }
 
   template <typename Op>
-  void iter_table(const Vect &q, int64_t adj, StatTracker &tracker, Op op) {
+  void iter_table(const QueryContext<Vect> &ctx, StatTracker &tracker, Op op) {
     /*
      * The probe functions iterate through all adj buckets.
      * Using this function avoids a lot of code duplication.
      * The specific operation used by the probe function is passed in.
      */
-    for (const size_t &probe_idx : rank(q, table.size(), adj)) {
+    for (const int64_t probe_idx : ctx.hashes.at(0).probe_sequence) {
       tracker.incr_buckets_probed();
       for (const KV &x : table.at(probe_idx)) {
         tracker.incr_comparisons();
-        op(q, x);
+        op(ctx.query, x);
       }
     }
   }
 
-  std::pair<std::optional<std::vector<KV>>, StatTracker>
-  proc_k_probe_output(std::vector<std::pair<KV, Component>> &topk,
+  std::pair<ProbeResult<Component>, StatTracker>
+  proc_k_probe_output(std::vector<IdScore> &topk,
                       const StatTracker &tracker) const {
-    if (topk.size() == 0) {
-      return {std::nullopt, tracker};
-    }
     // sort output so it is distant to nearest
-    std::sort(
-        topk.begin(), topk.end(),
-        [](const std::pair<KV, Component> &x,
-           const std::pair<KV, Component> &y) { return x.second > y.second; });
-
-    // copy topk into vector of proper return type
-    std::vector<KV> topk_out(topk.size());
-    std::generate(topk_out.begin(), topk_out.end(), [&topk, n = -1]() mutable {
-      ++n;
-      return topk.at(n).first;
+    std::sort(topk.begin(), topk.end(), [](const IdScore &x, const IdScore &y) {
+      return x.second > y.second;
     });
-    return {std::make_optional(topk_out), tracker};
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  proc_k_probe_approx_output(const Vect &q, std::vector<KV> &topk,
-                             StatTracker &tracker) const {
+  ids_to_kvs(const std::pair<ProbeResult<Component>, StatTracker> &found) const {
     /*
-     * Function to format the topk items found.
+     * Function to format the ids found as a vector of KV.
      */
-    if (topk.size() == 0) {
-      return {std::nullopt, tracker};
+    if (found.first.empty()) {
+      return {std::nullopt, found.second};
     }
-    // should be sorted distant to nearest.
-    std::sort(topk.begin(), topk.end(), [&q](KV x, KV y) {
-      return (x.first - q).norm() > (y.first - q).norm();
-    });
-    return {std::make_optional(topk), tracker};
+    return {std::make_optional(result_to_kvs<KV>(
+                found.first, [this](int64_t id) { return lookup(id); })),
+            found.second};
   }
 
   bool contains(const Vect &q) {
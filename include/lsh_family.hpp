@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <Eigen/Core>
@@ -6,33 +5,87 @@
 #include <cmath>
 #include <random>
 #include <type_traits>
+#include <utility>
 
 #include "normal_matrix.hpp"
+#include "stats/stats.hpp"
 #include "xf_or_xd.hpp"
 
 /*
- * Abstract base class for LSH and familes.
+ * Base class for LSH families, using static polymorphism (CRTP).
+ * Derived is the family itself, e.g. class SignLSH : public
+ * LSH_Family<SignLSH<...>, Component, Dim>. It provides
+ *   int64_t bit_count() const
+ *   int64_t dimension() const
+ *   Projections project(const Vect &input) const
+ *   Matrix project_batch(const Matrix &inputs) const
+ *   mp::cpp_int code(const Projections &projections) const
+ *   size_t code_max(const mp::cpp_int &code, size_t max) const
+ * and gets hash, hash_max and operator() from this class. Every call is
+ * resolved at compile time, so the projection and sign packing inline into
+ * the loops that hash. Tables take the family as a template parameter and
+ * check it with is_lsh_family.
+ * bucket_sim(idx, other, bits) ranks the buckets a multiprobe visits. The
+ * default here fits families whose codes are sign bits. A family with some
+ * other code defines its own, which hides this one.
  */
 
 namespace mp = boost::multiprecision;
 namespace nr {
 
-template <typename Component> class LSH_Family {
+template <typename Derived, typename Component, int Dim = Eigen::Dynamic>
+class LSH_Family {
 private:
   // use the proper matrix and vector type for component.
-  using Matrix = typename MatrixXf_or_Xd<Component>::type;
-  using Vect = typename VectorXf_or_Xd<Component>::type;
+  // inputs have Dim components. There is one projection per bit, and the
+  // bit count is chosen at run time, so projections are always dynamic.
+  using Vect = typename VectorXf_or_Xd<Component, Dim>::type;
 
-public:
-  virtual int64_t bit_count() const = 0;
+  const Derived &self() const { return static_cast<const Derived &>(*this); }
 
-  virtual int64_t dimension() const = 0;
+public:
+  mp::cpp_int operator()(const Vect &input) const { return hash(input); }
 
-  virtual mp::cpp_int operator()(const Vect &input) const = 0;
+  mp::cpp_int hash(const Vect &input) const {
+    // with a large number of hashes, it can become larger than 64 bit.
+    // have to use multiprecision.
+    return self().code(self().project(input));
+  }
 
-  virtual mp::cpp_int hash(const Vect &input) const = 0;
+  size_t hash_max(const Vect &input, size_t max) const {
+    return self().code_max(hash(input), max);
+  }
 
-  virtual size_t hash_max(const Vect &input, size_t max) const = 0;
+  double bucket_sim(size_t idx, size_t other, size_t bits) const {
+    /*
+     * similarity of buckets idx and other, comparing their low bits.
+     * Each sign bit that agrees makes the angle between the inputs smaller,
+     * so this is the cosine of the angle implied by the agreeing bits.
+     * Larger is more similar.
+     */
+    constexpr double PI = 3.141592653589;
+    constexpr double eps = 1e-3;
+    const double l = static_cast<double>(stats::same_bits(idx, other, bits));
+    const double L = static_cast<double>(self().bit_count());
+    return std::cos(PI * (1.0 - eps) * (1.0 - (l / L)));
+  }
 };
 
+template <typename Hash, typename Vect, typename = void>
+struct is_lsh_family : std::false_type {};
+
+template <typename Hash, typename Vect>
+struct is_lsh_family<
+    Hash, Vect,
+    std::void_t<decltype(std::declval<const Hash &>().bit_count()),
+                decltype(std::declval<const Hash &>().dimension()),
+                decltype(std::declval<const Hash &>().hash_max(
+                    std::declval<const Vect &>(), size_t())),
+                decltype(std::declval<const Hash &>().code(
+                    std::declval<const Hash &>().project(
+                        std::declval<const Vect &>()))),
+                decltype(std::declval<const Hash &>().code_max(
+                    std::declval<const mp::cpp_int &>(), size_t()))>>
+    : std::true_type {};
+
 } // namespace nr
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "multiprobe.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
+#include "sign_lsh.hpp"
+#include "stat_tracker.hpp"
+#include "stats/topk.hpp"
+#include "visited_set.hpp"
+
+/*
+ * Implementation of LSH Forest (Bawa et al.).
+ * Every tree is a prefix tree over the sign codes of one hash function. Rather
+ * than fixing the number of bits per bucket, a query descends to the longest
+ * prefix it shares with any item, then backs off one bit at a time in all
+ * trees until enough candidates are found. Dense regions are searched with
+ * long prefixes and sparse regions with short ones, so there are no bucket
+ * sizes to tune.
+ * A tree is stored as its items sorted by code, with the first hash bit as the
+ * most significant. Items sharing a prefix are then a contiguous range that
+ * is found with binary search.
+ */
+
+namespace nr {
+
+template <typename Vect, typename Hash = SignLSH<typename Vect::value_type,
+                                                 Vect::RowsAtCompileTime>>
+class LSH_Forest : public MultiProbe<LSH_Forest<Vect, Hash>, Vect> {
+private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
+  using Component = typename Vect::value_type;
+  using KV = std::pair<Vect, int64_t>;
+  using IdScore = std::pair<int64_t, Component>;
+
+  struct Tree {
+    std::vector<uint64_t> keys; // sorted prefix keys.
+    std::vector<int64_t> ids;   // ids[i] has keys[i].
+  };
+
+  std::vector<Tree> trees;
+  std::vector<Hash> hash_functions;
+  std::vector<Vect> items; // item i has id i.
+  int64_t depth;           // bits per code, at most 64.
+  VisitedSet visited;      // ids scored by the current probe.
+  VisitedSet ranked;       // ids already in a probe sequence.
+
+  template <typename Projections>
+  static uint64_t prefix_key(const Projections &projections) {
+    /*
+     * packs the signs of projections so the first projection is the most
+     * significant bit. Comparing keys then compares prefixes.
+     */
+    uint64_t key = 0;
+    for (int64_t i = 0; i < projections.size(); ++i) {
+      if (projections(i) >= 0)
+        key |= uint64_t(1) << (63 - i);
+    }
+    return key;
+  }
+
+  static std::pair<size_t, size_t> prefix_range(const Tree &tree, uint64_t key,
+                                                int64_t length) {
+    // positions of the items that share the first length bits of key.
+    const uint64_t mask = length == 0 ? 0 : ~uint64_t(0) << (64 - length);
+    const uint64_t low = key & mask;
+    const uint64_t high = low | ~mask;
+    auto begin = std::lower_bound(tree.keys.begin(), tree.keys.end(), low);
+    auto end = std::upper_bound(begin, tree.keys.end(), high);
+    return {static_cast<size_t>(begin - tree.keys.begin()),
+            static_cast<size_t>(end - tree.keys.begin())};
+  }
+
+  void rank(std::vector<HashedQuery<Vect>> &hashes, int64_t adj) {
+    /*
+     * fills each tree's probe sequence with ids, longest shared prefix first.
+     * All trees back off together one bit at a time. Stops once at least adj
+     * distinct ids have been collected, or every item has.
+     */
+    const size_t target = static_cast<size_t>(std::max<int64_t>(adj, 1));
+    std::vector<uint64_t> keys(trees.size(), 0);
+    // range of each tree already added to its probe sequence.
+    std::vector<std::pair<size_t, size_t>> added(trees.size(), {0, 0});
+    for (size_t t = 0; t < trees.size(); ++t) {
+      keys.at(t) = prefix_key(hashes.at(t).projections);
+      const auto start = prefix_range(trees.at(t), keys.at(t), depth);
+      added.at(t) = {start.first, start.first};
+    }
+
+    ranked.clear();
+    size_t distinct = 0;
+    auto append = [&](size_t t, size_t begin, size_t end) {
+      for (size_t pos = begin; pos < end; ++pos) {
+        const int64_t id = trees.at(t).ids.at(pos);
+        hashes.at(t).probe_sequence.push_back(id);
+        if (ranked.visit(id))
+          ++distinct;
+      }
+    };
+
+    for (int64_t length = depth; length >= 0; --length) {
+      for (size_t t = 0; t < trees.size(); ++t) {
+        const auto range = prefix_range(trees.at(t), keys.at(t), length);
+        // the new range contains the old one, so only add the ends.
+        append(t, range.first, added.at(t).first);
+        append(t, added.at(t).second, range.second);
+        added.at(t) = range;
+      }
+      if (distinct >= target || distinct == items.size())
+        return;
+    }
+  }
+
+public:
+  LSH_Forest(int64_t num_trees, int64_t bits, int64_t dimension)
+      : trees(num_trees), hash_functions(), items(0), depth(bits) {
+    /*
+     * Each tree has its own hash function.
+     */
+    if (bits < 1 || bits > 64)
+      throw std::runtime_error("LSH_Forest, bits must be between 1 and 64");
+    for (int64_t i = 0; i < num_trees; ++i) {
+      hash_functions.emplace_back(bits, dimension);
+    }
+  }
+
+  template <typename Cont>
+  void fill(const Cont &data, bool /* is_normalized */ = false) {
+    /*
+     * sorts every item into every tree.
+     * The "is_normalized" argument is not necessary for this table.
+     * It defaults to false so a value does not need to be passed in.
+     */
+    items.assign(data.begin(), data.end());
+    visited.resize(items.size());
+    ranked.resize(items.size());
+    for (size_t t = 0; t < trees.size(); ++t) {
+      const Hash &hash = hash_functions.at(t);
+      std::vector<std::pair<uint64_t, int64_t>> keyed(0);
+      keyed.reserve(items.size());
+      for (size_t id = 0; id < items.size(); ++id) {
+        keyed.push_back({prefix_key(hash.project(items.at(id))),
+                         static_cast<int64_t>(id)});
+      }
+      std::sort(keyed.begin(), keyed.end());
+      Tree &tree = trees.at(t);
+      tree.keys.resize(keyed.size());
+      tree.ids.resize(keyed.size());
+      for (size_t i = 0; i < keyed.size(); ++i) {
+        tree.keys.at(i) = keyed.at(i).first;
+        tree.ids.at(i) = keyed.at(i).second;
+      }
+    }
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) {
+    /*
+     * hashes q once with every tree's hash function. Each tree's probe
+     * sequence holds the ids of candidates rather than buckets. Together
+     * they cover at least adj distinct items when there are that many.
+     */
+    QueryContext<Vect> ctx(q);
+    ctx.hashes.reserve(trees.size());
+    for (const Hash &hash : hash_functions) {
+      ctx.hashes.push_back(hash_query(hash, q, 1));
+    }
+    rank(ctx.hashes, adj);
+    return ctx;
+  }
+
+  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q, int64_t adj) {
+    /*
+     * returns the vector closest to q among at least adj candidates.
+     */
+    auto found = probe_ids(q, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) {
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) {
+    StatTracker tracker;
+    int64_t neighbor = -1;
+    Component min_dist = std::numeric_limits<Component>::max();
+    iter_candidates(ctx, tracker, [&](int64_t id, Component dist) {
+      if (dist < min_dist) {
+        neighbor = id;
+        min_dist = dist;
+      }
+      return false;
+    });
+    ProbeResult<Component> result;
+    if (neighbor >= 0)
+      result.push_back(neighbor, min_dist);
+    return {result, tracker};
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  k_probe(int64_t k, const Vect &q, size_t adj) {
+    /*
+     * Returns the k vectors closest to q among at least adj candidates.
+     * Output is ordered distant to nearest.
+     */
+    return ids_to_kvs(k_probe_ids(k, q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t adj) {
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) {
+    if (k < 1)
+      throw std::runtime_error("LSH_Forest::k_probe, k < 1");
+    StatTracker tracker;
+    std::vector<IdScore> topk(0);
+    topk.reserve(k + 1);
+    Component largest_dist = std::numeric_limits<Component>::max();
+    iter_candidates(ctx, tracker, [&](int64_t id, Component dist) {
+      largest_dist = k_probe_step(k, id, dist, topk, largest_dist);
+      return false;
+    });
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
+  }
+
+  std::pair<std::optional<KV>, StatTracker>
+  probe_approx(const Vect &q, Component c, int64_t adj) {
+    /*
+     * Returns the first vector within distance c of q, searching candidates
+     * with the longest shared prefixes first.
+     */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) {
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) {
+    StatTracker tracker;
+    ProbeResult<Component> result;
+    iter_candidates(ctx, tracker, [&](int64_t id, Component dist) {
+      if (dist > c)
+        return false;
+      result.push_back(id, dist);
+      return true;
+    });
+    return {result, tracker};
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) {
+    /*
+     * finds the first k items within distance c from the query.
+     * Output is ordered distant to nearest.
+     */
+    return ids_to_kvs(k_probe_approx_ids(k, q, c, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c, size_t adj) {
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx, Component c) {
+    if (k < 1)
+      throw std::runtime_error("LSH_Forest::k_probe_approx, k < 1");
+    StatTracker tracker;
+    std::vector<IdScore> topk(0);
+    topk.reserve(k);
+    iter_candidates(ctx, tracker, [&](int64_t id, Component dist) {
+      if (dist <= c)
+        topk.push_back({id, dist});
+      return topk.size() == static_cast<size_t>(k);
+    });
+    // should be sorted distant to nearest.
+    std::sort(topk.begin(), topk.end(),
+              [](const auto &x, const auto &y) { return x.second > y.second; });
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
+  }
+
+  template <typename Op>
+  void iter_candidates(const QueryContext<Vect> &ctx, StatTracker &tracker,
+                       Op op) {
+    /*
+     * scores every candidate in the probe sequences once. op is called with
+     * the id and distance of each, and returns true to stop early.
+     */
+    visited.clear();
+    for (size_t t = 0; t < trees.size(); ++t) {
+      tracker.incr_tables_probed();
+      for (const int64_t id : ctx.hashes.at(t).probe_sequence) {
+        if (!visited.visit(id)) {
+          tracker.incr_duplicates_skipped();
+          continue;
+        }
+        tracker.incr_comparisons();
+        if (op(id, (ctx.query - items.at(id)).norm()))
+          return;
+      }
+    }
+  }
+
+  Component k_probe_step(const int64_t k, const int64_t id,
+                         const Component dist, std::vector<IdScore> &topk,
+                         const Component largest_dist) {
+    /*
+     * Checks if id should be added to the topk. If it should,
+     * it is added and the largest_dist is updated.
+     */
+    if (topk.size() < static_cast<size_t>(k)) {
+      topk.push_back({id, dist});
+      std::sort(topk.begin(), topk.end(), [](const auto &x, const auto &y) {
+        return x.second > y.second;
+      });
+    } else if (dist < largest_dist) {
+      stats::insert_unique_inplace(
+          IdScore{id, dist}, topk,
+          [](const auto &x, const auto &y) { return x.second < y.second; },
+          [](const auto &x, const auto &y) { return x.first == y.first; });
+    }
+    return topk.at(0).second;
+  }
+
+  std::pair<std::optional<std::vector<KV>>, StatTracker>
+  ids_to_kvs(const std::pair<ProbeResult<Component>, StatTracker> &found) {
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    return {result_to_kvs<KV>(found.first,
+                              [this](int64_t id) { return lookup(id); }),
+            found.second};
+  }
+
+  const Vect &lookup(int64_t id) const {
+    if (id < 0 || static_cast<size_t>(id) >= items.size())
+      throw std::out_of_range("LSH_Forest::lookup(id) id not in forest.");
+    return items.at(id);
+  }
+
+  bool contains(const Vect &q) {
+    /*
+     * Check if q is contained in the forest. Only the items with the same
+     * code as q in the first tree need to be checked.
+     */
+    const Tree &tree = trees.at(0);
+    const uint64_t key = prefix_key(hash_functions.at(0).project(q));
+    const auto range = prefix_range(tree, key, depth);
+    for (size_t pos = range.first; pos < range.second; ++pos) {
+      if (items.at(tree.ids.at(pos)).isApprox(q))
+        return true;
+    }
+    return false;
+  }
+
+  void print_stats() {}
+
+  size_t num_tables() const { return trees.size(); }
+};
+
+} // namespace nr
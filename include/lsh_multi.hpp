@@ -13,14 +13,22 @@
 #include <utility>
 #include <vector>
 
+#include "addressing.hpp"
+#include "dispatch.hpp"
 #include "fast_sim.hpp"
+#include "interleave.hpp"
 #include "kv_comparator.hpp"
+#include "matrix_rows.hpp"
 #include "multiprobe.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
 #include "sign_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
 #include "stats/topk.hpp"
 #include "tables.hpp"
+#include "thread_pool.hpp"
+#include "visited_set.hpp"
 
 /*
  * Implementation of Mulitprobe Locality Sensitive Hashing
@@ -30,38 +38,106 @@
 namespace mp = boost::multiprecision;
 namespace nr {
 
-template <typename Vect, typename Hash = SignLSH<typename Vect::value_type>>
-class LSH_MultiProbe_MultiTable : public MultiProbe<Vect> {
+template <typename Vect, typename Hash = SignLSH<typename Vect::value_type,
+                                                 Vect::RowsAtCompileTime>>
+class LSH_MultiProbe_MultiTable
+    : public MultiProbe<LSH_MultiProbe_MultiTable<Vect, Hash>, Vect> {
 private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
   using Component = typename Vect::value_type;
   using KV = std::pair<Vect, int64_t>;
+  using IdScore = std::pair<int64_t, Component>;
   using Table = std::unordered_map<size_t, std::list<KV>>;
   using MultiTable = std::vector<Table>;
 
   MultiTable tables;
+  std::vector<size_t> id_buckets; // bucket of each id in the first table.
   int64_t dim;
   int64_t num_buckets;
+  size_t bit_lim; // low bits of a bucket index flipped when probing.
   std::vector<Hash> hash_functions;
+  // one visited set per running query, shared by its tables.
+  mutable VisitedPool scratch;
+  // intra-query parallelism. Each task takes its own visited set from
+  // scratch and has its own topk.
+  size_t parallelism = 1;
+  ThreadPool *pool = nullptr; // ThreadPool::shared() if not set.
+  std::list<KV> empty_bucket;
+  // number of queries the batch path scans at once.
+  size_t batch_width = 8;
+
+  struct BatchCursor {
+    // how far one query of a batch has got.
+    Component largest_dist;
+    std::vector<IdScore> topk;
+    StatTracker tracker;
+    size_t table;                 // table of the staged bucket.
+    size_t rank;                  // position of the staged bucket.
+    const std::list<KV> *ready;   // bucket scanned next step.
+    const std::list<KV> *staged;  // bucket after it, being prefetched.
+  };
+
+  const std::list<KV> *stage(const QueryContext<Vect> &ctx,
+                             BatchCursor &cursor) const {
+    /*
+     * finds the bucket after the staged one and prefetches its first node.
+     * nullptr once every table's probe sequence is done.
+     */
+    ++cursor.rank;
+    while (cursor.table < tables.size() &&
+           cursor.rank >= ctx.hashes.at(cursor.table).probe_sequence.size()) {
+      ++cursor.table;
+      cursor.rank = 0;
+    }
+    if (cursor.table == tables.size())
+      return nullptr;
+    const std::list<KV> &bucket = bucket_at(
+        cursor.table, ctx.hashes.at(cursor.table).probe_sequence.at(cursor.rank));
+    prefetch_nodes(bucket);
+    return &bucket;
+  }
 
-  std::vector<size_t> rank(const Vect &q, size_t table, size_t max_hash,
-                           int64_t adj) {
+  const std::list<KV> &bucket_at(size_t table, size_t idx) const {
     /*
-     * Returns the adj indices that are most similar to q's hash.
+     * the bucket idx of a table, or an empty bucket. Unlike operator[] this
+     * never inserts, so tables can be read from several threads.
+     */
+    auto search = tables.at(table).find(idx);
+    if (search == tables.at(table).end())
+      return empty_bucket;
+    return search->second;
+  }
+
+  std::vector<int64_t> rank(size_t idx) const {
+    /*
+     * Returns the indices that are most similar to the hash idx.
      * These have the highest chance of containing a neighbor of q.
      */
-    const static size_t bit_lim = std::floor(std::log2(num_buckets)) + 1;
-    const size_t idx = hash_functions.at(table).hash_max(q, num_buckets);
-    return fast_sim_2bit(idx, bit_lim);
+    const std::vector<size_t> similar = fast_sim_2bit(idx, bit_lim);
+    std::vector<int64_t> ranked(0);
+    ranked.reserve(similar.size());
+    for (const size_t bucket : similar) {
+      // with Modulo addressing, flipping bits can leave the table.
+      if (bucket < static_cast<size_t>(num_buckets))
+        ranked.push_back(bucket);
+    }
+    return ranked;
   }
 
 public:
   LSH_MultiProbe_MultiTable(int64_t num_tables, int64_t bits, int64_t dimension,
-                            int64_t num_buckets)
+                            int64_t num_buckets,
+                            Addressing addressing = Addressing::Modulo)
       : tables(num_tables, std::unordered_map<size_t, std::list<KV>>()),
-        dim(dimension), num_buckets(num_buckets), hash_functions() {
+        dim(dimension), num_buckets(num_buckets),
+        bit_lim(address_bits(num_buckets, addressing)), hash_functions() {
     /*
      * Each table has its own hash function.
      */
+    check_addressing(num_buckets, bits, addressing,
+                     "LSH_MultiProbe_MultiTable");
     for (int64_t i = 0; i < num_tables; ++i) {
       hash_functions.emplace_back(bits, dim);
     }
@@ -73,124 +149,491 @@ public:
     hash_function(other.hash_function);
   }
 
-  template <typename Cont>
+  template <typename Cont,
+            typename = std::enable_if_t<!is_eigen<Cont>::value>>
   void fill(const Cont &data, bool is_normalized = false) {
     /*
      * fills the hash tables with input data.
      * The "is_normalized" argument is not necessary for this table.
      * It defaults to false so a value does not need to be passed in.
      */
+    id_buckets.resize(data.size());
+    scratch.resize(data.size());
     for (size_t table = 0; table < tables.size(); ++table) {
       const auto &hash = hash_functions.at(table);
       int64_t id = 0;
       for (const auto &datum : data) {
         const size_t hash_value = hash.hash_max(datum, num_buckets);
         tables.at(table)[hash_value].push_back({datum, id});
+        if (table == 0)
+          id_buckets.at(id) = hash_value;
         ++id;
       }
     }
   }
 
-  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q, int64_t adj) {
+  template <typename Derived,
+            typename = std::enable_if_t<is_eigen<Derived>::value>>
+  void fill(const Eigen::MatrixBase<Derived> &rows,
+            bool is_normalized = false) {
+    /*
+     * fills from a matrix with one item per row, e.g. a row-major matrix
+     * mapped over a numpy array. Rows are read in place, so the data is not
+     * copied into separate vectors first.
+     */
+    if (rows.cols() != dim)
+      throw std::runtime_error(
+          "LSH_MultiProbe_MultiTable::fill, rows.cols() != dim");
+    fill(matrix_rows<Vect>(rows), is_normalized);
+  }
+
+  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q,
+                                                  int64_t adj) const {
     /*
      * returns vector closest to q found in the adj highest ranked buckets.
      * If every bucket checked is empty, then no neighbor will be found.
      * This is the only case it can return nullopt.
      */
+    auto found = probe_ids(q, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) const {
+    /*
+     * returns the id and distance of the vector closest to q found in the adj
+     * highest ranked buckets. The result is empty if every bucket was empty.
+     */
+    return probe_ids(context(q, adj));
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const Eigen::MatrixBase<Derived> &q, int64_t adj) const {
+    // q can be any vector expression, such as a Map or a row of a matrix.
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) const {
+    const Vect &q = ctx.query;
     StatTracker tracker;
-    KV neighbor = KV();
+    VisitedPool::Lease visited = scratch.take();
+    int64_t neighbor = -1;
     Component min_dist = std::numeric_limits<Component>::max();
     for (size_t table = 0; table < tables.size(); ++table) {
       tracker.incr_tables_probed();
-      for (size_t idx : rank(q, table, num_buckets, adj)) {
+      for (const int64_t idx : ctx.hashes.at(table).probe_sequence) {
         tracker.incr_buckets_probed();
-        for (const KV &x : tables.at(table)[idx]) {
+        for (const KV &x : bucket_at(table, idx)) {
+          if (!visited->visit(x.second)) {
+            tracker.incr_duplicates_skipped();
+            continue;
+          }
           tracker.incr_comparisons();
-          Component dist = (q - x.first).norm();
+          Component dist = distance(q, x.first);
           if (dist < min_dist) {
-            neighbor = x;
+            neighbor = x.second;
             min_dist = dist;
           }
         }
       }
     }
-    if (min_dist == std::numeric_limits<Component>::max())
-      return {std::nullopt, tracker};
-    return {neighbor, tracker};
+    ProbeResult<Component> result;
+    if (neighbor >= 0)
+      result.push_back(neighbor, min_dist);
+    return {result, tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe(int64_t k, const Vect &q, size_t adj) {
+  k_probe(int64_t k, const Vect &q, size_t adj) const {
     /*
      * Returns the k vectors in adj highest ranked buckets that are closest to
      * the input vector q.
      */
+    return ids_to_kvs(k_probe_ids(k, q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t adj) const {
+    /*
+     * Returns the ids and distances of the k vectors in adj highest ranked
+     * buckets that are closest to the input vector q.
+     */
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Eigen::MatrixBase<Derived> &q,
+              size_t adj) const {
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) const {
+    if (parallelism > 1 && tables.size() > 1)
+      return k_probe_parallel(k, ctx);
+
     StatTracker tracker;
-    std::vector<std::pair<KV, Component>> topk(0);
+    VisitedPool::Lease visited = scratch.take();
+    std::vector<IdScore> topk(0);
     topk.reserve(k + 1);
     Component largest_dist = std::numeric_limits<Component>::max();
 
     for (size_t table = 0; table < tables.size(); ++table) {
-      tracker.incr_tables_probed();
-      for (size_t idx : rank(q, table, num_buckets, adj)) {
-        tracker.incr_buckets_probed();
-        for (const KV &x : tables.at(table)[idx]) {
-          tracker.incr_comparisons();
-          Component dist = (q - x.first).norm();
-          largest_dist = k_probe_step(k, x, dist, topk, largest_dist);
+      largest_dist =
+          k_probe_table(k, ctx, table, largest_dist, topk, *visited, tracker);
+    }
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
+  }
+
+  Component k_probe_table(int64_t k, const QueryContext<Vect> &ctx,
+                          size_t table, Component largest_dist,
+                          std::vector<IdScore> &topk, VisitedSet &seen,
+                          StatTracker &tracker) const {
+    /*
+     * probes the ranked buckets of one table. Only reads the table, so
+     * different tables can be scanned at the same time as long as each has
+     * its own topk, seen and tracker.
+     */
+    const Vect &q = ctx.query;
+    tracker.incr_tables_probed();
+    for (const int64_t idx : ctx.hashes.at(table).probe_sequence) {
+      tracker.incr_buckets_probed();
+      const std::list<KV> &bucket = bucket_at(table, idx);
+      for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+        prefetch_ahead(it, bucket.end());
+        const KV &x = *it;
+        if (!seen.visit(x.second)) {
+          tracker.incr_duplicates_skipped();
+          continue;
         }
+        tracker.incr_comparisons();
+        Component dist = distance(q, x.first);
+        largest_dist = k_probe_step(k, x.second, dist, topk, largest_dist);
       }
     }
-    return k_probe_output(topk, tracker);
+    return largest_dist;
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_parallel(int64_t k, const QueryContext<Vect> &ctx) const {
+    /*
+     * scans the tables concurrently on the shared thread pool. Task j scans
+     * tables j, j + tasks, ... into its own topk, and the topks are merged
+     * at the end. An id found by several tasks is compared once per task,
+     * but the result is the same as the serial scan.
+     */
+    const size_t tasks = std::min(parallelism, tables.size());
+    std::vector<std::vector<IdScore>> topks(tasks);
+    std::vector<StatTracker> trackers(tasks);
+    ThreadPool &workers = pool ? *pool : ThreadPool::shared();
+    workers.parallel_for(tasks, tasks, [&](size_t task) {
+      std::vector<IdScore> &topk = topks.at(task);
+      topk.reserve(k + 1);
+      VisitedPool::Lease seen = scratch.take();
+      Component largest_dist = std::numeric_limits<Component>::max();
+      for (size_t table = task; table < tables.size(); table += tasks) {
+        largest_dist = k_probe_table(k, ctx, table, largest_dist, topk, *seen,
+                                     trackers.at(task));
+      }
+    });
+
+    StatTracker tracker;
+    std::vector<IdScore> merged(0);
+    for (size_t task = 0; task < tasks; ++task) {
+      tracker += trackers.at(task);
+      merged.insert(merged.end(), topks.at(task).begin(),
+                    topks.at(task).end());
+    }
+    // the k nearest distinct ids, ordered distant to nearest.
+    std::sort(merged.begin(), merged.end(),
+              [](const IdScore &x, const IdScore &y) {
+                return x.first < y.first;
+              });
+    merged.erase(std::unique(merged.begin(), merged.end(),
+                             [](const IdScore &x, const IdScore &y) {
+                               return x.first == y.first;
+                             }),
+                 merged.end());
+    const size_t keep = std::min(merged.size(), static_cast<size_t>(k));
+    std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(),
+                      [](const IdScore &x, const IdScore &y) {
+                        return x.second < y.second;
+                      });
+    merged.resize(keep);
+    std::reverse(merged.begin(), merged.end());
+    return {ProbeResult<Component>::from_pairs(merged), tracker};
   }
 
   std::pair<std::optional<KV>, StatTracker>
-  probe_approx(const Vect &q, Component c, int64_t adj) {
+  probe_approx(const Vect &q, Component c, int64_t adj) const {
     /*
      * Returns the first vector within distance c that is found in the
      * adj highest ranked buckets.
      */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) const {
+    /*
+     * Returns the id and distance of the first vector within distance c that
+     * is found in the adj highest ranked buckets.
+     */
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Eigen::MatrixBase<Derived> &q, Component c,
+                   int64_t adj) const {
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) const {
+    const Vect &q = ctx.query;
     StatTracker tracker;
+    VisitedPool::Lease visited = scratch.take();
+    ProbeResult<Component> result;
     for (size_t table = 0; table < tables.size(); ++table) {
       tracker.incr_tables_probed();
-      for (size_t idx : rank(q, table, num_buckets, adj)) {
+      for (const int64_t idx : ctx.hashes.at(table).probe_sequence) {
         tracker.incr_buckets_probed();
-        for (const KV &x : tables.at(table)[idx]) {
+        for (const KV &x : bucket_at(table, idx)) {
+          if (!visited->visit(x.second)) {
+            tracker.incr_duplicates_skipped();
+            continue;
+          }
           tracker.incr_comparisons();
-          Component dist = (q - x.first).norm();
+          Component dist = distance(q, x.first);
           if (dist <= c) {
-            return {x, tracker};
+            result.push_back(x.second, dist);
+            return {result, tracker};
           }
         }
       }
     }
-    return {std::nullopt, tracker};
+    return {result, tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) {
+  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) const {
     /*
      * Function finds the first k items that are within distance c from
      * the query. Output is ordered by distant to nearest.
      */
+    return ids_to_kvs(k_probe_approx_ids(k, q, c, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c,
+                     size_t adj) const {
+    /*
+     * Function finds the ids and distances of the first k items that are
+     * within distance c from the query. Output is ordered by distant to
+     * nearest.
+     */
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Eigen::MatrixBase<Derived> &q,
+                     Component c, size_t adj) const {
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx,
+                     Component c) const {
+    const Vect &q = ctx.query;
     StatTracker tracker;
-    std::vector<std::pair<KV, Component>> topk(0);
+    VisitedPool::Lease visited = scratch.take();
+    std::vector<IdScore> topk(0);
     topk.reserve(k + 1); // allocate now so it doesn't need to resize
     for (size_t table = 0; table < tables.size(); ++table) {
       tracker.incr_tables_probed();
-      for (size_t idx : rank(q, table, num_buckets, adj)) {
+      for (const int64_t idx : ctx.hashes.at(table).probe_sequence) {
         tracker.incr_buckets_probed();
-        for (const KV &x : tables.at(table)[idx]) {
+        for (const KV &x : bucket_at(table, idx)) {
+          if (!visited->visit(x.second)) {
+            tracker.incr_duplicates_skipped();
+            continue;
+          }
           tracker.incr_comparisons();
-          Component dist = (q - x.first).norm();
+          Component dist = distance(q, x.first);
           if (dist <= c)
-            topk.push_back({x, dist});
+            topk.push_back({x.second, dist});
           if (topk.size() == static_cast<size_t>(k))
-            return k_probe_approx_output(k, topk, tracker);
+            return k_probe_approx_output(topk, tracker);
+        }
+      }
+    }
+    return k_probe_approx_output(topk, tracker);
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) const {
+    return context<Vect>(q, adj);
+  }
+
+  template <typename Derived>
+  QueryContext<Vect> context(const Eigen::MatrixBase<Derived> &q,
+                             int64_t /* adj */) const {
+    /*
+     * hashes q once with every table's hash function. The context can be
+     * passed to any of the probe functions in place of the query and adj.
+     * The probe sequence covers every bucket within 2 bits of q's hash, so
+     * adj does not change it. q is copied into the context once, so it can
+     * be a view of a larger matrix. The query isn't normalized, since
+     * these tables hash it as it is.
+     */
+    QueryContext<Vect> ctx(q);
+    ctx.hashes.reserve(tables.size());
+    for (const Hash &hash : hash_functions) {
+      HashedQuery<Vect> hashed = hash_query(hash, ctx.query, num_buckets);
+      hashed.probe_sequence = rank(hashed.bucket);
+      ctx.hashes.push_back(hashed);
+    }
+    return ctx;
+  }
+
+  template <typename Cont>
+  std::vector<QueryContext<Vect>> contexts(const Cont &qs,
+                                           int64_t /* adj */) const {
+    /*
+     * context for every query in qs. Each hash function hashes the whole
+     * batch with one matrix product. Like context, adj does not change the
+     * probe sequence. qs is anything with size() and at(i).
+     */
+    std::vector<QueryContext<Vect>> ctxs = make_contexts<Vect>(qs);
+    const BatchMatrix<Vect> columns = as_columns(ctxs, false);
+    for (auto &ctx : ctxs) {
+      ctx.hashes.reserve(tables.size());
+    }
+    for (const Hash &hash : hash_functions) {
+      std::vector<HashedQuery<Vect>> hashed =
+          hash_queries<Vect>(hash, columns, num_buckets);
+      for (size_t j = 0; j < ctxs.size(); ++j) {
+        hashed.at(j).probe_sequence = rank(hashed.at(j).bucket);
+        ctxs.at(j).hashes.push_back(std::move(hashed.at(j)));
+      }
+    }
+    return ctxs;
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_batch(int64_t k, const std::vector<Vect> &qs,
+                    size_t adj) const {
+    /*
+     * k_probe_ids for every query in qs, hashing them as one batch.
+     */
+    return k_probe_ids_batch(k, contexts(qs, adj));
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_batch(int64_t k,
+                    const std::vector<QueryContext<Vect>> &ctxs) const {
+    /*
+     * interleaves the scans of up to batch_width queries. Each step scans
+     * one ranked bucket of one query, then prefetches the query's next
+     * buckets before moving on to the next query. Every query scans the
+     * same buckets in the same order as k_probe_ids, so the results match.
+     */
+    std::vector<BatchCursor> cursors(ctxs.size());
+    // one visited set per slot, reused by each query that takes the slot.
+    std::vector<VisitedPool::Lease> batch_visited;
+    batch_visited.reserve(batch_width);
+    for (size_t slot = 0; slot < batch_width; ++slot) {
+      batch_visited.push_back(scratch.take());
+    }
+
+    auto start = [&](size_t query, size_t slot) {
+      BatchCursor &cursor = cursors.at(query);
+      cursor.largest_dist = std::numeric_limits<Component>::max();
+      cursor.topk.reserve(k + 1);
+      for (size_t table = 0; table < tables.size(); ++table) {
+        cursor.tracker.incr_tables_probed();
+      }
+      batch_visited.at(slot)->clear();
+      cursor.table = 0;
+      cursor.rank = static_cast<size_t>(-1); // stage moves to rank 0.
+      cursor.ready = stage(ctxs.at(query), cursor);
+      cursor.staged = cursor.ready ? stage(ctxs.at(query), cursor) : nullptr;
+    };
+
+    auto step = [&](size_t query, size_t slot) {
+      BatchCursor &cursor = cursors.at(query);
+      if (!cursor.ready)
+        return false;
+      const Vect &q = ctxs.at(query).query;
+      VisitedSet &seen = *batch_visited.at(slot);
+      cursor.tracker.incr_buckets_probed();
+      const std::list<KV> &bucket = *cursor.ready;
+      for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+        prefetch_ahead(it, bucket.end());
+        if (!seen.visit(it->second)) {
+          cursor.tracker.incr_duplicates_skipped();
+          continue;
         }
+        cursor.tracker.incr_comparisons();
+        const Component dist = distance(q, it->first);
+        cursor.largest_dist =
+            k_probe_step(k, it->second, dist, cursor.topk, cursor.largest_dist);
       }
+      // the staged bucket's node was requested a step ago, so its first
+      // vector can be requested now. Then stage the bucket after it.
+      cursor.ready = cursor.staged;
+      if (!cursor.ready)
+        return false;
+      prefetch_items(*cursor.ready);
+      cursor.staged = stage(ctxs.at(query), cursor);
+      return true;
+    };
+
+    interleave(ctxs.size(), batch_width, start, step);
+
+    std::vector<std::pair<ProbeResult<Component>, StatTracker>> results(0);
+    results.reserve(ctxs.size());
+    for (const BatchCursor &cursor : cursors) {
+      results.push_back(
+          {ProbeResult<Component>::from_pairs(cursor.topk), cursor.tracker});
     }
-    return k_probe_approx_output(k, topk, tracker);
+    return results;
+  }
+
+  void set_batch_width(size_t width) {
+    /*
+     * number of queries k_probe_ids_batch scans at once. Wider batches hide
+     * more memory latency, as long as the queries' buckets stay in cache.
+     */
+    batch_width = std::max<size_t>(width, 1);
+  }
+
+  const Vect &lookup(int64_t id) const {
+    /*
+     * returns the vector that was inserted with the given id.
+     * Every table contains every vector, so only the first is searched.
+     */
+    const Table &t = tables.at(0);
+    auto search = t.find(id_buckets.at(id));
+    if (search != t.end()) {
+      for (const KV &x : search->second) {
+        if (x.second == id)
+          return x.first;
+      }
+    }
+    throw std::out_of_range(
+        "LSH_MultiProbe_MultiTable::lookup(id) id not in bucket.");
   }
 
   bool contains(const Vect &q) {
@@ -210,72 +653,81 @@ public:
     return q_iter != l.end();
   }
 
-  Component k_probe_step(const int64_t k, const KV &x, const Component dist,
-                         std::vector<std::pair<KV, Component>> &topk,
-                         const Component largest_dist) {
+  static Component k_probe_step(const int64_t k, const int64_t id,
+                                const Component dist,
+                                std::vector<IdScore> &topk,
+                                const Component largest_dist) {
     /*
-     * Checks if x should be added to the topk. If it should,
+     * Checks if id should be added to the topk. If it should,
      * it is added and the largest_dist is updated.
      */
     if (topk.size() < static_cast<size_t>(k)) {
-      topk.push_back({x, dist});
+      topk.push_back({id, dist});
       std::sort(topk.begin(), topk.end(), [](const auto &x, const auto &y) {
         return x.second > y.second;
       });
     } else if (dist < largest_dist) {
-      insert_in_topk({x, dist}, topk);
+      insert_in_topk({id, dist}, topk);
     }
     return topk.at(0).second;
   }
 
-  void insert_in_topk(const std::pair<KV, Component> &to_add,
-                      std::vector<std::pair<KV, Component>> &topk) {
+  static void insert_in_topk(const IdScore &to_add,
+                             std::vector<IdScore> &topk) {
     /*
      * insert to_add into the topk so that the topk is distant to nearest.
      */
     stats::insert_unique_inplace(
         to_add, topk,
         [](const auto &x, const auto &y) { return x.second < y.second; },
-        [](const auto &x, const auto &y) {
-          return x.first.second == y.first.second;
-        });
+        [](const auto &x, const auto &y) { return x.first == y.first; });
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe_output(const std::vector<std::pair<KV, Component>> &topk,
-                 StatTracker tracker) {
+  ids_to_kvs(
+      const std::pair<ProbeResult<Component>, StatTracker> &found) const {
     /*
-     * simple function to process the output for k_probe.
-     * if the topk is empty, it returns nullopt. otherwise, it copies
-     * topk into a vector<KV> and returns that.
+     * simple function to process the output for the probes that return
+     * vectors. if nothing was found, it returns nullopt. otherwise, it looks
+     * up the vector of every id found.
      */
-    if (topk.size() == 0)
-      return {std::nullopt, tracker};
-    else {
-      std::vector<KV> topk_out(topk.size());
-      for (size_t i = 0; i < topk.size(); ++i)
-        topk_out.at(i) = topk.at(i).first;
-      return {topk_out, tracker};
-    }
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    return {result_to_kvs<KV>(found.first,
+                              [this](int64_t id) { return lookup(id); }),
+            found.second};
   }
 
-  std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe_approx_output(int64_t k, std::vector<std::pair<KV, Component>> &topk,
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_output(std::vector<IdScore> &topk,
                         StatTracker &tracker) const {
     /*
      * Function to format the topk for k_probe_approx.
      * the topk should be order distant to nearest.
      */
-    if (topk.size() == 0)
-      return {std::nullopt, tracker};
     // should be sorted distant to nearest.
     std::sort(topk.begin(), topk.end(),
               [](const auto &x, const auto &y) { return x.second > y.second; });
-    std::vector<KV> topk_output(topk.size());
-    for (size_t i = 0; i < topk.size(); ++i) {
-      topk_output.at(i) = topk.at(i).first;
-    }
-    return {topk_output, tracker};
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
+  }
+
+  void set_parallelism(size_t threads) {
+    /*
+     * number of threads, including the caller, that k_probe_ids may use to
+     * scan tables concurrently. 1, the default, scans them serially. Threads
+     * come from ThreadPool::shared(), so no threads are started per query.
+     */
+    parallelism = std::max<size_t>(threads, 1);
+  }
+
+  size_t get_parallelism() const { return parallelism; }
+
+  void set_thread_pool(ThreadPool &workers) {
+    /*
+     * runs parallel scans on workers rather than ThreadPool::shared(), e.g.
+     * a pool pinned to the NUMA node this index was built on.
+     */
+    pool = &workers;
   }
 
   void print_stats() {}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Read-only memory maps of data files, so a dataset larger than RAM can be
+ * read without loading it. Pages are read from the file the first time they
+ * are touched, and release() hands them back once a pass is done with them.
+ */
+
+namespace nr {
+
+class MappedFile {
+private:
+  void *addr = nullptr;
+  size_t length = 0;
+
+  void unmap() {
+    if (addr != nullptr)
+      ::munmap(addr, length);
+    addr = nullptr;
+    length = 0;
+  }
+
+public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("MappedFile, can't open " + path);
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error("MappedFile, can't stat " + path);
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0) {
+      addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        addr = nullptr;
+        ::close(fd);
+        throw std::runtime_error("MappedFile, can't map " + path);
+      }
+    }
+    // the mapping keeps the file open.
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile &other) = delete;
+  MappedFile &operator=(const MappedFile &other) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : addr(other.addr), length(other.length) {
+    other.addr = nullptr;
+    other.length = 0;
+  }
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      unmap();
+      std::swap(addr, other.addr);
+      std::swap(length, other.length);
+    }
+    return *this;
+  }
+
+  ~MappedFile() { unmap(); }
+
+  const char *data() const { return static_cast<const char *>(addr); }
+
+  size_t size() const { return length; }
+
+  void advise_sequential() const {
+    // the kernel can read ahead further for a front to back pass.
+    if (addr != nullptr)
+      ::madvise(addr, length, MADV_SEQUENTIAL);
+  }
+
+  void release(size_t begin, size_t end) const {
+    /*
+     * drops the whole pages in bytes [begin, end) from this process. They
+     * are read from the file again if touched, so a pass over the file only
+     * keeps about one chunk resident.
+     */
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t first = (begin + page - 1) / page * page;
+    const size_t last = std::min(end, length) / page * page;
+    if (addr != nullptr && first < last)
+      ::madvise(static_cast<char *>(addr) + first, last - first,
+                MADV_DONTNEED);
+  }
+};
+
+template <typename Vect> class MappedRows {
+private:
+  using Component = typename Vect::value_type;
+
+  MappedFile file;
+  size_t offset;   // bytes before the first row.
+  int64_t dim;     // components per row.
+  size_t stride;   // components from the start of one row to the next.
+  size_t num_rows;
+
+public:
+  using value_type = Vect;
+  using Row = Eigen::Map<const Vect>;
+  using RowMatrix =
+      Eigen::Matrix<Component, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+  using Matrix = Eigen::Map<const RowMatrix, 0, Eigen::OuterStride<>>;
+
+  MappedRows(MappedFile file, int64_t dim, size_t offset = 0,
+             size_t stride = 0)
+      : file(std::move(file)), offset(offset), dim(dim),
+        stride(stride == 0 ? dim : stride), num_rows(0) {
+    /*
+     * rows of Components stored one after another in file, starting at
+     * offset. stride is 0 when rows are packed with nothing between them.
+     */
+    if (dim <= 0)
+      throw std::runtime_error("MappedRows, dim must be positive");
+    if (Vect::RowsAtCompileTime != Eigen::Dynamic &&
+        dim != Vect::RowsAtCompileTime)
+      throw std::runtime_error("MappedRows, dim does not match Vect");
+    if (this->stride < static_cast<size_t>(dim))
+      throw std::runtime_error("MappedRows, stride is shorter than a row");
+    if (offset % sizeof(Component) != 0)
+      throw std::runtime_error("MappedRows, rows are not aligned");
+    const size_t row_bytes = dim * sizeof(Component);
+    const size_t size = this->file.size();
+    // the last row does not need anything after it.
+    if (size >= offset + row_bytes)
+      num_rows = (size - offset - row_bytes) /
+                     (this->stride * sizeof(Component)) +
+                 1;
+  }
+
+  size_t size() const { return num_rows; }
+
+  int64_t dimension() const { return dim; }
+
+  const Component *row_data(size_t i) const {
+    return reinterpret_cast<const Component *>(file.data() + offset) +
+           i * stride;
+  }
+
+  Row at(size_t i) const {
+    if (i >= num_rows)
+      throw std::out_of_range("MappedRows::at, row out of range");
+    return Row(row_data(i), dim);
+  }
+
+  Row operator[](size_t i) const { return Row(row_data(i), dim); }
+
+  Matrix matrix() const {
+    // every row at once, e.g. to fill from or to probe with in a batch.
+    return Matrix(row_data(0), num_rows, dim, Eigen::OuterStride<>(stride));
+  }
+
+  void advise_sequential() const { file.advise_sequential(); }
+
+  void release(size_t begin, size_t end) const {
+    // drops the pages holding rows [begin, end).
+    const size_t row_bytes = stride * sizeof(Component);
+    file.release(offset + begin * row_bytes, offset + end * row_bytes);
+  }
+};
+
+} // namespace nr
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Lets the rows of an Eigen matrix stand in for a container of vectors, so
+ * data already held in one big matrix (a numpy array, a mapped file) can be
+ * passed to fill without first copying every row into its own vector.
+ * at(i) is a view of row i as a column vector. A row-major matrix keeps
+ * each row contiguous, so reading a row is a sequential scan.
+ * The matrix must outlive the MatrixRows.
+ */
+
+namespace nr {
+
+template <typename T>
+using is_eigen = std::is_base_of<Eigen::EigenBase<T>, T>;
+
+template <typename Vect, typename Derived> class MatrixRows {
+private:
+  const Derived &matrix;
+
+public:
+  using value_type = Vect;
+  // row i of the matrix, viewed as a column vector.
+  using Row = decltype(std::declval<const Derived &>().row(0).transpose());
+
+  class const_iterator {
+  private:
+    const MatrixRows *rows;
+    size_t i;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Vect;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Row;
+
+    const_iterator(const MatrixRows *rows, size_t i) : rows(rows), i(i) {}
+
+    reference operator*() const { return rows->at(i); }
+
+    const_iterator &operator++() {
+      ++i;
+      return *this;
+    }
+
+    bool operator==(const const_iterator &other) const {
+      return i == other.i;
+    }
+
+    bool operator!=(const const_iterator &other) const {
+      return i != other.i;
+    }
+  };
+
+  explicit MatrixRows(const Eigen::MatrixBase<Derived> &matrix)
+      : matrix(matrix.derived()) {
+    if (Vect::RowsAtCompileTime != Eigen::Dynamic &&
+        matrix.cols() != Vect::RowsAtCompileTime)
+      throw std::runtime_error("MatrixRows, columns do not match Vect");
+  }
+
+  size_t size() const { return static_cast<size_t>(matrix.rows()); }
+
+  Row at(size_t i) const {
+    if (i >= size())
+      throw std::out_of_range("MatrixRows::at, row out of range");
+    return matrix.row(i).transpose();
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+
+  const_iterator end() const { return const_iterator(this, size()); }
+};
+
+template <typename Vect, typename Derived>
+MatrixRows<Vect, Derived> matrix_rows(const Eigen::MatrixBase<Derived> &rows) {
+  return MatrixRows<Vect, Derived>(rows);
+}
+
+} // namespace nr
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "popcount.hpp"
+#include "probe_result.hpp"
+#include "sign_lsh.hpp"
+#include "stat_tracker.hpp"
+#include "visited_set.hpp"
+
+/*
+ * Multi-index hashing (Norouzi et al.) for exact search in Hamming space.
+ * Each code is split into m disjoint substrings and there is one table per
+ * substring. If two codes are within Hamming distance r, then by the
+ * pigeonhole principle at least one of their substrings is within distance
+ * r / m. So a radius r search only enumerates small balls around each
+ * substring of the query, rather than around the whole code.
+ * This makes long codes (hundreds of bits) searchable without allocating a
+ * bucket for every possible code. Substrings of about log2(n) bits, so
+ * m = bits / log2(n), keep the substring tables sparse but not empty.
+ * Hash must be a sign family (SignLSH or SimpleLSH).
+ */
+
+namespace nr {
+
+template <typename Vect, typename Hash = SignLSH<typename Vect::value_type,
+                                                 Vect::RowsAtCompileTime>>
+class MultiIndexHashing {
+private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
+  using Component = typename Vect::value_type;
+  using IdScore = std::pair<int64_t, Component>;
+  using IdDist = std::pair<int64_t, size_t>;
+  using SubTable = std::unordered_map<uint64_t, std::vector<int64_t>>;
+
+  Hash hash_function;
+  size_t bits;
+  size_t words;                         // 64 bit words per code.
+  std::vector<size_t> sub_start;        // first bit of each substring.
+  std::vector<size_t> sub_bits;         // length of each substring.
+  std::vector<SubTable> sub_tables;     // one per substring.
+  std::vector<uint64_t> codes;          // code i starts at codes[i * words].
+  std::vector<Vect> items;              // item i has id i.
+  VisitedSet visited;
+
+  static uint64_t extract(const uint64_t *code, size_t start, size_t len) {
+    // bits [start, start + len) of code. len is at most 64.
+    const size_t word = start / 64;
+    const size_t offset = start % 64;
+    uint64_t out = code[word] >> offset;
+    if (offset != 0 && offset + len > 64)
+      out |= code[word + 1] << (64 - offset);
+    if (len < 64)
+      out &= (uint64_t(1) << len) - 1;
+    return out;
+  }
+
+  template <typename Op>
+  static void for_each_at_distance(uint64_t center, size_t len, size_t dist,
+                                   Op op) {
+    /*
+     * calls op on every len bit value at exactly Hamming distance dist from
+     * center, by flipping every combination of dist bits.
+     */
+    std::vector<size_t> flips(dist, 0);
+    for (size_t i = 0; i < dist; ++i) {
+      flips.at(i) = i;
+    }
+    if (dist > len)
+      return;
+    while (true) {
+      uint64_t value = center;
+      for (size_t bit : flips) {
+        value ^= uint64_t(1) << bit;
+      }
+      op(value);
+      // advance to the next combination in lexicographic order.
+      size_t i = dist;
+      while (i > 0 && flips.at(i - 1) == len - dist + i - 1) {
+        --i;
+      }
+      if (i == 0)
+        return;
+      ++flips.at(i - 1);
+      for (size_t j = i; j < dist; ++j) {
+        flips.at(j) = flips.at(j - 1) + 1;
+      }
+    }
+  }
+
+  template <typename Op>
+  void search_substrings(const std::vector<uint64_t> &query_code,
+                         size_t sub_radius, StatTracker &tracker, Op op) {
+    /*
+     * looks up every substring value at exactly sub_radius from the query's
+     * substrings. op is called with each id found for the first time this
+     * query, along with its full Hamming distance.
+     */
+    for (size_t s = 0; s < sub_tables.size(); ++s) {
+      const uint64_t center =
+          extract(query_code.data(), sub_start.at(s), sub_bits.at(s));
+      for_each_at_distance(
+          center, sub_bits.at(s), sub_radius, [&](uint64_t value) {
+            tracker.incr_buckets_probed();
+            auto found = sub_tables.at(s).find(value);
+            if (found == sub_tables.at(s).end())
+              return;
+            for (const int64_t id : found->second) {
+              if (!visited.visit(id)) {
+                tracker.incr_duplicates_skipped();
+                continue;
+              }
+              tracker.incr_comparisons();
+              op(id, hamming_distance(query_code.data(), code(id), words));
+            }
+          });
+    }
+  }
+
+  static void sort_nearest_first(std::vector<IdDist> &found) {
+    std::sort(found.begin(), found.end(), [](const IdDist &x, const IdDist &y) {
+      return x.second < y.second || (x.second == y.second && x.first < y.first);
+    });
+  }
+
+public:
+  MultiIndexHashing(int64_t bits, int64_t dimension, int64_t num_substrings)
+      : hash_function(bits, dimension), bits(bits), words(code_words(bits)),
+        sub_start(0), sub_bits(0), sub_tables(0), codes(0), items(0) {
+    if (num_substrings < 1 || num_substrings > bits) {
+      throw std::runtime_error(
+          "MultiIndexHashing, need between 1 and bits substrings");
+    }
+    const size_t m = static_cast<size_t>(num_substrings);
+    // the first bits % m substrings get an extra bit.
+    size_t start = 0;
+    for (size_t s = 0; s < m; ++s) {
+      const size_t len = this->bits / m + (s < this->bits % m ? 1 : 0);
+      if (len > 64) {
+        throw std::runtime_error(
+            "MultiIndexHashing, substrings can be at most 64 bits");
+      }
+      sub_start.push_back(start);
+      sub_bits.push_back(len);
+      start += len;
+    }
+    sub_tables.resize(m);
+  }
+
+  template <typename Cont>
+  void fill(const Cont &data, bool is_normalized = false) {
+    /*
+     * stores the code of every item in data and indexes each of its
+     * substrings. Ids are positions in data. Unless is_normalized, items are
+     * scaled by the largest norm before they are hashed.
+     */
+    Component max_norm = 0;
+    if (!is_normalized) {
+      for (const auto &datum : data) {
+        max_norm = std::max(max_norm, datum.norm());
+      }
+    }
+    if (max_norm <= 0)
+      max_norm = 1;
+    items.assign(data.begin(), data.end());
+    codes.assign(items.size() * words, 0);
+    visited.resize(items.size());
+    for (auto &sub_table : sub_tables) {
+      sub_table.clear();
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+      const Vect scaled = items.at(i) / max_norm;
+      uint64_t *item_code = codes.data() + i * words;
+      pack_signs(hash_function.project(scaled), item_code, words);
+      for (size_t s = 0; s < sub_tables.size(); ++s) {
+        const uint64_t key =
+            extract(item_code, sub_start.at(s), sub_bits.at(s));
+        sub_tables.at(s)[key].push_back(static_cast<int64_t>(i));
+      }
+    }
+  }
+
+  std::vector<uint64_t> hash_code(const Vect &q) const {
+    // packed code of the normalized query.
+    const auto norm = q.norm();
+    return pack_signs(hash_function.project(norm > 0 ? Vect(q / norm) : q));
+  }
+
+  std::pair<std::vector<IdDist>, StatTracker>
+  radius_search(const std::vector<uint64_t> &query_code, size_t radius) {
+    /*
+     * ids and Hamming distances of every item within radius of query_code,
+     * nearest first. Exact: by pigeonhole, only substrings within
+     * radius / m need to be enumerated.
+     */
+    StatTracker tracker;
+    std::vector<IdDist> found(0);
+    visited.clear();
+    const size_t sub_radius = radius / sub_tables.size();
+    for (size_t r = 0; r <= sub_radius; ++r) {
+      search_substrings(query_code, r, tracker,
+                        [&found, radius](int64_t id, size_t dist) {
+                          if (dist <= radius)
+                            found.push_back({id, dist});
+                        });
+    }
+    sort_nearest_first(found);
+    return {found, tracker};
+  }
+
+  std::pair<std::vector<IdDist>, StatTracker> radius_search(const Vect &q,
+                                                            size_t radius) {
+    return radius_search(hash_code(q), radius);
+  }
+
+  std::pair<std::vector<IdDist>, StatTracker>
+  k_nearest(int64_t k, const std::vector<uint64_t> &query_code) {
+    /*
+     * ids and Hamming distances of the k items nearest query_code, nearest
+     * first. Grows the substring radius one step at a time. After every
+     * substring has been searched to radius r, all items within distance
+     * m * (r + 1) - 1 have been seen, so the search stops once the k-th
+     * nearest is that close.
+     */
+    if (k < 1)
+      throw std::runtime_error("MultiIndexHashing::k_nearest, k < 1");
+    StatTracker tracker;
+    std::vector<IdDist> found(0);
+    visited.clear();
+    const size_t m = sub_tables.size();
+    const size_t kk = std::min(static_cast<size_t>(k), items.size());
+    if (kk == 0)
+      return {found, tracker};
+    const size_t longest = *std::max_element(sub_bits.begin(), sub_bits.end());
+    for (size_t r = 0; r <= longest; ++r) {
+      search_substrings(query_code, r, tracker,
+                        [&found](int64_t id, size_t dist) {
+                          found.push_back({id, dist});
+                        });
+      if (found.size() == items.size())
+        break; // everything has been seen.
+      if (found.size() >= kk) {
+        std::nth_element(found.begin(), found.begin() + (kk - 1), found.end(),
+                         [](const IdDist &x, const IdDist &y) {
+                           return x.second < y.second;
+                         });
+        if (found.at(kk - 1).second + 1 <= m * (r + 1))
+          break;
+      }
+    }
+    sort_nearest_first(found);
+    found.resize(std::min(found.size(), kk));
+    return {found, tracker};
+  }
+
+  std::pair<std::vector<IdDist>, StatTracker> k_nearest(int64_t k,
+                                                        const Vect &q) {
+    return k_nearest(k, hash_code(q));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t candidates) {
+    /*
+     * rescores the candidates items nearest q in Hamming distance with exact
+     * inner products. Returns the ids and inner products of the best k,
+     * ordered smallest to largest inner product like NR_MultiProbe.
+     */
+    if (k < 1)
+      throw std::runtime_error("MultiIndexHashing::k_probe_ids, k < 1");
+    auto nearest = k_nearest(std::max<int64_t>(k, candidates), q);
+    std::vector<IdScore> scored(0);
+    scored.reserve(nearest.first.size());
+    for (const IdDist &near : nearest.first) {
+      scored.push_back({near.first, q.dot(items.at(near.first))});
+    }
+    std::sort(scored.begin(), scored.end(),
+              [](const IdScore &x, const IdScore &y) {
+                return x.second < y.second;
+              });
+    if (scored.size() > static_cast<size_t>(k))
+      scored.erase(scored.begin(), scored.end() - k);
+    return {ProbeResult<Component>::from_pairs(scored), nearest.second};
+  }
+
+  const Vect &lookup(int64_t id) const {
+    if (id < 0 || static_cast<size_t>(id) >= items.size()) {
+      throw std::out_of_range(
+          "MultiIndexHashing::lookup(id) id not in index.");
+    }
+    return items.at(id);
+  }
+
+  const uint64_t *code(int64_t id) const {
+    // packed code of the item with the given id.
+    return codes.data() + static_cast<size_t>(id) * words;
+  }
+
+  size_t words_per_code() const { return words; }
+
+  size_t num_substrings() const { return sub_tables.size(); }
+
+  size_t size() const { return items.size(); }
+};
+
+} // namespace nr
@@ -4,10 +4,13 @@
 #include <iostream>
 #include <limits>
 #include <optional>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "kv_comparator.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
 #include "simple_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
@@ -15,36 +18,69 @@
 #include "tables.hpp"
 
 /*
- * Abstract base class for multiprobe tables.
+ * Base class for multiprobe tables, using static polymorphism (CRTP).
+ * Derived is the table itself, e.g. class LSH_Forest : public
+ * MultiProbe<LSH_Forest<Vect, Hash>, Vect>. Probes are called on the
+ * concrete type, so they are not virtual and can be inlined. Every table
+ * provides
+ *   probe, k_probe, probe_approx, k_probe_approx
+ *   probe_ids, k_probe_ids, probe_approx_ids, k_probe_approx_ids
+ *   context(q, adj), and the _ids probes taking a QueryContext
+ *   lookup(id), contains(q), print_stats(), num_tables()
+ * taking the arguments listed in is_multiprobe, which checks for them at
+ * compile time. Code that needs one type for every table, like
+ * the Python bindings, can use AnyMultiProbe (any_multiprobe.hpp).
  */
 
 namespace nr {
 
-template <typename Vect> class MultiProbe {
-private:
-  using Component = typename Vect::value_type;
-  using KV = std::pair<Vect, int64_t>;
+template <typename Index, typename Vect, typename = void>
+struct is_multiprobe : std::false_type {};
 
-public:
-  template <typename Cont> void fill(const Cont &data, bool is_normalized);
+template <typename Index, typename Vect>
+struct is_multiprobe<
+    Index, Vect,
+    std::void_t<
+        decltype(std::declval<Index &>().probe(std::declval<const Vect &>(),
+                                               int64_t())),
+        decltype(std::declval<Index &>().k_probe(
+            int64_t(), std::declval<const Vect &>(), size_t())),
+        decltype(std::declval<Index &>().probe_ids(
+            std::declval<const Vect &>(), int64_t())),
+        decltype(std::declval<Index &>().k_probe_ids(
+            int64_t(), std::declval<const Vect &>(), size_t())),
+        decltype(std::declval<Index &>().probe_approx_ids(
+            std::declval<const Vect &>(), typename Vect::value_type(),
+            int64_t())),
+        decltype(std::declval<Index &>().k_probe_approx_ids(
+            int64_t(), std::declval<const Vect &>(),
+            typename Vect::value_type(), size_t())),
+        decltype(std::declval<Index &>().context(std::declval<const Vect &>(),
+                                                 int64_t())),
+        decltype(std::declval<Index &>().probe_ids(
+            std::declval<const QueryContext<Vect> &>())),
+        decltype(std::declval<Index &>().k_probe_ids(
+            int64_t(), std::declval<const QueryContext<Vect> &>())),
+        decltype(std::declval<Index &>().probe_approx_ids(
+            std::declval<const QueryContext<Vect> &>(),
+            typename Vect::value_type())),
+        decltype(std::declval<Index &>().k_probe_approx_ids(
+            int64_t(), std::declval<const QueryContext<Vect> &>(),
+            typename Vect::value_type())),
+        decltype(std::declval<const Index &>().lookup(int64_t())),
+        decltype(std::declval<Index &>().contains(
+            std::declval<const Vect &>())),
+        decltype(std::declval<Index &>().print_stats()),
+        decltype(std::declval<const Index &>().num_tables())>>
+    : std::true_type {};
 
-  virtual std::pair<std::optional<KV>, StatTracker> probe(const Vect &q,
-                                                          int64_t adj) = 0;
-
-  virtual std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe(int64_t k, const Vect &q, size_t adj) = 0;
-
-  virtual std::pair<std::optional<KV>, StatTracker>
-  probe_approx(const Vect &q, Component c, int64_t adj) = 0;
-
-  virtual std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) = 0;
-
-  virtual bool contains(const Vect &q) = 0;
-
-  virtual void print_stats() = 0;
-
-  virtual size_t num_tables() const = 0;
+template <typename Derived, typename Vect> class MultiProbe {
+protected:
+  MultiProbe() {
+    // Derived is complete once its constructor instantiates this one.
+    static_assert(is_multiprobe<Derived, Vect>::value,
+                  "a table must provide the whole MultiProbe interface");
+  }
 };
 
 } // namespace nr
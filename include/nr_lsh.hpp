@@ -6,6 +6,7 @@
 #include "index_builder.hpp"
 #include "normal_matrix.hpp"
 #include "nr_multiprobe.hpp"
+#include "probe_result.hpp"
 #include "simple_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
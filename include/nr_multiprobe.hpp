@@ -4,17 +4,25 @@
 #include <algorithm>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <optional>
 #include <utility>
 #include <vector>
 
+#include "dispatch.hpp"
 #include "kv_comparator.hpp"
+#include "matrix_rows.hpp"
 #include "multiprobe.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
 #include "simple_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
 #include "stats/topk.hpp"
+#include "interleave.hpp"
 #include "tables.hpp"
+#include "thread_pool.hpp"
+#include "visited_set.hpp"
 
 /*
  * Multiprobe implementation of NR-LSH
@@ -22,28 +30,93 @@
 
 namespace nr {
 
-template <typename Vect> class NR_MultiProbe : public MultiProbe<Vect> {
+template <typename Vect, typename Hash = SimpleLSH<typename Vect::value_type,
+                                                   Vect::RowsAtCompileTime>>
+class NR_MultiProbe : public MultiProbe<NR_MultiProbe<Vect, Hash>, Vect> {
 private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
   using Component = typename Vect::value_type;
   using KV = std::pair<Vect, int64_t>;
+  using IdScore = std::pair<int64_t, Component>;
+  using ProbeTables = Tables<Vect, Hash>;
+  using Partition = Table<Vect, Hash>;
 
-  std::vector<Tables<Vect>> probe_tables;
+  std::vector<ProbeTables> probe_tables;
   int64_t dim;
+  // one visited set per running query, shared by its probe tables.
+  mutable VisitedPool scratch;
+  // intra-query parallelism. Each task takes its own visited set from
+  // scratch and has its own topk.
+  size_t parallelism = 1;
+  ThreadPool *pool = nullptr; // ThreadPool::shared() if not set.
+  // number of queries the batch path scans at once.
+  size_t batch_width = 8;
+
+  struct BatchCursor {
+    // how far one query of a batch has got.
+    Component q_norm;
+    Component smallest_inner;
+    std::vector<IdScore> topk;
+    StatTracker tracker;
+    size_t probe; // probe table of the next bucket.
+    size_t rank;  // position of the next bucket in the probe sequence.
+  };
+
+  void number_lists() {
+    // the shared lists of every probe table get their own numbers.
+    size_t lists = 0;
+    for (auto &probe_table : probe_tables) {
+      lists = probe_table.number_lists(lists);
+    }
+  }
+
+  bool seek(const QueryContext<Vect> &ctx, size_t &probe, size_t &rank) const {
+    // moves (probe, rank) to the next bucket that exists. false at the end.
+    while (probe < probe_tables.size() &&
+           rank >= ctx.hashes.at(probe).probe_sequence.size()) {
+      ++probe;
+      rank = 0;
+    }
+    return probe < probe_tables.size();
+  }
 
 public:
   NR_MultiProbe(int64_t num_tables, int64_t num_partitions, int64_t bits,
-                int64_t dim, size_t num_buckets)
-      : probe_tables(num_tables), dim(dim) {
-    for (auto &probe_table : probe_tables) {
-      probe_table = Tables<Vect>(num_partitions, bits, dim, num_buckets);
+                int64_t dim, size_t num_buckets,
+                Addressing addressing = Addressing::Modulo)
+      : dim(dim) {
+    // built in place. Each probe table has its own random hash.
+    probe_tables.reserve(num_tables);
+    for (int64_t t = 0; t < num_tables; ++t) {
+      probe_tables.emplace_back(num_partitions, bits, dim, num_buckets,
+                                addressing);
     }
   }
 
-  NR_MultiProbe(const NR_MultiProbe &other) {
-    probe_tables(other.probe_tables);
+  NR_MultiProbe(int64_t num_partitions, const std::vector<Hash> &hashes,
+                size_t num_buckets, Addressing addressing = Addressing::Modulo)
+      : dim(hashes.empty() ? 0 : hashes.front().dimension()) {
+    /*
+     * one probe table per hash. For families that are not built from
+     * (bits, dim), like PStableLSH.
+     */
+    probe_tables.reserve(hashes.size());
+    for (const Hash &hash : hashes) {
+      probe_tables.emplace_back(num_partitions, hash, num_buckets, addressing);
+    }
   }
 
-  template <typename Cont> void fill(const Cont &data, bool is_normalized) {
+  // copying duplicates every probe table, and so the whole dataset.
+  NR_MultiProbe(const NR_MultiProbe &other) = default;
+  NR_MultiProbe(NR_MultiProbe &&other) = default;
+  NR_MultiProbe &operator=(const NR_MultiProbe &other) = default;
+  NR_MultiProbe &operator=(NR_MultiProbe &&other) = default;
+
+  template <typename Cont,
+            typename = std::enable_if_t<!is_eigen<Cont>::value>>
+  void fill(const Cont &data, bool is_normalized) {
     /*
      * if is_normalized is true, then the data input to the table is
      * normalized, otherwise, it is inserted as the original unnormalised
@@ -56,87 +129,532 @@ public:
       }
       probe_table.fill(data, is_normalized);
     }
+    number_lists();
+    scratch.resize(data.size());
+  }
+
+  void fill_streaming(const MappedRows<Vect> &rows, const std::string &dir,
+                      bool is_normalized, size_t chunk_size = 4096) {
+    /*
+     * builds each probe table from rows mapped from a file, a chunk at a
+     * time, spilling buckets to dir. See Tables::fill_streaming. The norm
+     * boundaries are the same for every probe table, so the norms are read
+     * once, and only the hashing pass runs per table.
+     */
+    if (rows.dimension() != dim)
+      throw std::runtime_error("NR_MultiProbe::fill_streaming, wrong dim");
+    const std::vector<Component> boundaries =
+        probe_tables.at(0).streaming_boundaries(rows, chunk_size);
+    for (auto &probe_table : probe_tables) {
+      probe_table.fill_streaming(rows, boundaries, dir, is_normalized,
+                                 chunk_size);
+    }
+    number_lists();
+    scratch.resize(rows.size());
   }
 
-  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q, int64_t adj) {
+  template <typename Derived,
+            typename = std::enable_if_t<is_eigen<Derived>::value>>
+  void fill(const Eigen::MatrixBase<Derived> &rows, bool is_normalized) {
+    /*
+     * fills from a matrix with one item per row, e.g. a row-major matrix
+     * mapped over a numpy array. Rows are read in place, so the data is not
+     * copied into separate vectors first.
+     */
+    if (rows.cols() != dim)
+      throw std::runtime_error("NR_MultiProbe::fill, rows.cols() != dim");
+    fill(matrix_rows<Vect>(rows), is_normalized);
+  }
+
+  std::pair<std::optional<KV>, StatTracker> probe(const Vect &q,
+                                                  int64_t adj) const {
     /*
      * returns the vector in adj highest ranked buckets that has
      * the largest inner product with q.
      */
+    auto found = probe_ids(q, adj);
+    if (found.first.empty())
+      return std::make_pair(std::nullopt, found.second);
+    const int64_t id = found.first.ids.at(0);
+    return std::make_pair(KV{lookup(id), id}, found.second);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) const {
+    /*
+     * returns the id and inner product of the vector in adj highest ranked
+     * buckets that has the largest inner product with q.
+     */
+    return probe_ids(context(q, adj));
+  }
 
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const Eigen::MatrixBase<Derived> &q, int64_t adj) const {
+    // q can be any vector expression, such as a Map or a row of a matrix.
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) const {
     StatTracker tracker;
+    VisitedPool::Lease visited = scratch.take();
 
-    for (auto &probe_table : probe_tables) {
-      auto p = probe_table.probe(q, adj);
-      std::optional<KV> out = p.first;
+    for (size_t t = 0; t < probe_tables.size(); ++t) {
+      auto p = probe_tables.at(t).probe_ids(ctx.query, ctx.hashes.at(t),
+                                            *visited);
       tracker += p.second;
-      if (out)
-        return std::make_pair(out, tracker);
+      if (!p.first.empty())
+        return std::make_pair(p.first, tracker);
     }
-    return std::make_pair(std::nullopt, tracker);
+    return std::make_pair(ProbeResult<Component>(), tracker);
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe(int64_t k, const Vect &q, size_t adj) {
+  k_probe(int64_t k, const Vect &q, size_t adj) const {
     /*
      * returns the k vectors in adj highest ranked buckets that have the largest
      * inner products with q.
      */
+    auto found = k_probe_ids(k, q, adj);
+    return {result_to_kvs<KV>(found.first,
+                              [this](int64_t id) { return lookup(id); }),
+            found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Vect &q, size_t adj) const {
+    /*
+     * returns the ids and inner products of the k vectors in adj highest
+     * ranked buckets that have the largest inner products with q.
+     * Output is ordered smallest to largest inner product.
+     */
+    if (k < 1)
+      throw std::runtime_error("NR_MultiProbe::k_probe, k < 1");
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const Eigen::MatrixBase<Derived> &q,
+              size_t adj) const {
     if (k < 1)
       throw std::runtime_error("NR_MultiProbe::k_probe, k < 1");
+    return k_probe_ids(k, context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_ids(int64_t k, const QueryContext<Vect> &ctx) const {
+    if (k < 1)
+      throw std::runtime_error("NR_MultiProbe::k_probe, k < 1");
+
+    if (parallelism > 1 && probe_tables.size() > 1)
+      return k_probe_parallel(k, ctx);
 
     StatTracker tracker;
-    // store KV pair and the inner product value with q; avoid recomputing
-    std::vector<std::pair<KV, Component>> topk(0);
+    // store id and the inner product value with q; avoid recomputing
+    std::vector<IdScore> topk(0);
     // reserve memory now so it never needs to be resized in loops.
     topk.reserve(k + 1);
-    k_probe_tables(k, q, adj, topk);
-    // copy output to just a vector of KV.
-    std::vector<KV> topk_out(topk.size());
-    std::generate(topk_out.begin(), topk_out.end(),
-                  [&topk, n = -1]() mutable { return topk.at(++n).first; });
-    return {topk_out, tracker};
+    VisitedPool::Lease visited = scratch.take();
+    k_probe_tables(k, ctx, topk, *visited, tracker);
+    return {ProbeResult<Component>::from_pairs(topk), tracker};
   }
 
   std::pair<std::optional<KV>, StatTracker>
-  probe_approx(const Vect &q, Component c, int64_t adj) {
+  probe_approx(const Vect &q, Component c, int64_t adj) const {
     /*
      * returns the first vector in adj highest ranked buckets that has
      * an inner product with q that is greater than c.
      */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty())
+      return std::make_pair(std::nullopt, found.second);
+    const int64_t id = found.first.ids.at(0);
+    return std::make_pair(KV{lookup(id), id}, found.second);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) const {
+    /*
+     * returns the id and inner product of the first vector in adj highest
+     * ranked buckets that has an inner product with q that is greater than c.
+     */
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Eigen::MatrixBase<Derived> &q, Component c,
+                   int64_t adj) const {
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) const {
     StatTracker tracker;
-    for (auto &probe_table : probe_tables) {
+    VisitedPool::Lease visited = scratch.take();
+    for (size_t t = 0; t < probe_tables.size(); ++t) {
       tracker.incr_tables_probed();
-      auto p = probe_table.probe_approx(q, c, adj);
+      auto p = probe_tables.at(t).probe_approx_ids(ctx.query, ctx.hashes.at(t),
+                                                   c, *visited);
       tracker += p.second;
-      if (p.first)
-        return std::make_pair(p.first.value(), tracker);
+      if (!p.first.empty())
+        return std::make_pair(p.first, tracker);
     }
-    return std::make_pair(std::nullopt, tracker);
+    return std::make_pair(ProbeResult<Component>(), tracker);
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
-  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) {
+  k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) const {
     /*
      * returns the k vectors from adj buckets that have the largest inner
      * products with q.
      */
+    auto found = k_probe_approx_ids(k, q, c, adj);
+    return std::make_pair(
+        result_to_kvs<KV>(found.first,
+                          [this](int64_t id) { return lookup(id); }),
+        found.second);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c,
+                     size_t adj) const {
+    /*
+     * returns the ids and inner products of the first k vectors found in adj
+     * buckets with inner products greater than c.
+     */
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  template <typename Derived>
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Eigen::MatrixBase<Derived> &q,
+                     Component c, size_t adj) const {
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx,
+                     Component c) const {
     StatTracker tracker;
-    std::vector<KV> vects(0);
-    for (auto &probe_table : probe_tables) {
-      if (k - vects.size() > 0) {
-        auto found = probe_table.k_probe_approx(k - vects.size(), q, c, adj);
+    ProbeResult<Component> found_ids;
+    // ids found by one table are visited, so no other table returns them.
+    VisitedPool::Lease visited = scratch.take();
+    for (size_t t = 0; t < probe_tables.size(); ++t) {
+      if (k - static_cast<int64_t>(found_ids.size()) > 0) {
+        auto found = probe_tables.at(t).k_probe_approx_ids(
+            k - found_ids.size(), ctx.query, ctx.hashes.at(t), c, *visited);
         tracker += found.second;
-        if (found.first) {
-          std::vector<KV> v = found.first.value();
-          insert_kv(vects, v);
+        for (size_t i = 0; i < found.first.size(); ++i) {
+          found_ids.push_back(found.first.ids.at(i), found.first.scores.at(i));
         }
       }
     }
-    if (vects.size() == 0) {
-      std::make_pair(std::nullopt, tracker);
+    return std::make_pair(found_ids, tracker);
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) const {
+    return context<Vect>(q, adj);
+  }
+
+  template <typename Derived>
+  QueryContext<Vect> context(const Eigen::MatrixBase<Derived> &q,
+                             int64_t adj) const {
+    /*
+     * hashes q with every probe table's hash function, once. The context can
+     * be passed to any of the probe functions in place of the query and adj.
+     * q is copied into the context once, so it can be a view of a larger
+     * matrix.
+     */
+    QueryContext<Vect> ctx(q);
+    const Vect unit = ctx.normalized();
+    ctx.hashes.reserve(probe_tables.size());
+    for (const auto &probe_table : probe_tables) {
+      ctx.hashes.push_back(probe_table.hash_query(unit, adj));
+    }
+    return ctx;
+  }
+
+  template <typename Cont>
+  std::vector<QueryContext<Vect>> contexts(const Cont &qs, int64_t adj) const {
+    /*
+     * context for every query in qs. Each probe table hashes the whole batch
+     * with one matrix product. qs is anything with size() and at(i), like
+     * a std::vector or the MappedRows of a query file.
+     */
+    std::vector<QueryContext<Vect>> ctxs = make_contexts<Vect>(qs);
+    const BatchMatrix<Vect> normalized = as_columns(ctxs, true);
+    for (auto &ctx : ctxs) {
+      ctx.hashes.reserve(probe_tables.size());
+    }
+    for (const auto &probe_table : probe_tables) {
+      std::vector<HashedQuery<Vect>> hashed =
+          probe_table.hash_queries(normalized, adj);
+      for (size_t j = 0; j < ctxs.size(); ++j) {
+        ctxs.at(j).hashes.push_back(std::move(hashed.at(j)));
+      }
     }
-    return std::make_pair(vects, tracker);
+    return ctxs;
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_batch(int64_t k, const std::vector<Vect> &qs,
+                    size_t adj) const {
+    /*
+     * k_probe_ids for every query in qs, hashing them as one batch.
+     */
+    return k_probe_ids_batch(k, contexts(qs, adj));
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_batch(int64_t k,
+                    const std::vector<QueryContext<Vect>> &ctxs) const {
+    /*
+     * interleaves the scans of up to batch_width queries. Each step scans
+     * one ranked bucket of one query, then prefetches the query's next
+     * buckets before moving on to the next query. Every query scans the
+     * same buckets in the same order as k_probe_ids, so the results match.
+     */
+    if (k < 1)
+      throw std::runtime_error("NR_MultiProbe::k_probe_batch, k < 1");
+    std::vector<BatchCursor> cursors(ctxs.size());
+    // one visited set per slot, reused by each query that takes the slot.
+    std::vector<VisitedPool::Lease> batch_visited;
+    batch_visited.reserve(batch_width);
+    for (size_t slot = 0; slot < batch_width; ++slot) {
+      batch_visited.push_back(scratch.take());
+    }
+
+    auto start = [&](size_t query, size_t slot) {
+      const QueryContext<Vect> &ctx = ctxs.at(query);
+      BatchCursor &cursor = cursors.at(query);
+      cursor.q_norm = ctx.norm;
+      cursor.smallest_inner = std::numeric_limits<Component>::min();
+      cursor.topk.reserve(k + 1);
+      cursor.probe = 0;
+      cursor.rank = 0;
+      for (size_t probe = 0; probe < probe_tables.size(); ++probe) {
+        cursor.tracker.incr_tables_probed();
+      }
+      batch_visited.at(slot)->clear();
+      if (seek(ctx, cursor.probe, cursor.rank)) {
+        probe_tables.at(cursor.probe)
+            .prefetch_bucket(
+                ctx.hashes.at(cursor.probe).probe_sequence.at(cursor.rank));
+      }
+    };
+
+    auto step = [&](size_t query, size_t slot) {
+      const QueryContext<Vect> &ctx = ctxs.at(query);
+      BatchCursor &cursor = cursors.at(query);
+      if (!seek(ctx, cursor.probe, cursor.rank))
+        return false;
+      const ProbeTables &probe_table = probe_tables.at(cursor.probe);
+      const int64_t bucket_idx =
+          ctx.hashes.at(cursor.probe).probe_sequence.at(cursor.rank);
+      for (size_t t = 0; t < probe_table.size(); ++t) {
+        cursor.tracker.incr_buckets_probed();
+        cursor.smallest_inner = probe_bucket(
+            k, ctx.query, cursor.q_norm, probe_table.at(t), bucket_idx,
+            cursor.smallest_inner, cursor.topk, *batch_visited.at(slot),
+            cursor.tracker);
+      }
+      // the next bucket's nodes were requested a step ago, so its first
+      // vectors can be requested now. Then start on the bucket after.
+      ++cursor.rank;
+      if (!seek(ctx, cursor.probe, cursor.rank))
+        return false;
+      probe_tables.at(cursor.probe)
+          .prefetch_items(
+              ctx.hashes.at(cursor.probe).probe_sequence.at(cursor.rank));
+      size_t probe = cursor.probe;
+      size_t rank = cursor.rank + 1;
+      if (seek(ctx, probe, rank)) {
+        probe_tables.at(probe).prefetch_bucket(
+            ctx.hashes.at(probe).probe_sequence.at(rank));
+      }
+      return true;
+    };
+
+    interleave(ctxs.size(), batch_width, start, step);
+
+    std::vector<std::pair<ProbeResult<Component>, StatTracker>> results(0);
+    results.reserve(ctxs.size());
+    for (const BatchCursor &cursor : cursors) {
+      results.push_back(
+          {ProbeResult<Component>::from_pairs(cursor.topk), cursor.tracker});
+    }
+    return results;
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_by_bucket(int64_t k, const std::vector<Vect> &qs, size_t adj) {
+    /*
+     * same as k_probe_ids_batch, but bucket major. See below.
+     */
+    return k_probe_ids_by_bucket(k, contexts(qs, adj));
+  }
+
+  std::vector<std::pair<ProbeResult<Component>, StatTracker>>
+  k_probe_ids_by_bucket(int64_t k,
+                        const std::vector<QueryContext<Vect>> &ctxs) const {
+    /*
+     * bucket major batch execution for large batches where many queries
+     * probe the same buckets. The (list, query) pairs of each partition are
+     * grouped by the list the buckets are stored in. Each list is read once,
+     * and its vectors are scored against every query that probes it with one
+     * matrix product, so a query probing two buckets that share a list
+     * scores it once. Scores go into per query topk heaps.
+     * Every query scores the same candidates as k_probe_ids, so the results
+     * match up to ties. There is no norm pruning, so comparisons count every
+     * candidate of every probed bucket.
+     */
+    if (k < 1)
+      throw std::runtime_error("NR_MultiProbe::k_probe_by_bucket, k < 1");
+    const size_t full = static_cast<size_t>(k);
+    std::vector<std::vector<IdScore>> heaps(ctxs.size());
+    std::vector<StatTracker> trackers(ctxs.size());
+    for (auto &heap : heaps) {
+      heap.reserve(full);
+    }
+    const BatchMatrix<Vect> queries = as_columns(ctxs, false);
+
+    for (size_t probe = 0; probe < probe_tables.size(); ++probe) {
+      const ProbeTables &probe_table = probe_tables.at(probe);
+      for (size_t j = 0; j < ctxs.size(); ++j) {
+        trackers.at(j).incr_tables_probed();
+        for (size_t i = 0; i < ctxs.at(j).hashes.at(probe).probe_sequence.size();
+             ++i) {
+          for (size_t t = 0; t < probe_table.size(); ++t) {
+            trackers.at(j).incr_buckets_probed();
+          }
+        }
+      }
+
+      for (size_t t = 0; t < probe_table.size(); ++t) {
+        const Partition &partition = probe_table.at(t);
+        std::vector<std::pair<size_t, size_t>> probes(0); // (list, query)
+        for (size_t j = 0; j < ctxs.size(); ++j) {
+          for (const int64_t bucket :
+               ctxs.at(j).hashes.at(probe).probe_sequence)
+            probes.push_back({partition.list_of(bucket), j});
+        }
+        std::sort(probes.begin(), probes.end());
+        probes.erase(std::unique(probes.begin(), probes.end()), probes.end());
+
+        size_t first = 0;
+        while (first < probes.size()) {
+          // probes[first, last) all probe the same list.
+          const size_t list = probes.at(first).first;
+          size_t last = first;
+          while (last < probes.size() && probes.at(last).first == list) {
+            ++last;
+          }
+          BatchMatrix<Vect> interested(queries.rows(), last - first);
+          for (size_t i = first; i < last; ++i) {
+            interested.col(i - first) = queries.col(probes.at(i).second);
+          }
+          score_bucket(partition, list, interested, probes, first, full, heaps,
+                       trackers);
+          first = last;
+        }
+      }
+    }
+
+    std::vector<std::pair<ProbeResult<Component>, StatTracker>> results(0);
+    results.reserve(ctxs.size());
+    for (size_t j = 0; j < ctxs.size(); ++j) {
+      std::vector<IdScore> &heap = heaps.at(j);
+      std::sort(heap.begin(), heap.end(),
+                [](const IdScore &x, const IdScore &y) {
+                  return x.second < y.second;
+                });
+      results.push_back(
+          {ProbeResult<Component>::from_pairs(heap), trackers.at(j)});
+    }
+    return results;
+  }
+
+  void score_bucket(const Partition &partition, size_t bucket_idx,
+                    const BatchMatrix<Vect> &interested,
+                    const std::vector<std::pair<size_t, size_t>> &probes,
+                    size_t first, size_t full,
+                    std::vector<std::vector<IdScore>> &heaps,
+                    std::vector<StatTracker> &trackers) const {
+    /*
+     * scores the first scan_limit items of a bucket against the interested
+     * queries, the columns of interested, with one matrix product.
+     * Column c is the query probes[first + c].second. A list_of value is
+     * itself a bucket stored in that list, so it can be passed as bucket_idx.
+     */
+    const size_t limit = partition.scan_limit(bucket_idx);
+    if (limit == 0)
+      return;
+    BatchMatrix<Vect> items(interested.rows(), limit);
+    std::vector<int64_t> ids(limit, 0);
+    size_t m = 0;
+    for (const KV &item : partition.at(bucket_idx)) {
+      if (m == limit)
+        break;
+      items.col(m) = item.first;
+      ids.at(m) = item.second;
+      ++m;
+    }
+    const BatchMatrix<Vect> scores = items.transpose() * interested;
+    for (Eigen::Index c = 0; c < scores.cols(); ++c) {
+      const size_t query = probes.at(first + c).second;
+      for (size_t i = 0; i < limit; ++i) {
+        offer_to_heap({ids.at(i), scores(i, c)}, full, heaps.at(query),
+                      trackers.at(query));
+      }
+    }
+  }
+
+  static void offer_to_heap(const IdScore &candidate, size_t full,
+                            std::vector<IdScore> &heap, StatTracker &tracker) {
+    /*
+     * adds candidate to a min heap of at most full items. An id can be
+     * offered once per table, so ids already in the heap are skipped. An
+     * id that was pushed out of the heap can't get back in, since its score
+     * is no larger than the heap's minimum.
+     */
+    auto greater = [](const IdScore &x, const IdScore &y) {
+      return x.second > y.second;
+    };
+    tracker.incr_comparisons();
+    if (heap.size() == full && candidate.second <= heap.front().second)
+      return;
+    for (const IdScore &held : heap) {
+      if (held.first == candidate.first) {
+        tracker.incr_duplicates_skipped();
+        return;
+      }
+    }
+    if (heap.size() == full) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      heap.back() = candidate;
+    } else {
+      heap.push_back(candidate);
+    }
+    std::push_heap(heap.begin(), heap.end(), greater);
+  }
+
+  void set_batch_width(size_t width) {
+    /*
+     * number of queries k_probe_ids_batch scans at once. Wider batches hide
+     * more memory latency, as long as the queries' buckets stay in cache.
+     */
+    batch_width = std::max<size_t>(width, 1);
+  }
+
+  const Vect &lookup(int64_t id) const {
+    /*
+     * returns the vector with the given id. Every probe table contains all
+     * vectors, so only the first needs to be searched.
+     */
+    return probe_tables.at(0).lookup(id);
   }
 
   bool contains(const Vect &q) {
@@ -149,8 +667,9 @@ public:
     return probe_tables.at(0).contains(q);
   }
 
-  void k_probe_tables(int64_t k, const Vect &q, size_t adj,
-                      std::vector<std::pair<KV, Component>> &topk) {
+  void k_probe_tables(int64_t k, const QueryContext<Vect> &ctx,
+                      std::vector<IdScore> &topk, VisitedSet &seen,
+                      StatTracker &tracker) const {
     /*
      * Iterates over each probe_table.
      * In each probe_table, it starts iterating over the highest ranked
@@ -158,21 +677,102 @@ public:
      * buckets.
      */
     Component smallest_inner = std::numeric_limits<Component>::min();
+    const Component q_norm = ctx.norm;
     for (size_t probe = 0; probe < probe_tables.size(); ++probe) {
-      const auto rankings(probe_tables.at(probe).rank_around_query(q, adj));
-      for (size_t col = 0; col < adj; ++col) {
-        for (size_t t = 0; t < probe_tables.at(probe).size(); ++t) {
-          const std::list<KV> &bucket =
-              probe_tables.at(probe).at(t).at(rankings.at(t).at(col));
-          smallest_inner = probe_bucket(k, q, bucket, smallest_inner, topk);
-        }
+      smallest_inner = k_probe_table(k, ctx, probe, q_norm, smallest_inner,
+                                     topk, seen, tracker);
+    }
+  }
+
+  Component k_probe_table(int64_t k, const QueryContext<Vect> &ctx,
+                          size_t probe, Component q_norm,
+                          Component smallest_inner,
+                          std::vector<IdScore> &topk, VisitedSet &seen,
+                          StatTracker &tracker) const {
+    /*
+     * probes every partition of one probe table, highest ranked bucket
+     * first. Only reads the table, so different probe tables can be scanned
+     * at the same time as long as each has its own topk, seen and tracker.
+     */
+    tracker.incr_tables_probed();
+    // every partition of a probe table shares the same ranking.
+    const auto &ranking = ctx.hashes.at(probe).probe_sequence;
+    for (const int64_t bucket_idx : ranking) {
+      for (size_t t = 0; t < probe_tables.at(probe).size(); ++t) {
+        tracker.incr_buckets_probed();
+        smallest_inner =
+            probe_bucket(k, ctx.query, q_norm, probe_tables.at(probe).at(t),
+                         bucket_idx, smallest_inner, topk, seen, tracker);
       }
     }
+    return smallest_inner;
   }
 
-  Component probe_bucket(int64_t k, const Vect &q, const std::list<KV> &bucket,
-                         Component smallest_inner,
-                         std::vector<std::pair<KV, Component>> &topk) {
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_parallel(int64_t k, const QueryContext<Vect> &ctx) const {
+    /*
+     * scans the probe tables concurrently on the shared thread pool. Task j
+     * scans tables j, j + tasks, ... into its own topk, and the topks are
+     * merged at the end. An id found by several tasks is scored once per
+     * task, so comparisons can be higher than the serial scan, but the
+     * result is the same.
+     */
+    const size_t tasks = std::min(parallelism, probe_tables.size());
+    const Component q_norm = ctx.norm;
+    std::vector<std::vector<IdScore>> topks(tasks);
+    std::vector<StatTracker> trackers(tasks);
+    ThreadPool &workers = pool ? *pool : ThreadPool::shared();
+    workers.parallel_for(tasks, tasks, [&](size_t task) {
+      std::vector<IdScore> &topk = topks.at(task);
+      topk.reserve(k + 1);
+      VisitedPool::Lease seen = scratch.take();
+      Component smallest_inner = std::numeric_limits<Component>::min();
+      for (size_t probe = task; probe < probe_tables.size(); probe += tasks) {
+        smallest_inner = k_probe_table(k, ctx, probe, q_norm, smallest_inner,
+                                       topk, *seen, trackers.at(task));
+      }
+    });
+
+    StatTracker tracker;
+    std::vector<IdScore> merged(0);
+    for (size_t task = 0; task < tasks; ++task) {
+      tracker += trackers.at(task);
+      merged.insert(merged.end(), topks.at(task).begin(),
+                    topks.at(task).end());
+    }
+    return {ProbeResult<Component>::from_pairs(merge_topks(k, merged)),
+            tracker};
+  }
+
+  static std::vector<IdScore> merge_topks(int64_t k,
+                                          std::vector<IdScore> &merged) {
+    /*
+     * the k best distinct ids among the concatenated topks, ordered smallest
+     * to largest inner product.
+     */
+    std::sort(merged.begin(), merged.end(),
+              [](const IdScore &x, const IdScore &y) {
+                return x.first < y.first;
+              });
+    merged.erase(std::unique(merged.begin(), merged.end(),
+                             [](const IdScore &x, const IdScore &y) {
+                               return x.first == y.first;
+                             }),
+                 merged.end());
+    const size_t keep = std::min(merged.size(), static_cast<size_t>(k));
+    std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(),
+                      [](const IdScore &x, const IdScore &y) {
+                        return x.second > y.second;
+                      });
+    merged.resize(keep);
+    std::reverse(merged.begin(), merged.end());
+    return merged;
+  }
+
+  Component probe_bucket(int64_t k, const Vect &q, Component q_norm,
+                         const Partition &partition, size_t bucket_idx,
+                         Component smallest_inner, std::vector<IdScore> &topk,
+                         VisitedSet &seen, StatTracker &tracker) const {
     /*
      * Iterates cross the bucket looking for inner products that are larger
      * than the current smallest inner product in the topk.
@@ -181,13 +781,43 @@ public:
      *
      * if less than k items have been found so far, it just adds them into
      * the topk.
+     *
+     * items already scored in another table are skipped, and only the first
+     * scan_limit items are scanned.
+     *
+     * Buckets are sorted by descending norm. Once the topk is full, the scan
+     * stops at the first item where ||q|| * ||x|| <= smallest_inner, since
+     * by Cauchy-Schwarz neither it nor anything after it can enter the topk.
      */
-    for (const KV &item : bucket) {
-      const Component inner = q.dot(item.first);
+    const size_t full = static_cast<size_t>(k);
+    // a bucket sharing the list already scanned it. Nothing it had left can
+    // beat smallest_inner, which has only grown since.
+    if (!partition.visit_list(bucket_idx, seen))
+      return smallest_inner;
+    if (topk.size() == full &&
+        partition.max_norm(bucket_idx) * q_norm <= smallest_inner)
+      return smallest_inner;
+    const size_t limit = partition.scan_limit(bucket_idx);
+    const std::vector<Component> &norms = partition.bucket_norms(bucket_idx);
+    const std::list<KV> &bucket = partition.at(bucket_idx);
+    size_t scanned = 0;
+    for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+      if (scanned == limit ||
+          (topk.size() == full && norms.at(scanned) * q_norm <= smallest_inner))
+        break;
+      ++scanned;
+      prefetch_ahead(it, bucket.end());
+      const KV &item = *it;
+      if (!seen.visit(item.second)) {
+        tracker.incr_duplicates_skipped();
+        continue;
+      }
+      tracker.incr_comparisons();
+      const Component inner = dot(q, item.first);
       if (topk.size() < static_cast<size_t>(k)) {
-        build_topk({item, inner}, topk);
+        build_topk({item.second, inner}, topk);
       } else if (inner > smallest_inner) {
-        insert_in_topk({item, inner}, topk);
+        insert_in_topk({item.second, inner}, topk);
 
         // since a new item larger than the smallest element of topk
         // was added, there is a new smallest inner.
@@ -197,22 +827,21 @@ public:
     return smallest_inner;
   }
 
-  void build_topk(const std::pair<KV, Component> &to_add,
-                  std::vector<std::pair<KV, Component>> &topk) {
+  static void build_topk(const IdScore &to_add, std::vector<IdScore> &topk) {
     /*
      * Add to_add to the top and sort it.
      * keeping it sorted is necessary since the smallest element is in the
      * front of the topk.
      */
     topk.push_back(to_add);
-    std::sort(
-        topk.begin(), topk.end(),
-        [](const std::pair<KV, Component> &x,
-           const std::pair<KV, Component> &y) { return x.second < y.second; });
+    std::sort(topk.begin(), topk.end(),
+              [](const IdScore &x, const IdScore &y) {
+                return x.second < y.second;
+              });
   }
 
-  void insert_in_topk(const std::pair<KV, Component> &to_add,
-                      std::vector<std::pair<KV, Component>> &topk) {
+  static void insert_in_topk(const IdScore &to_add,
+                             std::vector<IdScore> &topk) {
     /*
      * inserts values into the topk inplace. The previous smallest value is
      * automatically overwritten, so the size stays at k.
@@ -221,37 +850,65 @@ public:
      */
     stats::insert_unique_inplace(
         to_add, topk,
-        [](const std::pair<KV, Component> &x,
-           const std::pair<KV, Component> &y) { return x.second > y.second; },
+        [](const IdScore &x, const IdScore &y) { return x.second > y.second; },
         // two items are equal if they have the same id.
-        [](const std::pair<KV, Component> &x,
-           const std::pair<KV, Component> &y) {
-          return x.first.second == y.first.second;
-        });
+        [](const IdScore &x, const IdScore &y) { return x.first == y.first; });
   }
 
-  static typename std::vector<KV>::const_iterator
-  find_value(const std::vector<KV> &vects, int64_t value) {
-    for (auto iter = vects.begin(); iter != vects.end(); ++iter) {
-      if ((*iter).second == value) {
-        return iter;
-      }
+  void set_bucket_cap(size_t cap) {
+    /*
+     * bounds the worst case cost of probing a bucket. Lists larger than
+     * cap only have their cap highest norm items scanned. With
+     * set_bucket_occupancy, buckets that share a list share one cap.
+     */
+    for (auto &probe_table : probe_tables) {
+      probe_table.set_bucket_cap(cap);
     }
-    return vects.end();
   }
 
-  static void insert_kv(std::vector<KV> &vects,
-                        const std::vector<KV> &to_insert) {
-    // inserts only key-value pairs with unique values.
-    // modifies in-place.
-    for (auto &kv : to_insert) {
-      if (find_value(vects, kv.second) == vects.end()) {
-        // kv is not in vects.
-        vects.push_back(kv);
-      }
+  void set_parallelism(size_t threads) {
+    /*
+     * number of threads, including the caller, that k_probe_ids may use to
+     * scan probe tables concurrently. 1, the default, scans them serially.
+     * Threads come from ThreadPool::shared(), so no threads are started per
+     * query.
+     */
+    parallelism = std::max<size_t>(threads, 1);
+  }
+
+  size_t get_parallelism() const { return parallelism; }
+
+  void set_partitioning(Partitioning how, bool parallel = false) {
+    /*
+     * how the next fill cuts each probe table into partitions. parallel
+     * runs the partitioning on the thread pool used for probing.
+     */
+    ThreadPool *workers = nullptr;
+    if (parallel)
+      workers = pool ? pool : &ThreadPool::shared();
+    for (auto &probe_table : probe_tables) {
+      probe_table.set_partitioning(how, workers);
     }
   }
 
+  void set_bucket_occupancy(double occupancy) {
+    /*
+     * the next fill gives each partition about one list per occupancy items
+     * instead of one per bucket. 0, the default, keeps every bucket.
+     */
+    for (auto &probe_table : probe_tables) {
+      probe_table.set_bucket_occupancy(occupancy);
+    }
+  }
+
+  void set_thread_pool(ThreadPool &workers) {
+    /*
+     * runs parallel scans on workers rather than ThreadPool::shared(), e.g.
+     * a pool pinned to the NUMA node this index was built on.
+     */
+    pool = &workers;
+  }
+
   void print_stats() {
     for (auto &probe_table : probe_tables) {
       probe_table.print_stats();
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * NUMA placement without a libnuma dependency.
+ * Nodes and their CPUs are read from /sys/devices/system/node. Linux places
+ * a page on the node of the thread that first writes it, so an index built
+ * by a thread pinned to a node lives on that node. NumaReplicas builds one
+ * copy of a read-only index per node that way, and each query uses the copy
+ * on the node it is running on.
+ * Off Linux, or without sysfs, everything is one node and pinning does
+ * nothing.
+ */
+
+namespace nr {
+
+inline std::vector<int> parse_cpu_list(const std::string &list) {
+  /*
+   * parses a kernel cpu list such as "0-3,8,10-11".
+   */
+  std::vector<int> cpus(0);
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    if (range.empty() || range == "\n")
+      continue;
+    const size_t dash = range.find('-');
+    const int low = std::stoi(range.substr(0, dash));
+    const int high =
+        dash == std::string::npos ? low : std::stoi(range.substr(dash + 1));
+    if (high < low)
+      throw std::runtime_error("parse_cpu_list, bad range " + range);
+    for (int cpu = low; cpu <= high; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+inline std::vector<int> all_cpus() {
+  // every CPU this process may run on.
+  std::vector<int> cpus(0);
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < count; ++cpu) {
+      cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+  return cpus;
+}
+
+inline std::vector<std::vector<int>> numa_nodes() {
+  /*
+   * CPUs of each online NUMA node, in node order. Nodes without CPUs are
+   * left out. Falls back to one node holding every CPU.
+   */
+  std::vector<std::vector<int>> nodes(0);
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string list;
+  if (online && std::getline(online, list)) {
+    for (const int node : parse_cpu_list(list)) {
+      std::ifstream cpulist("/sys/devices/system/node/node" +
+                            std::to_string(node) + "/cpulist");
+      std::string cpus;
+      if (cpulist && std::getline(cpulist, cpus)) {
+        std::vector<int> node_cpus = parse_cpu_list(cpus);
+        if (!node_cpus.empty())
+          nodes.push_back(node_cpus);
+      }
+    }
+  }
+  if (nodes.empty())
+    nodes.push_back(all_cpus());
+  return nodes;
+}
+
+inline bool pin_current_thread(const std::vector<int> &cpus) {
+  /*
+   * restricts the calling thread to cpus. Returns false if the thread
+   * could not be pinned.
+   */
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+inline int current_cpu() {
+  // the CPU the calling thread is running on, or -1 if unknown.
+#if defined(__linux__)
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+template <typename Index> class NumaReplicas {
+private:
+  std::vector<std::vector<int>> nodes;
+  std::vector<std::unique_ptr<Index>> replicas; // one per node.
+  std::vector<size_t> node_of_cpu;
+
+public:
+  template <typename Build>
+  explicit NumaReplicas(Build build,
+                        std::vector<std::vector<int>> nodes = numa_nodes())
+      : nodes(std::move(nodes)), replicas(this->nodes.size()),
+        node_of_cpu(0) {
+    /*
+     * calls build() once per node, on a thread pinned to that node, so each
+     * replica's memory is first touched on its node. build returns a
+     * std::unique_ptr<Index> to a filled index. Every build should produce
+     * the same index, e.g. by filling from the same data.
+     */
+    for (size_t node = 0; node < this->nodes.size(); ++node) {
+      for (const int cpu : this->nodes.at(node)) {
+        if (cpu < 0)
+          continue;
+        if (static_cast<size_t>(cpu) >= node_of_cpu.size())
+          node_of_cpu.resize(cpu + 1, 0);
+        node_of_cpu.at(cpu) = node;
+      }
+    }
+    std::exception_ptr error;
+    for (size_t node = 0; node < this->nodes.size(); ++node) {
+      // one node at a time, so each build can use the whole node.
+      std::thread builder([&, node] {
+        try {
+          pin_current_thread(this->nodes.at(node));
+          replicas.at(node) = build();
+        } catch (...) {
+          error = std::current_exception();
+        }
+      });
+      builder.join();
+      if (error)
+        std::rethrow_exception(error);
+    }
+  }
+
+  size_t num_nodes() const { return replicas.size(); }
+
+  const std::vector<int> &cpus(size_t node) const { return nodes.at(node); }
+
+  size_t current_node() const {
+    // node of the CPU the calling thread runs on. 0 if unknown.
+    const int cpu = current_cpu();
+    if (cpu < 0 || static_cast<size_t>(cpu) >= node_of_cpu.size())
+      return 0;
+    return node_of_cpu.at(cpu);
+  }
+
+  const Index &on_node(size_t node) const { return *replicas.at(node); }
+
+  const Index &local() const {
+    /*
+     * the replica on the caller's node. Replicas are read only, so set them
+     * up in build. Probes are const and take their scratch per query, so
+     * any number of threads can probe the same replica at once.
+     */
+    return on_node(current_node());
+  }
+};
+
+} // namespace nr
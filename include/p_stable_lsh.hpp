@@ -5,6 +5,7 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <cmath>
 #include <random>
+#include <stdexcept>
 
 #include "lsh_family.hpp"
 #include "normal_matrix.hpp"
@@ -17,10 +18,14 @@
 namespace mp = boost::multiprecision;
 namespace nr {
 
-template <typename Component> class PStableLSH : public LSH_Family<Component> {
+template <typename Component, int Dim = Eigen::Dynamic>
+class PStableLSH
+    : public LSH_Family<PStableLSH<Component, Dim>, Component, Dim> {
 private:
-  // use the proper vector type for component.
-  using Vect = typename VectorXf_or_Xd<Component>::type;
+  // use the proper matrix and vector type for component.
+  using Matrix = typename MatrixXf_or_Xd<Component>::type;
+  using Vect = typename VectorXf_or_Xd<Component, Dim>::type;
+  using Projections = typename VectorXf_or_Xd<Component>::type;
 
   // The a_i must be drawn from a p-stable distribution.
   // a normal distribution satisfies this and is convenient.
@@ -30,7 +35,10 @@ private:
   Component b;
 
 public:
-  PStableLSH(Component r, int64_t dim) : a(dim), dim(dim), r(r) {
+  PStableLSH(Component r, int64_t dim)
+      : a(Dim == Eigen::Dynamic ? dim : Dim), dim(dim), r(r) {
+    if (Dim != Eigen::Dynamic && dim != Dim)
+      throw std::runtime_error("PStableLSH, dim does not match Dim");
     NormalMatrix<Component> nm;
     nm.fill_vector(a);
     // b is selected uniformly from [0, r]
@@ -44,22 +52,43 @@ public:
 
   int64_t dimension() const { return dim; }
 
-  mp::cpp_int operator()(const Vect &input) const { return hash(input); }
+  Projections project(const Vect &input) const {
+    // the single projection, already shifted by b and scaled by r.
+    Projections projection(1);
+    projection(0) = (a.dot(input) + b) / r;
+    return projection;
+  }
+
+  Matrix project_batch(const Matrix &inputs) const {
+    // one row: the projection of every column of inputs.
+    Matrix projections = a.transpose() * inputs;
+    projections.array() += b;
+    return projections / r;
+  }
 
-  mp::cpp_int hash(const Vect &input) const {
-    Component h = floor((a.dot(input) + b) / r);
+  mp::cpp_int code(const Projections &projections) const {
+    Component h = floor(projections(0));
     return mp::cpp_int(h);
   }
 
-  size_t hash_max(const Vect &input, size_t max) const {
-    mp::cpp_int mp_hash = hash(input);
-    mp::cpp_int residue = mp_hash % max;
+  size_t code_max(const mp::cpp_int &code, size_t max) const {
+    mp::cpp_int residue = code % max;
     if (residue < 1) {
       residue *= -1;
     }
     size_t idx = residue.convert_to<size_t>();
     return idx;
   }
+
+  double bucket_sim(size_t idx, size_t other, size_t) const {
+    /*
+     * a code is a slot of width r along the projection, so neighbouring
+     * slots hold the closest inputs. There are no bits to compare.
+     */
+    const double gap = static_cast<double>(idx > other ? idx - other
+                                                       : other - idx);
+    return -gap;
+  }
 };
 
 } // namespace nr
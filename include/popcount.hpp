@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dispatch.hpp"
+
+/*
+ * Bit counting kernels shared by everything that compares sign hash codes.
+ * Codes are packed into arrays of 64 bit words, bit i of the code is bit
+ * (i % 64) of word (i / 64).
+ */
+
+namespace nr {
+
+inline size_t popcount(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  // compiles to a single popcnt instruction when the target supports it.
+  return static_cast<size_t>(__builtin_popcountll(x));
+#else
+  // SWAR fallback. Counts bits in pairs, then nibbles, then bytes.
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<size_t>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline size_t code_words(size_t bits) {
+  // number of 64 bit words needed to store a code with the given bits.
+  return (bits + 63) / 64;
+}
+
+inline size_t hamming_distance(const uint64_t *x, const uint64_t *y,
+                               size_t words) {
+  size_t dist = 0;
+  for (size_t w = 0; w < words; ++w) {
+    dist += popcount(x[w] ^ y[w]);
+  }
+  return dist;
+}
+
+NR_DISPATCH("arch=icelake-server", "avx2", "popcnt", "default")
+inline void hamming_distances(const uint64_t *query, const uint64_t *codes,
+                              size_t words, size_t n, uint32_t *out) {
+  /*
+   * distance from query to each of the n codes stored back to back in codes.
+   * Written as a flat loop over contiguous memory so the compiler can
+   * unroll and vectorize it. Dispatched, so the popcnt instruction (or
+   * AVX-512 vector popcount) is used wherever the CPU has it.
+   */
+  if (words == 1) {
+    const uint64_t q = query[0];
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = static_cast<uint32_t>(popcount(q ^ codes[i]));
+    }
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<uint32_t>(
+        hamming_distance(query, codes + i * words, words));
+  }
+}
+
+template <typename Vect>
+void pack_signs(const Vect &projections, uint64_t *out, size_t words) {
+  /*
+   * packs the signs of projections into out. Bit i is set when
+   * projections(i) >= 0, the same convention SignLSH::code uses.
+   */
+  const auto &evaluated = projections.eval();
+  pack_signs(evaluated.data(), static_cast<size_t>(evaluated.size()), out,
+             words);
+}
+
+template <typename Vect>
+std::vector<uint64_t> pack_signs(const Vect &projections) {
+  std::vector<uint64_t> out(code_words(projections.size()), 0);
+  pack_signs(projections, out.data(), out.size());
+  return out;
+}
+
+} // namespace nr
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Lightweight output of the *_ids probe functions.
+ * Holds parallel arrays of item ids and their scores, so probing does not need
+ * to copy the vectors it finds. Vectors can be looked up by id afterwards.
+ * For the MIPS tables, the score is the inner product with the query.
+ * For the near neighbor tables, the score is the distance to the query.
+ */
+
+namespace nr {
+
+template <typename Component> struct ProbeResult {
+  std::vector<int64_t> ids;
+  std::vector<Component> scores;
+
+  ProbeResult() : ids(0), scores(0) {}
+
+  void reserve(size_t n) {
+    ids.reserve(n);
+    scores.reserve(n);
+  }
+
+  void push_back(int64_t id, Component score) {
+    ids.push_back(id);
+    scores.push_back(score);
+  }
+
+  size_t size() const { return ids.size(); }
+
+  bool empty() const { return ids.empty(); }
+
+  static ProbeResult
+  from_pairs(const std::vector<std::pair<int64_t, Component>> &pairs) {
+    // splits a vector of (id, score) pairs into parallel arrays.
+    ProbeResult result;
+    result.reserve(pairs.size());
+    for (const auto &pair : pairs) {
+      result.push_back(pair.first, pair.second);
+    }
+    return result;
+  }
+};
+
+template <typename KV, typename Component, typename Lookup>
+std::vector<KV> result_to_kvs(const ProbeResult<Component> &result,
+                              Lookup lookup) {
+  /*
+   * copies the vectors for every id in result. Used by the probe functions
+   * that return vectors, rather than ids.
+   */
+  std::vector<KV> kvs(0);
+  kvs.reserve(result.size());
+  for (int64_t id : result.ids) {
+    kvs.push_back({lookup(id), id});
+  }
+  return kvs;
+}
+
+} // namespace nr
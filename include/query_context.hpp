@@ -0,0 +1,185 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <boost/multiprecision/cpp_int.hpp>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "xf_or_xd.hpp"
+
+/*
+ * Everything a table computes about a query before it starts scanning
+ * buckets. Produced by a table's context(q, adj) and accepted by its probe
+ * functions, so a query is hashed once even if it is probed several times.
+ * Tables with several hash functions store one HashedQuery per hash.
+ * A batch of queries can be hashed together, with one matrix product per
+ * hash function rather than one matrix-vector product per query.
+ */
+
+namespace mp = boost::multiprecision;
+namespace nr {
+
+// queries stored as the columns of a matrix, for hashing a batch at once.
+template <typename Vect>
+using BatchMatrix =
+    Eigen::Matrix<typename Vect::Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+class ProbeSequence {
+  /*
+   * the buckets, or items, a query probes, best first. Reads like a const
+   * std::vector. Copies share one vector, so a ranking cached by a table is
+   * handed to every query that needs it without being copied. push_back
+   * copies the vector first if anything else shares it.
+   */
+private:
+  std::shared_ptr<std::vector<int64_t>> sequence;
+
+  static const std::vector<int64_t> &none() {
+    static const std::vector<int64_t> empty(0);
+    return empty;
+  }
+
+public:
+  using value_type = int64_t;
+  using const_iterator = std::vector<int64_t>::const_iterator;
+
+  ProbeSequence() = default;
+
+  ProbeSequence(std::vector<int64_t> buckets)
+      : sequence(std::make_shared<std::vector<int64_t>>(std::move(buckets))) {}
+
+  const std::vector<int64_t> &buckets() const {
+    return sequence ? *sequence : none();
+  }
+
+  operator const std::vector<int64_t> &() const { return buckets(); }
+
+  bool shares_with(const ProbeSequence &other) const {
+    return sequence && sequence == other.sequence;
+  }
+
+  void push_back(int64_t bucket) {
+    if (!sequence || sequence.use_count() > 1)
+      sequence = std::make_shared<std::vector<int64_t>>(buckets());
+    sequence->push_back(bucket);
+  }
+
+  const_iterator begin() const { return buckets().begin(); }
+  const_iterator end() const { return buckets().end(); }
+  size_t size() const { return buckets().size(); }
+  bool empty() const { return buckets().empty(); }
+  int64_t at(size_t i) const { return buckets().at(i); }
+  int64_t operator[](size_t i) const { return buckets()[i]; }
+  int64_t front() const { return buckets().front(); }
+  int64_t back() const { return buckets().back(); }
+};
+
+inline bool operator==(const ProbeSequence &x, const ProbeSequence &y) {
+  return x.buckets() == y.buckets();
+}
+
+inline bool operator==(const ProbeSequence &x, const std::vector<int64_t> &y) {
+  return x.buckets() == y;
+}
+
+inline bool operator==(const std::vector<int64_t> &x, const ProbeSequence &y) {
+  return x == y.buckets();
+}
+
+template <typename Vect> struct HashedQuery {
+  // one projection per hash bit, so dynamic even when Vect is fixed size.
+  typename VectorXf_or_Xd<typename Vect::Scalar>::type projections;
+  mp::cpp_int code;                    // packed hash code
+  size_t bucket;                       // code reduced to a bucket index
+  ProbeSequence probe_sequence;        // buckets to probe, best first.
+};
+
+template <typename Vect> struct QueryContext {
+  /*
+   * query is a copy rather than a view. q can be a temporary expression or
+   * a row of a MappedRows whose pages are released, and contexts outlive
+   * the call that made them, e.g. while queued in an AsyncProber.
+   */
+  Vect query; // the query as it was passed in. Used for scoring.
+  typename Vect::value_type norm;
+  std::vector<HashedQuery<Vect>> hashes;
+
+  // q can be any vector expression, e.g. a Map over a caller's buffer.
+  template <typename Derived>
+  QueryContext(const Eigen::MatrixBase<Derived> &q)
+      : query(q), norm(query.norm()), hashes(0) {}
+
+  Vect normalized() const {
+    // unit length query, which NR tables hash. Only they pay for it.
+    return norm > 0 ? Vect(query / norm) : query;
+  }
+};
+
+template <typename Vect, typename Hash>
+HashedQuery<Vect> hash_query(const Hash &hash, const Vect &input,
+                             size_t num_buckets) {
+  /*
+   * hashes input with hash. The probe sequence is left for the table to fill
+   * since each table ranks buckets differently.
+   */
+  HashedQuery<Vect> hashed;
+  hashed.projections = hash.project(input);
+  hashed.code = hash.code(hashed.projections);
+  hashed.bucket = hash.code_max(hashed.code, num_buckets);
+  return hashed;
+}
+
+template <typename Vect, typename Hash>
+std::vector<HashedQuery<Vect>> hash_queries(const Hash &hash,
+                                            const BatchMatrix<Vect> &inputs,
+                                            size_t num_buckets) {
+  /*
+   * hashes every column of inputs, projecting them all with one matrix
+   * product. Entry j is the same as hash_query(hash, inputs.col(j), ...).
+   */
+  const BatchMatrix<Vect> projections = hash.project_batch(inputs);
+  std::vector<HashedQuery<Vect>> hashed(inputs.cols());
+  for (Eigen::Index j = 0; j < inputs.cols(); ++j) {
+    HashedQuery<Vect> &query = hashed.at(j);
+    query.projections = projections.col(j);
+    query.code = hash.code(query.projections);
+    query.bucket = hash.code_max(query.code, num_buckets);
+  }
+  return hashed;
+}
+
+template <typename Vect, typename Cont>
+std::vector<QueryContext<Vect>> make_contexts(const Cont &queries) {
+  /*
+   * a context without hashes for every query. queries can be any container
+   * with size() and at(i), e.g. MappedRows, so queries read from a file go
+   * straight into their contexts.
+   */
+  std::vector<QueryContext<Vect>> contexts;
+  contexts.reserve(queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    contexts.emplace_back(queries.at(i));
+  }
+  return contexts;
+}
+
+template <typename Vect>
+BatchMatrix<Vect> as_columns(const std::vector<QueryContext<Vect>> &contexts,
+                             bool normalized) {
+  // the queries of contexts as the columns of a matrix.
+  const Eigen::Index dim =
+      contexts.empty() ? 0 : contexts.front().query.size();
+  BatchMatrix<Vect> columns(dim, contexts.size());
+  for (size_t j = 0; j < contexts.size(); ++j) {
+    const QueryContext<Vect> &ctx = contexts.at(j);
+    if (normalized && ctx.norm > 0)
+      columns.col(j) = ctx.query / ctx.norm;
+    else
+      columns.col(j) = ctx.query;
+  }
+  return columns;
+}
+
+} // namespace nr
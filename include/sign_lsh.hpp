@@ -5,10 +5,13 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <cmath>
 #include <random>
+#include <stdexcept>
 #include <type_traits>
+#include <vector>
 
 #include "lsh_family.hpp"
 #include "normal_matrix.hpp"
+#include "popcount.hpp"
 #include "xf_or_xd.hpp"
 
 /*
@@ -19,20 +22,26 @@
 namespace mp = boost::multiprecision;
 namespace nr {
 
-template <typename Component> class SignLSH : public LSH_Family<Component> {
+template <typename Component, int Dim = Eigen::Dynamic>
+class SignLSH : public LSH_Family<SignLSH<Component, Dim>, Component, Dim> {
 private:
   // use the proper matrix and vector type for component.
   using Matrix = typename MatrixXf_or_Xd<Component>::type;
-  using Vect = typename VectorXf_or_Xd<Component>::type;
+  using Vect = typename VectorXf_or_Xd<Component, Dim>::type;
+  using Projections = typename VectorXf_or_Xd<Component>::type;
 
-  Matrix a;
+  // one hyperplane per row. With a fixed Dim the rows have a fixed length.
+  typename MatrixXf_or_Xd<Component, Eigen::Dynamic, Dim>::type a;
   int64_t bits;
   int64_t dim;
   std::vector<mp::cpp_int> bit_mask;
 
 public:
   SignLSH(int64_t bits, int64_t dim)
-      : a(Matrix(bits, dim)), bits(bits), dim(dim), bit_mask(bits) {
+      : a(bits, Dim == Eigen::Dynamic ? dim : Dim), bits(bits), dim(dim),
+        bit_mask(bits) {
+    if (Dim != Eigen::Dynamic && dim != Dim)
+      throw std::runtime_error("SignLSH, dim does not match Dim");
     NormalMatrix<Component> nm;
     nm.fill_matrix(a);
     fill_bit_mask();
@@ -42,19 +51,28 @@ public:
 
   int64_t dimension() const { return dim; }
 
-  mp::cpp_int operator()(const Vect &input) const { return hash(input); }
+  Projections project(const Vect &input) const {
+    // projections of input onto each hyperplane.
+    return a * input;
+  }
+
+  Matrix project_batch(const Matrix &inputs) const {
+    // projections of every column of inputs, with one matrix product.
+    return a * inputs;
+  }
 
-  mp::cpp_int hash(const Vect &input) const {
-    // with a large number of hashes, it can become larger than 64 bit.
-    // have to use multiprecision.
-    Vect prods = a * input;
-    Vect bit_vect = numerals_to_bits(prods);
-    return bits_to_num(bit_vect);
+  mp::cpp_int code(const Projections &projections) const {
+    // packs the signs of the projections into an integer, 64 bits at a
+    // time with the dispatched sign packing kernel. Same value as
+    // bits_to_num(numerals_to_bits(projections)).
+    const std::vector<uint64_t> words = pack_signs(projections);
+    mp::cpp_int packed = 0;
+    mp::import_bits(packed, words.rbegin(), words.rend(), 64);
+    return packed;
   }
 
-  size_t hash_max(const Vect &input, size_t max) const {
-    mp::cpp_int mp_hash = hash(input);
-    mp::cpp_int residue = mp_hash % max;
+  size_t code_max(const mp::cpp_int &code, size_t max) const {
+    mp::cpp_int residue = code % max;
     size_t idx = residue.convert_to<size_t>();
     return idx;
   }
@@ -68,7 +86,7 @@ public:
 
   std::vector<mp::cpp_int> get_bit_mask() const { return bit_mask; }
 
-  Vect numerals_to_bits(Vect input) const {
+  Projections numerals_to_bits(Projections input) const {
     // if a value is positive, it's bit is 1, otherwise 0.
     // can be in place because input arg is a copy.
     for (int64_t i = 0; i < input.rows(); ++i) {
@@ -77,7 +95,7 @@ public:
     return input;
   }
 
-  mp::cpp_int bits_to_num(const Vect &bits) const {
+  mp::cpp_int bits_to_num(const Projections &bits) const {
     // convert a string of bits to an integer.
     mp::cpp_int sum = 0;
     for (Eigen::Index i = 0; i < bits.size(); ++i) {
@@ -19,13 +19,18 @@
 namespace mp = boost::multiprecision;
 namespace nr {
 
-template <typename Component> class SimpleLSH : public LSH_Family<Component> {
+template <typename Component, int Dim = Eigen::Dynamic>
+class SimpleLSH
+    : public LSH_Family<SimpleLSH<Component, Dim>, Component, Dim> {
 private:
   // use the proper matrix and vector type for component.
   using Matrix = typename MatrixXf_or_Xd<Component>::type;
-  using Vect = typename VectorXf_or_Xd<Component>::type;
+  using Vect = typename VectorXf_or_Xd<Component, Dim>::type;
+  using Projections = typename VectorXf_or_Xd<Component>::type;
+  // P(input) has one more component than input.
+  using Appended = typename VectorXf_or_Xd<Component, plus_one(Dim)>::type;
 
-  SignLSH<Component> sign_hash;
+  SignLSH<Component, plus_one(Dim)> sign_hash;
 
 public:
   SimpleLSH(int64_t bits, int64_t dim) : sign_hash(bits, dim + 1) {}
@@ -39,27 +44,35 @@ public:
     return sign_hash.dimension() - 1;
   }
 
-  mp::cpp_int operator()(const Vect &input) const { return hash(input); }
+  Projections project(const Vect &input) const {
+    // projections of P(input) onto each hyperplane.
+    return sign_hash.project(P(input));
+  }
+
+  Matrix project_batch(const Matrix &inputs) const {
+    // projections of P(column) for every column of inputs.
+    Matrix simple(inputs.rows() + 1, inputs.cols());
+    for (Eigen::Index j = 0; j < inputs.cols(); ++j) {
+      simple.col(j) = P(inputs.col(j));
+    }
+    return sign_hash.project_batch(simple);
+  }
 
-  mp::cpp_int hash(const Vect &input) const {
-    // with a large number of hashes, it can become larger than 64 bit.
-    // have to use multiprecision.
-    Vect simple = P(input);
-    return sign_hash(simple);
+  mp::cpp_int code(const Projections &projections) const {
+    return sign_hash.code(projections);
   }
 
-  size_t hash_max(const Vect &input, size_t max) const {
-    Vect simple = P(input);
-    return sign_hash.hash_max(simple, max);
+  size_t code_max(const mp::cpp_int &code, size_t max) const {
+    return sign_hash.code_max(code, max);
   }
 
   std::vector<mp::cpp_int> get_bit_mask() const {
     return sign_hash.get_bit_mask();
   }
 
-  Vect P(const Vect &input) const {
+  Appended P(const Vect &input) const {
     // symmetric transform that appends sqrt(1 - ||input||) to input
-    Vect append(sign_hash.dimension());
+    Appended append(sign_hash.dimension());
     Component norm = input.norm();
     if (norm - 1 >= 1e-4)
       throw std::logic_error("SimpleLSH::P, Cannot take sqrt of negative");
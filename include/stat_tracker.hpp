@@ -7,6 +7,7 @@
  * For instance, the number of comparisons should generally be very low.
  */
 
+#include <tuple>
 #include <utility>
 
 namespace nr {
@@ -18,10 +19,11 @@ struct Tracked {
   const size_t buckets_probed;
   const size_t partitions_probed;
   const size_t tables_probed;
+  const size_t duplicates_skipped;
 
-  Tracked(size_t c, size_t b, size_t p, size_t t)
+  Tracked(size_t c, size_t b, size_t p, size_t t, size_t d = 0)
       : comparisons(c), buckets_probed(b), partitions_probed(p),
-        tables_probed(t) {}
+        tables_probed(t), duplicates_skipped(d) {}
 };
 
 class StatTracker {
@@ -30,6 +32,7 @@ private:
   size_t buckets_probed = 0;
   size_t partitions_probed = 0;
   size_t tables_probed = 0;
+  size_t duplicates_skipped = 0; // items already scored by another table.
 
 public:
   StatTracker() {}
@@ -39,6 +42,7 @@ public:
     buckets_probed += other.buckets_probed;
     partitions_probed += other.partitions_probed;
     tables_probed += other.tables_probed;
+    duplicates_skipped += other.duplicates_skipped;
     return *this;
   }
 
@@ -46,16 +50,18 @@ public:
   void incr_buckets_probed() { ++buckets_probed; }
   void incr_partitions_probed() { ++partitions_probed; }
   void incr_tables_probed() { ++tables_probed; }
+  void incr_duplicates_skipped() { ++duplicates_skipped; }
 
   void k_partitions_probed(size_t k) { partitions_probed += k; }
 
-  std::tuple<size_t, size_t, size_t, size_t> get_stats() const {
-    return {comparisons, buckets_probed, partitions_probed, tables_probed};
+  std::tuple<size_t, size_t, size_t, size_t, size_t> get_stats() const {
+    return {comparisons, buckets_probed, partitions_probed, tables_probed,
+            duplicates_skipped};
   }
 
   Tracked tracked_stats() const {
     return Tracked(comparisons, buckets_probed, partitions_probed,
-                   tables_probed);
+                   tables_probed, duplicates_skipped);
   }
 };
 } // namespace nr
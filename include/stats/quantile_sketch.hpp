@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+ * Approximate quantiles of a stream in bounded memory.
+ * Items go into level 0. When a level holds k items it is sorted and every
+ * other item, starting at a random one of the first two, is promoted to the
+ * next level, where each item stands for twice as many inputs. This is the
+ * compactor scheme of Karnin, Lang and Liberty (KLL) with equal capacities.
+ * It keeps O(k log(n / k)) items, and the rank of a returned quantile is off
+ * by O(n log(n / k) / k) at worst.
+ */
+
+namespace nr {
+namespace stats {
+
+template <typename T> class QuantileSketch {
+private:
+  size_t k; // capacity of each level. Even, so compactions pair up.
+  std::vector<std::vector<T>> levels; // an item at level l weighs 2^l.
+  size_t count = 0;
+  T smallest = T();
+  T largest = T();
+  std::mt19937 gen;
+
+  void compact(size_t level) {
+    if (levels.size() == level + 1)
+      levels.emplace_back();
+    std::vector<T> &items = levels.at(level);
+    std::sort(items.begin(), items.end());
+    for (size_t i = gen() & 1; i < items.size(); i += 2) {
+      levels.at(level + 1).push_back(items.at(i));
+    }
+    levels.at(level).clear();
+    if (levels.at(level + 1).size() >= k)
+      compact(level + 1);
+  }
+
+public:
+  explicit QuantileSketch(size_t k = 256)
+      : k(std::max<size_t>(2, k + k % 2)), levels(1), gen(k) {}
+
+  void insert(const T &x) {
+    if (count == 0 || x < smallest)
+      smallest = x;
+    if (count == 0 || largest < x)
+      largest = x;
+    ++count;
+    levels.at(0).push_back(x);
+    if (levels.at(0).size() >= k)
+      compact(0);
+  }
+
+  size_t size() const { return count; }
+
+  T min() const { return smallest; }
+
+  T max() const { return largest; }
+
+  T quantile(double q) const {
+    /*
+     * an item whose rank is about q * size(). The min and max are exact.
+     */
+    if (count == 0)
+      throw std::runtime_error("QuantileSketch::quantile, sketch is empty");
+    if (q <= 0)
+      return smallest;
+    if (q >= 1)
+      return largest;
+    std::vector<std::pair<T, size_t>> weighted(0);
+    size_t total = 0;
+    for (size_t level = 0; level < levels.size(); ++level) {
+      for (const T &x : levels.at(level)) {
+        weighted.push_back({x, size_t(1) << level});
+        total += size_t(1) << level;
+      }
+    }
+    std::sort(weighted.begin(), weighted.end(),
+              [](const auto &x, const auto &y) { return x.first < y.first; });
+    const double target = q * static_cast<double>(total);
+    size_t seen = 0;
+    for (const auto &item : weighted) {
+      seen += item.second;
+      if (static_cast<double>(seen) >= target)
+        return item.first;
+    }
+    return largest;
+  }
+};
+
+} // namespace stats
+} // namespace nr
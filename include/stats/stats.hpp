@@ -10,6 +10,8 @@
 #include <stdexcept>
 #include <type_traits>
 
+#include "../popcount.hpp"
+
 /*
  * Implementations of some simple statistics that are not provided
  * by the standard library (and (without spending too long...) I couldn't
@@ -118,17 +120,12 @@ inline short same_bits(size_t m, size_t n, size_t bits) {
    * checks which bits of m and n are the same.
    * the bits paramter is how many bits to compare.
    */
-  size_t one_bits = m & n;    // both ones.
-  size_t zero_bits = ~m & ~n; // both zero
-  size_t match_bits = one_bits | zero_bits;
-
-  // iterate through first 'bits' of the match_bits to find the count
-  short count = 0;
-  for (size_t i = 0; i < bits; ++i) {
-    count += match_bits & 1;
-    match_bits >>= 1;
+  size_t match_bits = ~(m ^ n); // one where the bits agree.
+  if (bits < static_cast<size_t>(std::numeric_limits<size_t>::digits)) {
+    // only count the first 'bits' of match_bits.
+    match_bits &= (size_t(1) << bits) - 1;
   }
-  return count;
+  return static_cast<short>(popcount(match_bits));
 }
 } // namespace stats
 } // namespace nr
@@ -2,7 +2,10 @@
 #pragma once
 
 #include <algorithm>
+#include <numeric>
+#include <optional>
 #include <utility>
+#include <vector>
 
 namespace nr {
 namespace stats {
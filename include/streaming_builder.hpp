@@ -0,0 +1,253 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "index_builder.hpp"
+#include "mapped_file.hpp"
+#include "query_context.hpp"
+#include "stats/quantile_sketch.hpp"
+
+/*
+ * Out-of-core version of IndexBuilder, for datasets that don't fit in memory
+ * next to the index. The data is read from a MappedRows in chunks, in two
+ * passes:
+ *   1. the norms set the norm boundaries of the partitions, through a
+ *      QuantileSketch for EqualCount or the norm range for LogNorm.
+ *   2. each chunk is normalized by its partitions' boundaries, hashed as a
+ *      batch, and appended to one bucket file per partition.
+ * Tables then loads the partitions one at a time. Only a chunk of the input
+ * and one partition are in memory at once, besides the index.
+ * Each spill writes to its own new directory, so builds can share a scratch
+ * directory, and SpillFiles removes what it wrote even if the build throws.
+ */
+
+namespace nr {
+
+template <typename Vect> struct SpilledPartition {
+  // a partition read back from its bucket file.
+  std::vector<Vect> vectors; // normalized.
+  std::vector<int64_t> buckets;
+  std::vector<int64_t> ids;
+};
+
+class SpillFiles {
+  /*
+   * the bucket files of one spill, in a directory of their own made under a
+   * parent directory. The files and the directory are removed when this is
+   * destroyed, so a build that throws doesn't leave them behind.
+   */
+private:
+  std::string directory;
+  std::vector<std::string> paths;
+
+public:
+  SpillFiles(const std::string &parent, size_t num_files) : paths(0) {
+    std::string name = parent + "/nr_spill_XXXXXX";
+    if (::mkdtemp(&name[0]) == nullptr)
+      throw std::runtime_error("SpillFiles, can't make a directory in " +
+                               parent);
+    directory = name;
+    for (size_t p = 0; p < num_files; ++p) {
+      paths.push_back(directory + "/partition_" + std::to_string(p) + ".bin");
+    }
+  }
+
+  SpillFiles(const SpillFiles &) = delete;
+  SpillFiles &operator=(const SpillFiles &) = delete;
+
+  SpillFiles(SpillFiles &&other)
+      : directory(std::move(other.directory)), paths(std::move(other.paths)) {
+    other.directory.clear();
+    other.paths.clear();
+  }
+
+  SpillFiles &operator=(SpillFiles &&) = delete;
+
+  ~SpillFiles() {
+    for (const auto &path : paths) {
+      std::remove(path.c_str());
+    }
+    if (!directory.empty())
+      ::rmdir(directory.c_str());
+  }
+
+  const std::string &path(size_t p) const { return paths.at(p); }
+
+  const std::string &dir() const { return directory; }
+
+  size_t size() const { return paths.size(); }
+
+  void remove(size_t p) const {
+    // frees the disk of a file that has been loaded.
+    std::remove(paths.at(p).c_str());
+  }
+};
+
+struct StreamingBuilder {
+  template <typename Vect>
+  static std::vector<typename Vect::value_type>
+  norm_boundaries(const MappedRows<Vect> &rows, int64_t m, size_t chunk_size,
+                  Partitioning partitioning = Partitioning::EqualCount,
+                  size_t sketch_size = 256) {
+    /*
+     * the upper norm of each of the m partitions, so partition p holds the
+     * norms in (boundaries[p - 1], boundaries[p]]. The last boundary is the
+     * exact max norm. With EqualCount the partitions have about the same
+     * number of items. With LogNorm the boundaries cut the norms into
+     * ranges of equal width in log(norm), the same ranges as
+     * IndexBuilder::log_norm_partitions.
+     */
+    using Component = typename Vect::value_type;
+    if (m <= 0)
+      throw std::runtime_error("StreamingBuilder, m must be positive");
+    if (rows.size() < static_cast<size_t>(m))
+      throw std::runtime_error("StreamingBuilder, fewer rows than partitions");
+    stats::QuantileSketch<Component> sketch(sketch_size);
+    Component smallest = std::numeric_limits<Component>::max(); // positive.
+    Component largest = 0;
+    rows.advise_sequential();
+    for (size_t start = 0; start < rows.size(); start += chunk_size) {
+      const size_t end = std::min(rows.size(), start + chunk_size);
+      for (size_t i = start; i < end; ++i) {
+        const Component norm = rows[i].norm();
+        if (partitioning == Partitioning::EqualCount)
+          sketch.insert(norm);
+        if (norm > 0)
+          smallest = std::min(smallest, norm);
+        largest = std::max(largest, norm);
+      }
+      rows.release(start, end);
+    }
+    std::vector<Component> boundaries(m, largest);
+    if (partitioning == Partitioning::LogNorm) {
+      // no range to cut. Every boundary is the max, so all go in the first.
+      if (!(smallest < largest))
+        return boundaries;
+      const double log_smallest = std::log(static_cast<double>(smallest));
+      const double width =
+          (std::log(static_cast<double>(largest)) - log_smallest) / m;
+      for (int64_t p = 0; p < m - 1; ++p) {
+        boundaries.at(p) =
+            static_cast<Component>(std::exp(log_smallest + (p + 1) * width));
+      }
+      return boundaries;
+    }
+    for (int64_t p = 0; p < m - 1; ++p) {
+      boundaries.at(p) = sketch.quantile(static_cast<double>(p + 1) / m);
+    }
+    return boundaries;
+  }
+
+  template <typename Component>
+  static size_t partition_of(Component norm,
+                             const std::vector<Component> &boundaries) {
+    // the first partition whose upper boundary is at least norm.
+    const auto found =
+        std::lower_bound(boundaries.begin(), boundaries.end(), norm);
+    if (found == boundaries.end())
+      return boundaries.size() - 1;
+    return found - boundaries.begin();
+  }
+
+  template <typename Vect, typename Hash>
+  static SpillFiles
+  spill(const MappedRows<Vect> &rows,
+        const std::vector<typename Vect::value_type> &boundaries,
+        const Hash &hash, size_t num_buckets, const std::string &dir,
+        size_t chunk_size) {
+    /*
+     * writes every row, normalized by its partition's boundary, to its
+     * partition's bucket file in a new directory under dir. A record is the
+     * id, the bucket and the components.
+     */
+    using Component = typename Vect::value_type;
+    const int64_t dim = rows.dimension();
+    SpillFiles paths(dir, boundaries.size());
+    std::vector<std::ofstream> files(boundaries.size());
+    for (size_t p = 0; p < boundaries.size(); ++p) {
+      files.at(p).open(paths.path(p), std::ios::binary | std::ios::trunc);
+      if (!files.at(p))
+        throw std::runtime_error("StreamingBuilder::spill, can't open " +
+                                 paths.path(p));
+    }
+
+    rows.advise_sequential();
+    std::vector<size_t> parts(chunk_size);
+    for (size_t start = 0; start < rows.size(); start += chunk_size) {
+      const size_t end = std::min(rows.size(), start + chunk_size);
+      BatchMatrix<Vect> normalized(dim, end - start);
+      for (size_t i = start; i < end; ++i) {
+        const auto row = rows[i];
+        const size_t p = partition_of(row.norm(), boundaries);
+        const Component Up = boundaries.at(p);
+        parts.at(i - start) = p;
+        if (Up > 0)
+          normalized.col(i - start) = row / Up;
+        else
+          normalized.col(i - start) = row;
+      }
+      // one matrix product hashes the whole chunk.
+      const auto hashed = hash_queries<Vect>(hash, normalized, num_buckets);
+      for (size_t j = 0; j < hashed.size(); ++j) {
+        const int64_t id = start + j;
+        const int64_t bucket = hashed.at(j).bucket;
+        std::ofstream &file = files.at(parts.at(j));
+        file.write(reinterpret_cast<const char *>(&id), sizeof(id));
+        file.write(reinterpret_cast<const char *>(&bucket), sizeof(bucket));
+        file.write(reinterpret_cast<const char *>(normalized.col(j).data()),
+                   dim * sizeof(Component));
+      }
+      rows.release(start, end);
+    }
+    for (size_t p = 0; p < files.size(); ++p) {
+      files.at(p).close();
+      if (!files.at(p))
+        throw std::runtime_error("StreamingBuilder::spill, can't write " +
+                                 paths.path(p));
+    }
+    return paths;
+  }
+
+  template <typename Vect>
+  static SpilledPartition<Vect> read_partition(const std::string &path,
+                                               int64_t dim) {
+    /*
+     * reads back every record of a bucket file written by spill.
+     */
+    using Component = typename Vect::value_type;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      throw std::runtime_error("StreamingBuilder::read_partition, can't open " +
+                               path);
+    SpilledPartition<Vect> partition;
+    int64_t id = 0;
+    int64_t bucket = 0;
+    Vect x(dim);
+    while (file.read(reinterpret_cast<char *>(&id), sizeof(id))) {
+      file.read(reinterpret_cast<char *>(&bucket), sizeof(bucket));
+      file.read(reinterpret_cast<char *>(x.data()), dim * sizeof(Component));
+      if (!file)
+        throw std::runtime_error(
+            "StreamingBuilder::read_partition, truncated record in " + path);
+      partition.ids.push_back(id);
+      partition.buckets.push_back(bucket);
+      partition.vectors.push_back(x);
+    }
+    return partition;
+  }
+};
+
+} // namespace nr
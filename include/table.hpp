@@ -3,6 +3,7 @@
 
 #include <boost/multiprecision/cpp_int.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <iterator>
 #include <limits>
@@ -10,58 +11,217 @@
 #include <map>
 #include <numeric>
 #include <omp.h>
+#include <optional>
 #include <stdexcept>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <iostream>
 
+#include "addressing.hpp"
+#include "dispatch.hpp"
+#include "interleave.hpp"
+#include "lsh_family.hpp"
+#include "probe_result.hpp"
 #include "simple_lsh.hpp"
 #include "stat_tracker.hpp"
 #include "stats/stats.hpp"
+#include "visited_set.hpp"
 
 namespace nr {
 
-template <typename Vect> class Table {
+template <typename Vect, typename Hash = SimpleLSH<typename Vect::value_type,
+                                                   Vect::RowsAtCompileTime>>
+class Table {
 private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
   using Component = typename Vect::value_type;
   using KV = std::pair<Vect, int64_t>;
 
-  size_t num_buckets;
-  std::vector<std::list<KV>> table;
-  SimpleLSH<Component> hash;
+  size_t num_buckets; // buckets a hash can address.
+  size_t bit_lim; // low bits of a bucket index compared when ranking.
+  std::vector<std::list<KV>> table; // the lists the buckets are stored in.
+  // bucket b is stored in table[b & slot_mask]. All ones unless resized.
+  size_t slot_mask = ~size_t(0);
+  std::unordered_map<int64_t, size_t> id_buckets; // list each id is in.
+  Hash hash;
   typename Vect::value_type normalizer; // this partitions Up normalizer
   bool data_is_normalized = false;
+  // norms[b][i] is the norm of the i-th item in bucket b.
+  std::vector<std::vector<Component>> norms;
+  std::vector<Component> max_norms; // largest norm in each bucket.
+  // at most this many items are scanned per list. 0 scans everything.
+  size_t bucket_cap = 0;
+  // a query's VisitedSet knows list i of this table as first_list + i.
+  size_t first_list = 0;
+  // visited sets for probes that are not given one.
+  mutable VisitedPool scratch;
+
+  void sort_by_norm() {
+    /*
+     * sorts every bucket by descending norm and records the norms.
+     * By Cauchy-Schwarz, q.dot(x) <= ||q|| * ||x||, so a scan can stop at the
+     * first item whose bound can't beat what it is looking for, and skip a
+     * bucket whose max norm can't.
+     */
+    for (size_t b = 0; b < table.size(); ++b) {
+      std::vector<std::pair<Component, KV>> ordered(0);
+      ordered.reserve(table.at(b).size());
+      for (KV &x : table.at(b)) {
+        const Component norm = x.first.norm();
+        ordered.push_back({norm, std::move(x)});
+      }
+      std::stable_sort(ordered.begin(), ordered.end(),
+                       [](const auto &x, const auto &y) {
+                         return x.first > y.first;
+                       });
+      table.at(b).clear();
+      norms.at(b).clear();
+      for (auto &item : ordered) {
+        norms.at(b).push_back(item.first);
+        table.at(b).push_back(std::move(item.second));
+      }
+      max_norms.at(b) = norms.at(b).empty() ? 0 : norms.at(b).front();
+    }
+  }
+
+  bool past_cap(size_t scanned) const {
+    return bucket_cap > 0 && scanned >= bucket_cap;
+  }
+
+  size_t slot(size_t bucket) const { return bucket & slot_mask; }
+
+  bool resized() const { return table.size() != num_buckets; }
 
 public:
-  Table(SimpleLSH<Component> hash, size_t num_buckets)
-      : num_buckets(num_buckets), table(num_buckets), hash(hash),
-        normalizer(0) {}
+  Table(Hash hash, size_t num_buckets,
+        Addressing addressing = Addressing::Modulo)
+      : num_buckets(num_buckets),
+        bit_lim(address_bits(num_buckets, addressing)), table(num_buckets),
+        hash(hash), normalizer(0), norms(num_buckets),
+        max_norms(num_buckets, 0) {}
+
+  void resize_buckets(size_t num_slots) {
+    /*
+     * stores the buckets in num_slots lists rather than one list each, so
+     * a small partition doesn't carry thousands of empty lists. Bucket b
+     * goes in list b % num_slots, i.e. buckets that agree on their low bits
+     * share a list. Hashing and ranking still use every bucket, so a probe
+     * sequence means the same thing in every partition. Call before fill.
+     * num_slots must be a power of two that divides the number of buckets.
+     */
+    if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0 ||
+        num_buckets % num_slots != 0)
+      throw std::runtime_error(
+          "Table::resize_buckets, num_slots must be a power of two dividing "
+          "the number of buckets");
+    table = std::vector<std::list<KV>>(num_slots);
+    norms = std::vector<std::vector<Component>>(num_slots);
+    max_norms = std::vector<Component>(num_slots, 0);
+    id_buckets.clear();
+    slot_mask = num_slots == num_buckets ? ~size_t(0) : num_slots - 1;
+  }
 
-  void fill(const std::vector<Vect> &normalized_partition,
+  size_t num_slots() const { return table.size(); }
+
+  void fill(std::vector<Vect> normalized_partition,
             const std::vector<int64_t> &indices,
             const std::vector<int64_t> &ids, const Component Up,
             bool is_normalized) {
+    /*
+     * the vectors are moved into the buckets. Pass the partition as an
+     * rvalue to avoid copying it.
+     */
     for (size_t i = 0; i < indices.size(); ++i) {
-      KV to_insert = {normalized_partition.at(i), ids.at(i)};
+      Vect &x = normalized_partition.at(i);
+      if (!is_normalized)
+        x *= Up; // this UN-normalizes before inserting.
 
       // modulo is done in the index builder. Don't need to repeat it.
-      size_t bucket_idx = indices.at(i);
-
-      if (is_normalized) {
-        table.at(bucket_idx).push_back(to_insert);
-      } else {
-        // this UN-normalizes before inserting.
-        KV fix_to_insert = {to_insert.first * Up, to_insert.second};
-        table.at(bucket_idx).push_back(fix_to_insert);
-      }
+      size_t bucket_idx = slot(indices.at(i));
+      id_buckets[ids.at(i)] = bucket_idx;
+      table.at(bucket_idx).emplace_back(std::move(x), ids.at(i));
     }
     normalizer = Up;
     data_is_normalized = is_normalized;
+    sort_by_norm();
+  }
+
+  void set_bucket_cap(size_t cap) {
+    /*
+     * bounds the cost of probing a bucket. Buckets are sorted by norm, so only
+     * the cap highest norm items of a bucket are scanned. Items past the cap
+     * can still be looked up. The cap applies to a stored list, so after
+     * resize_buckets the buckets that share a list share its cap too.
+     */
+    bucket_cap = cap;
+  }
+
+  size_t get_bucket_cap() const { return bucket_cap; }
+
+  size_t number_lists(size_t first) {
+    /*
+     * numbers this table's lists first, first + 1, ... in a query's
+     * VisitedSet and returns the next free number. A table that was not
+     * resized has one list per bucket, and a ranking never has a bucket
+     * twice, so it takes no numbers.
+     */
+    first_list = first;
+    return resized() ? first + table.size() : first;
+  }
+
+  bool visit_list(size_t bucket, VisitedSet &visited) const {
+    /*
+     * marks the list bucket is stored in as scanned by visited's query.
+     * Returns false if another bucket sharing the list already scanned it.
+     */
+    return !resized() || visited.visit_list(first_list + slot(bucket));
+  }
+
+  bool list_visited(size_t bucket, const VisitedSet &visited) const {
+    return resized() && visited.list_visited(first_list + slot(bucket));
+  }
+
+  size_t list_of(size_t bucket) const {
+    // buckets with the same list_of are stored in the same list.
+    return slot(bucket);
+  }
+
+  const std::vector<Component> &bucket_norms(size_t bucket) const {
+    // norms of the items in bucket, in the order they are stored.
+    return norms.at(slot(bucket));
+  }
+
+  Component max_norm(size_t bucket) const {
+    return max_norms.at(slot(bucket));
+  }
+
+  size_t scan_limit(size_t bucket) const {
+    // number of items a probe scans in bucket.
+    const size_t size = table.at(slot(bucket)).size();
+    return bucket_cap == 0 ? size : std::min(size, bucket_cap);
+  }
+
+  void prefetch_bucket(size_t bucket) const {
+    // the first list node and the norms of bucket.
+    if (bucket >= num_buckets)
+      return;
+    prefetch_nodes(table[slot(bucket)]);
+    prefetch(norms[slot(bucket)].data());
+  }
+
+  void prefetch_items(size_t bucket) const {
+    // the first vector of bucket. Call prefetch_bucket on it first.
+    if (bucket < num_buckets)
+      nr::prefetch_items(table[slot(bucket)]);
   }
 
   int64_t first_non_empty_bucket() const {
-    for (size_t bucket = 0; bucket < num_buckets; ++bucket) {
+    // an index into the stored lists, which are the buckets unless resized.
+    for (size_t bucket = 0; bucket < table.size(); ++bucket) {
       if (table.at(bucket).size() > 0) {
         return static_cast<int64_t>(bucket);
       }
@@ -79,11 +239,11 @@ public:
       throw std::runtime_error("table::MIPS, All buckets empty.");
     }
     KV max = *table.at(start_bucket).begin();
-    double big_dot = q.dot(max.first);
-    for (size_t idx = start_bucket; idx < num_buckets; ++idx) {
+    double big_dot = nr::dot(q, max.first);
+    for (size_t idx = start_bucket; idx < table.size(); ++idx) {
       for (auto &current : table[idx]) {
         // KV current = *iter;
-        double dot = q.dot(current.first);
+        double dot = nr::dot(q, current.first);
         if (dot > big_dot) {
           big_dot = dot;
           max = current;
@@ -100,30 +260,80 @@ public:
      * returning the KV pair that results in
      * the largest inner product with the query point.
      * */
-    using mp = boost::multiprecision::cpp_int;
-    mp mp_hash = hash(q);
-    mp residue = mp_hash % table.size();
-    int64_t idx = residue.convert_to<int64_t>();
+    auto found = probe_ids(q, n_to_probe);
+    if (found.first.empty()) // no large inner products were found.
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
 
-    StatTracker partition_tracker;
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const Vect &q, int64_t n_to_probe) const {
+    /*
+     * Same as probe, but only returns the id and inner product of the
+     * best vector found. The result is empty if nothing was found.
+     */
+    VisitedPool::Lease visited = scratch.take();
+    return probe_ids(q, n_to_probe, *visited);
+  }
 
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const Vect &q, int64_t n_to_probe, VisitedSet &visited) const {
+    /*
+     * ids already in visited were scored by another table, so they are
+     * skipped rather than dotted again.
+     */
+    const int64_t idx = hash.hash_max(q, num_buckets);
     std::vector<int64_t> rank = probe_ranking(idx, n_to_probe);
+    return probe_ranked_ids(q, rank, visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ranked_ids(const Vect &q, const std::vector<int64_t> &rank,
+                   VisitedSet &visited) const {
+    /*
+     * Searches the buckets in rank. Every partition of a Tables shares the
+     * same ranking, so Tables computes it once and passes it in.
+     */
+    StatTracker partition_tracker;
+
     // initialize to impossible values
-    KV max = {Vect(1), -1};
+    int64_t max_id = -1;
     Component big_dot = std::numeric_limits<Component>::min();
-    for (int64_t r = 0; r < n_to_probe; ++r) {
-      for (const auto &current : table.at(rank.at(r))) {
+    const Component q_norm = q.norm();
+    for (const int64_t rank_bucket : rank) {
+      // buckets that share a list are scanned once. Nothing the list had
+      // left could beat big_dot, which has only grown since.
+      if (!visit_list(rank_bucket, visited))
+        continue;
+      const size_t bucket = slot(rank_bucket);
+      // nothing in this bucket can beat the best found so far.
+      if (max_id >= 0 && max_norms.at(bucket) * q_norm <= big_dot)
+        continue;
+      const std::vector<Component> &bucket_norm = norms.at(bucket);
+      size_t scanned = 0;
+      for (const auto &current : table.at(bucket)) {
+        // later items have smaller norms, so they can't do better either.
+        if (past_cap(scanned) ||
+            (max_id >= 0 && bucket_norm.at(scanned) * q_norm <= big_dot))
+          break;
+        ++scanned;
+        if (!visited.visit(current.second)) {
+          partition_tracker.incr_duplicates_skipped();
+          continue;
+        }
         partition_tracker.incr_comparisons();
-        Component dot = q.dot(current.first);
+        Component dot = nr::dot(q, current.first);
         if (dot > big_dot) {
           big_dot = dot;
-          max = current;
+          max_id = current.second;
         }
       }
     }
-    if (max.second < 0) // no large inner products were found.
-      return {std::nullopt, partition_tracker};
-    return {max, partition_tracker};
+    ProbeResult<Component> result;
+    if (max_id >= 0)
+      result.push_back(max_id, big_dot);
+    return {result, partition_tracker};
   }
 
   inline double sim(size_t idx, size_t other) const {
@@ -132,12 +342,16 @@ public:
      * Disimilar inputs result in NEGATIVE output.
      * sort of similar inputs result in an output closer to zero.
      */
-    constexpr double PI = 3.141592653589;
-    constexpr double eps = 1e-3;
-    const size_t bit_lim = std::floor(std::log2(num_buckets)) + 1;
-    const double l = static_cast<double>(stats::same_bits(idx, other, bit_lim));
-    const double L = static_cast<double>(hash.bit_count());
-    return normalizer * std::cos(PI * (1.0 - eps) * (1.0 - (l / L)));
+    return normalizer * unscaled_sim(idx, other);
+  }
+
+  inline double unscaled_sim(size_t idx, size_t other) const {
+    /*
+     * sim without the normalizer. normalizer is positive, so this ranks
+     * buckets the same way as sim, and it is the same for every partition.
+     * The hash family decides how similar two of its buckets are.
+     */
+    return hash.bucket_sim(idx, other, bit_lim);
   }
 
   std::vector<int64_t> probe_ranking(int64_t idx, int64_t adj) const {
@@ -148,10 +362,10 @@ public:
     return stats::topk<int64_t>(
         adj, static_cast<int64_t>(0), static_cast<int64_t>(num_buckets),
         [&](const int64_t x, const int64_t y) {
-          return sim(idx, x) > sim(idx, y);
+          return unscaled_sim(idx, x) > unscaled_sim(idx, y);
         },
         [&](const int64_t x, const int64_t y) {
-          return sim(idx, x) < sim(idx, y);
+          return unscaled_sim(idx, x) < unscaled_sim(idx, y);
         });
   }
 
@@ -160,14 +374,53 @@ public:
     /*
      * returns the first vector x (if any) where q.dot(x) > c
      */
+    auto found = look_in_ids(bucket, q, c);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  look_in_ids(int64_t bucket, const Vect &q, double c) const {
+    /*
+     * returns the id and inner product of the first vector x (if any)
+     * where q.dot(x) > c
+     */
+    VisitedPool::Lease visited = scratch.take();
+    return look_in_ids(bucket, q, c, *visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  look_in_ids(int64_t bucket, const Vect &q, double c,
+              VisitedSet &visited) const {
     StatTracker partition_tracker;
     partition_tracker.incr_buckets_probed();
-    for (auto &x : table.at(bucket)) {
+    ProbeResult<Component> result;
+    // another bucket scanned this list to the bound, which c hasn't changed.
+    if (list_visited(bucket, visited))
+      return {result, partition_tracker};
+    const Component q_norm = q.norm();
+    const std::vector<Component> &bucket_norm = norms.at(slot(bucket));
+    size_t scanned = 0;
+    for (auto &x : table.at(slot(bucket))) {
+      // no item from here on can have q.dot(x) > c.
+      if (past_cap(scanned) || bucket_norm.at(scanned) * q_norm <= c)
+        break;
+      ++scanned;
+      if (!visited.visit(x.second)) {
+        partition_tracker.incr_duplicates_skipped();
+        continue;
+      }
       partition_tracker.incr_comparisons();
-      if (q.dot(x.first) > c)
-        return {x, partition_tracker};
+      const Component dot = nr::dot(q, x.first);
+      if (dot > c) {
+        result.push_back(x.second, dot);
+        return {result, partition_tracker};
+      }
     }
-    return {std::nullopt, partition_tracker};
+    visit_list(bucket, visited);
+    return {result, partition_tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
@@ -177,20 +430,73 @@ public:
      * or it reaches the end of the bucket. It returns success as long as at
      * least one such x is found. Otherwise, it returns nullopt.
      */
+    auto found = look_in_until_ids(bucket, q, c, limit);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    return {result_to_kvs<KV>(found.first,
+                              [this](int64_t id) { return lookup(id); }),
+            found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  look_in_until_ids(int64_t bucket, const Vect &q, double c,
+                    size_t limit) const {
+    /*
+     * Same as look_in_until, but returns ids and inner products.
+     * The result is empty if no x with dot(q, x) > c is found.
+     */
+    VisitedPool::Lease visited = scratch.take();
+    return look_in_until_ids(bucket, q, c, limit, *visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  look_in_until_ids(int64_t bucket, const Vect &q, double c, size_t limit,
+                    VisitedSet &visited) const {
     StatTracker partition_tracker;
-    std::vector<KV> successful(0);
-    for (const auto &x : table.at(bucket)) {
+    ProbeResult<Component> successful;
+    if (list_visited(bucket, visited))
+      return {successful, partition_tracker};
+    const Component q_norm = q.norm();
+    const std::vector<Component> &bucket_norm = norms.at(slot(bucket));
+    size_t scanned = 0;
+    for (const auto &x : table.at(slot(bucket))) {
+      // no item from here on can have q.dot(x) > c.
+      if (past_cap(scanned) || bucket_norm.at(scanned) * q_norm <= c)
+        break;
+      ++scanned;
+      if (!visited.visit(x.second)) {
+        partition_tracker.incr_duplicates_skipped();
+        continue;
+      }
       partition_tracker.incr_comparisons();
-      if (q.dot(x.first) > c)
-        successful.push_back(x);
+      const Component dot = nr::dot(q, x.first);
+      if (dot > c)
+        successful.push_back(x.second, dot);
       if (successful.size() == limit) // return if limit vectors found
         return {successful, partition_tracker};
     }
-    if (successful.size() == 0)
-      return {std::nullopt, partition_tracker};
+    // only a list scanned to the end or the bound is skipped next time.
+    visit_list(bucket, visited);
     return {successful, partition_tracker};
   }
 
+  bool has_id(int64_t id) const { return id_buckets.count(id) > 0; }
+
+  const Vect &lookup(int64_t id) const {
+    /*
+     * returns the vector stored in this partition with the given id.
+     */
+    auto bucket_iter = id_buckets.find(id);
+    if (bucket_iter == id_buckets.end()) {
+      throw std::out_of_range("Table::lookup(id) id not in partition.");
+    }
+    for (const KV &x : table.at(bucket_iter->second)) {
+      if (x.second == id)
+        return x.first;
+    }
+    throw std::out_of_range("Table::lookup(id) id not in bucket.");
+  }
+
   bool contains(Vect q) const {
     /*
      * Checks if this partition contains q.
@@ -201,7 +507,7 @@ public:
     if (norm_q.norm() > 1) // norm_q is longer than longest in partition
       return false;
     const size_t idx = hash.hash_max(norm_q, num_buckets);
-    const std::list<KV> &bucket = table.at(idx);
+    const std::list<KV> &bucket = table.at(slot(idx));
     q /= query_scalar();
     auto vect_equality = [q](const KV &x) { return x.first.isApprox(q); };
     auto q_iter = std::find_if(bucket.begin(), bucket.end(), vect_equality);
@@ -247,7 +553,17 @@ public:
     std::cout << "\tstdev:      " << stdev << '\n';
     std::cout << "\tlow median: " << stats::lower_median(bucket_sizes) << '\n';
     std::cout << "\tempty:      " << num_empty_buckets << '\n';
-    std::cout << "\tnon-empty:  " << num_buckets - num_empty_buckets << '\n';
+    std::cout << "\tnon-empty:  " << table.size() - num_empty_buckets << '\n';
+    if (resized())
+      std::cout << "\tlists:      " << table.size() << " for " << num_buckets
+                << " buckets" << '\n';
+    if (bucket_cap > 0) {
+      const auto over_cap =
+          std::count_if(bucket_sizes.begin(), bucket_sizes.end(),
+                        [this](size_t size) { return size > bucket_cap; });
+      std::cout << "\tcap:        " << bucket_cap << '\n';
+      std::cout << "\tover cap:   " << over_cap << '\n';
+    }
 
     std::vector<size_t> non_empty_sizes = stats::nonzero(bucket_sizes);
 
@@ -266,7 +582,10 @@ public:
     return (*this)[idx];
   }
 
-  const std::list<KV> &operator[](size_t idx) const { return table[idx]; }
+  const std::list<KV> &operator[](size_t idx) const {
+    // the list bucket idx is stored in, shared with other buckets if resized.
+    return table[slot(idx)];
+  }
 
   size_t size() const { return num_buckets; }
 }; // namespace nr
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <boost/multiprecision/cpp_int.hpp>
+#include <cstdio>
 #include <iostream>
 #include <iterator>
 #include <omp.h>
@@ -12,51 +13,95 @@
 #include <utility>
 #include <vector>
 
+#include "addressing.hpp"
 #include "index_builder.hpp"
+#include "lru_cache.hpp"
+#include "lsh_family.hpp"
+#include "mapped_file.hpp"
+#include "probe_result.hpp"
+#include "query_context.hpp"
 #include "simple_lsh.hpp"
 #include "stat_tracker.hpp"
+#include "streaming_builder.hpp"
 #include "table.hpp"
+#include "visited_set.hpp"
 
 namespace nr {
 
-template <typename Vect> class Tables {
+/*
+ * Hash is the family every partition hashes with. It defaults to SimpleLSH,
+ * but any family with the LSH_Family interface works, and its bucket_sim
+ * decides which buckets are probed after the query's own.
+ */
+template <typename Vect, typename Hash = SimpleLSH<typename Vect::value_type,
+                                                   Vect::RowsAtCompileTime>>
+class Tables {
 private:
+  static_assert(is_lsh_family<Hash, Vect>::value,
+                "Hash must provide the LSH_Family interface");
+
   using Component = typename Vect::value_type;
   using KV = std::pair<Vect, int64_t>;
+  using Partition = Table<Vect, Hash>;
 
   int64_t num_partitions; // corresponds to the number of tables.
   size_t num_buckets;     // is the size of each table.
-  SimpleLSH<Component> hash;
-  std::vector<Table<Vect>> tables;
+  Hash hash;
+  std::vector<Partition> tables;
   std::vector<Component> normalizers;
-
-public:
-  Tables() : hash(0, 0) {}
-
-  Tables(int64_t num_partitions, int64_t bits, int64_t dim, size_t num_buckets)
-      : num_partitions(num_partitions), num_buckets(num_buckets),
-        hash(bits, dim),
-        tables(num_partitions, Table<Vect>(hash, num_buckets)) {
-    std::cout << "hash dim: " << hash.dimension();
+  // visited sets for the queries probing this Tables on its own.
+  mutable VisitedPool scratch;
+  // bucket rankings only depend on (idx, adj), so recent ones are reused.
+  // The cache locks itself, so concurrent probes can share it.
+  mutable LRUCache<std::pair<int64_t, int64_t>, ProbeSequence> ranking_cache;
+  Partitioning partitioning = Partitioning::EqualCount;
+  ThreadPool *build_pool = nullptr; // partitions in parallel if set.
+  // mean items per list each partition is sized for. 0 keeps every bucket.
+  double bucket_occupancy = 0;
+
+  size_t slots_for(size_t items) const {
+    /*
+     * the fewest lists, doubling from one, that hold items at no more than
+     * bucket_occupancy each. A partition that needs more than the buckets
+     * allow, or that can't halve num_buckets evenly, keeps every bucket.
+     */
+    size_t slots = 1;
+    while (static_cast<double>(slots) * bucket_occupancy <
+           static_cast<double>(items)) {
+      if (2 * slots > num_buckets || num_buckets % (2 * slots) != 0)
+        return num_buckets;
+      slots *= 2;
+    }
+    return slots;
   }
 
-  Tables(Tables &&other) {
-    num_partitions = other.num_partitions;
-    num_buckets = other.num_buckets;
-    hash = other.hash;
-    tables = other.tables;
-    normalizers = other.normalizers;
+  void size_partition(size_t p, size_t items) {
+    if (bucket_occupancy > 0)
+      tables.at(p).resize_buckets(slots_for(items));
   }
 
-  Tables &operator=(Tables &&other) {
-    num_partitions = other.num_partitions;
-    num_buckets = other.num_buckets;
-    hash = other.hash;
-    tables = other.tables;
-    normalizers = other.normalizers;
-    return *this;
+public:
+  Tables(int64_t num_partitions, int64_t bits, int64_t dim, size_t num_buckets,
+         Addressing addressing = Addressing::Modulo)
+      : Tables(num_partitions, Hash(bits, dim), num_buckets, addressing) {}
+
+  Tables(int64_t num_partitions, const Hash &hash, size_t num_buckets,
+         Addressing addressing = Addressing::Modulo)
+      : num_partitions(num_partitions), num_buckets(num_buckets), hash(hash),
+        tables(num_partitions, Partition(hash, num_buckets, addressing)) {
+    /*
+     * for families that are not built from (bits, dim), like PStableLSH.
+     */
+    check_addressing(num_buckets, hash.bit_count(), addressing, "Tables");
+    std::cout << "hash dim: " << hash.dimension();
   }
 
+  // the partitions hold a copy of the data, so only copy on purpose.
+  Tables(const Tables &other) = default;
+  Tables(Tables &&other) = default;
+  Tables &operator=(const Tables &other) = default;
+  Tables &operator=(Tables &&other) = default;
+
   template <typename Cont> void fill(const Cont &data, bool is_normalized) {
     /*
      * partition data and put partitions into different tables.
@@ -80,24 +125,71 @@ public:
     }
     */
 
-    auto tup = IndexBuilder::build(data, num_partitions, num_buckets, hash);
+    auto tup = IndexBuilder::build(data, num_partitions, num_buckets, hash,
+                                   partitioning, build_pool);
 
     auto &parts = std::get<0>(tup);
     auto &normal_data = std::get<1>(tup);
     auto &normalizers = std::get<2>(tup);
     auto &indices = std::get<3>(tup);
 
-    std::vector<std::vector<Vect>> parted_data(parts.size());
-    for (size_t p = 0; p < parts.size(); ++p) {
-      for (size_t i = 0; i < parts.at(p).size(); ++i) {
-        parted_data.at(p).push_back(normal_data.at(p).at(i));
-      }
+    // each partition takes its normalized vectors rather than copying them.
+    for (size_t p = 0; p < tables.size(); ++p) {
+      size_partition(p, parts.at(p).size());
+      tables.at(p).fill(std::move(normal_data.at(p)), indices.at(p),
+                        parts.at(p), normalizers.at(p), is_normalized);
     }
+    number_lists(0);
+    scratch.resize(data.size());
+  }
 
+  void fill_streaming(const MappedRows<Vect> &rows, const std::string &dir,
+                      bool is_normalized, size_t chunk_size = 4096) {
+    /*
+     * same as fill, but for data too big to hold in memory next to the
+     * index. See StreamingBuilder. The bucket files are written to a new
+     * directory in dir, which must exist, and removed once their partition
+     * is loaded. Partitions are cut as set_partitioning says. EqualCount
+     * boundaries come from a quantile sketch, so partitions are only about
+     * the same size.
+     */
+    fill_streaming(rows, streaming_boundaries(rows, chunk_size), dir,
+                   is_normalized, chunk_size);
+  }
+
+  void fill_streaming(const MappedRows<Vect> &rows,
+                      const std::vector<Component> &boundaries,
+                      const std::string &dir, bool is_normalized,
+                      size_t chunk_size = 4096) {
+    /*
+     * fill_streaming with norm boundaries from streaming_boundaries, so
+     * tables that partition the same rows only read their norms once.
+     */
+    if (rows.dimension() != hash.dimension())
+      throw std::runtime_error("Tables::fill_streaming, wrong dimension");
+    if (boundaries.size() != tables.size())
+      throw std::runtime_error(
+          "Tables::fill_streaming, one boundary per partition");
+    normalizers = boundaries;
+    const SpillFiles files = StreamingBuilder::spill(
+        rows, normalizers, hash, num_buckets, dir, chunk_size);
     for (size_t p = 0; p < tables.size(); ++p) {
-      tables.at(p).fill(parted_data.at(p), indices.at(p), parts.at(p),
+      auto part =
+          StreamingBuilder::read_partition<Vect>(files.path(p), rows.dimension());
+      files.remove(p);
+      size_partition(p, part.ids.size());
+      tables.at(p).fill(std::move(part.vectors), part.buckets, part.ids,
                         normalizers.at(p), is_normalized);
     }
+    number_lists(0);
+    scratch.resize(rows.size());
+  }
+
+  std::vector<Component> streaming_boundaries(const MappedRows<Vect> &rows,
+                                              size_t chunk_size = 4096) const {
+    // the norm boundaries fill_streaming cuts rows into partitions with.
+    return StreamingBuilder::norm_boundaries(rows, num_partitions, chunk_size,
+                                             partitioning);
   }
 
   std::pair<std::optional<KV>, StatTracker> probe(const Vect &q,
@@ -106,39 +198,171 @@ public:
      * Find the vector in the adj highest ranked bucket of each partition
      * that has the largets inner product with q.
      */
-    std::vector<KV> x(0);
+    auto found = probe_ids(q, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker> probe_ids(const Vect &q,
+                                                           int64_t adj) const {
+    /*
+     * Same as probe, but returns the id and inner product of the best vector.
+     * Each partition reports its inner product, so nothing is recomputed.
+     */
+    return probe_ids(context(q, adj));
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const QueryContext<Vect> &ctx) const {
+    VisitedPool::Lease visited = scratch.take();
+    return probe_ids(ctx.query, ctx.hashes.at(0), *visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_ids(const Vect &q, const HashedQuery<Vect> &hashed,
+            VisitedSet &visited) const {
+    /*
+     * ids already in visited are skipped. Used when several Tables are
+     * probed for the same query.
+     */
+    ProbeResult<Component> best;
     StatTracker table_tracker;
+    // every partition shares the hash, so they share the ranking too.
     for (auto &table : tables) {
-      auto found = table.probe(q, adj);
-      std::optional<KV> candidate_vect = found.first;
-      if (candidate_vect)
-        x.push_back(candidate_vect.value());
+      auto found = table.probe_ranked_ids(q, hashed.probe_sequence, visited);
+      const ProbeResult<Component> &candidate = found.first;
+      if (!candidate.empty() &&
+          (best.empty() || candidate.scores.at(0) > best.scores.at(0)))
+        best = candidate;
       table_tracker += found.second;
       table_tracker.incr_partitions_probed();
     }
-    if (x.size() == 0)
-      return {std::nullopt, table_tracker};
+    return {best, table_tracker};
+  }
 
-    KV ret = *std::max_element(x.begin(), x.end(), [&](KV y, KV z) {
-      return q.dot(y.first) < q.dot(z.first);
-    });
-    return {ret, table_tracker};
+  HashedQuery<Vect> hash_query(const Vect &normalized_q, int64_t adj) const {
+    /*
+     * hashes a unit length query and ranks the adj buckets to probe.
+     * For a unit query the appended sqrt(1 - ||q||^2) of the Simple-LSH
+     * transform is 0, so queries are hashed as [q / ||q||; 0]. This is not
+     * the bucket hash_max(q) gives for ||q|| < 1, whose appended component
+     * is non-zero; it does make the buckets depend only on the direction
+     * of q, which is all MIPS ranks by, and accepts queries with ||q|| > 1.
+     */
+    HashedQuery<Vect> hashed = nr::hash_query(hash, normalized_q, num_buckets);
+    hashed.probe_sequence =
+        shared_ranking(static_cast<int64_t>(hashed.bucket), adj);
+    return hashed;
+  }
+
+  std::vector<HashedQuery<Vect>>
+  hash_queries(const BatchMatrix<Vect> &normalized_qs, int64_t adj) const {
+    /*
+     * hash_query for every column of normalized_qs, projecting them with one
+     * matrix product.
+     */
+    std::vector<HashedQuery<Vect>> hashed =
+        nr::hash_queries<Vect>(hash, normalized_qs, num_buckets);
+    for (auto &query : hashed) {
+      query.probe_sequence =
+          shared_ranking(static_cast<int64_t>(query.bucket), adj);
+    }
+    return hashed;
+  }
+
+  QueryContext<Vect> context(const Vect &q, int64_t adj) const {
+    /*
+     * hashes q once. The context can be passed to any of the probe
+     * functions in place of the query and adj.
+     */
+    QueryContext<Vect> ctx(q);
+    ctx.hashes.push_back(hash_query(ctx.normalized(), adj));
+    return ctx;
+  }
+
+  ProbeSequence shared_ranking(int64_t idx, int64_t adj) const {
+    /*
+     * finds the ranking used by every partition. Partitions only differ by
+     * their normalizer, which does not change the order of the buckets.
+     * Recently used rankings are memoized, and a cached ranking is shared
+     * with the queries that use it rather than copied.
+     */
+    const auto key = std::make_pair(idx, adj);
+    std::optional<ProbeSequence> cached = ranking_cache.get(key);
+    if (cached)
+      return std::move(cached.value());
+    ProbeSequence ranking(tables.at(0).probe_ranking(idx, adj));
+    ranking_cache.put(key, ranking);
+    return ranking;
   }
 
   auto sub_tables_rankings(int64_t idx, int64_t k) const {
     /*
      * finds rankings for each partition.
      */
-    std::vector<std::vector<int64_t>> rankings(tables.size());
-    for (size_t i = 0; i < tables.size(); ++i)
-      rankings.at(i) = tables.at(i).probe_ranking(idx, k);
-    return rankings;
+    return std::vector<std::vector<int64_t>>(
+        tables.size(), shared_ranking(idx, k).buckets());
   }
 
-  std::vector<std::vector<int64_t>> rank_around_query(const Vect &q,
-                                                      int64_t adj) const {
-    int64_t idx = static_cast<int64_t>(hash.hash_max(q, num_buckets));
-    return sub_tables_rankings(idx, adj);
+  std::vector<int64_t> rank_around_query(const Vect &q, int64_t adj) const {
+    return context(q, adj).hashes.at(0).probe_sequence;
+  }
+
+  void set_ranking_cache_size(size_t size) { ranking_cache.resize(size); }
+
+  void set_partitioning(Partitioning how, ThreadPool *workers = nullptr) {
+    /*
+     * how the next fill cuts the data into partitions by norm. With
+     * workers, the norms and the selection run on them.
+     */
+    partitioning = how;
+    build_pool = workers;
+  }
+
+  void set_bucket_occupancy(double occupancy) {
+    /*
+     * sizes each partition at the next fill for about occupancy items per
+     * list, rather than num_buckets lists each. Small partitions then share
+     * lists between buckets (see Table::resize_buckets), so num_buckets can
+     * be chosen for the largest partition. 0, the default, turns it off.
+     */
+    if (occupancy < 0)
+      throw std::runtime_error(
+          "Tables::set_bucket_occupancy, occupancy must not be negative");
+    bucket_occupancy = occupancy;
+  }
+
+  size_t number_lists(size_t first) {
+    /*
+     * numbers the shared lists of every partition from first, so one
+     * VisitedSet can track them for a query. Returns the next free number.
+     */
+    for (auto &table : tables) {
+      first = table.number_lists(first);
+    }
+    return first;
+  }
+
+  void prefetch_bucket(size_t bucket) const {
+    // starts loading bucket in every partition.
+    for (const auto &table : tables) {
+      table.prefetch_bucket(bucket);
+    }
+  }
+
+  void prefetch_items(size_t bucket) const {
+    for (const auto &table : tables) {
+      table.prefetch_items(bucket);
+    }
+  }
+
+  void set_bucket_cap(size_t cap) {
+    // at most cap items are scanned per list in every partition.
+    for (auto &table : tables) {
+      table.set_bucket_cap(cap);
+    }
   }
 
   std::pair<std::optional<KV>, StatTracker>
@@ -147,70 +371,122 @@ public:
      * finds the first vector in any of the adj hiehgest ranked partitions
      * with q.dot(x) > c
      */
+    auto found = probe_approx_ids(q, c, adj);
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    const int64_t id = found.first.ids.at(0);
+    return {KV{lookup(id), id}, found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, Component c, int64_t adj) const {
+    /*
+     * Same as probe_approx, but returns the id and inner product.
+     */
+    return probe_approx_ids(context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const QueryContext<Vect> &ctx, Component c) const {
+    VisitedPool::Lease visited = scratch.take();
+    return probe_approx_ids(ctx.query, ctx.hashes.at(0), c, *visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  probe_approx_ids(const Vect &q, const HashedQuery<Vect> &hashed, Component c,
+                   VisitedSet &visited) const {
     StatTracker table_tracker;
-    auto rankings = rank_around_query(q, adj);
-    for (int64_t col = 0; col < adj; ++col) {
+    for (const int64_t bucket : hashed.probe_sequence) {
       for (size_t t = 0; t < tables.size(); ++t) {
-        auto found = tables.at(t).look_in(rankings[t][col], q, c);
+        auto found = tables.at(t).look_in_ids(bucket, q, c, visited);
         table_tracker += found.second; // add partition's stats to total
-        if (found.first) {
+        if (!found.first.empty()) {
           // probed t partitions before value was found.
           table_tracker.k_partitions_probed(t);
-          return std::make_pair(found.first.value(), table_tracker);
+          return {found.first, table_tracker};
         }
       }
     }
     // If nothing found, it looked through the top ranked buckets.
-    table_tracker.k_partitions_probed(rankings.size());
-    return {std::nullopt, table_tracker};
+    table_tracker.k_partitions_probed(tables.size());
+    return {ProbeResult<Component>(), table_tracker};
   }
 
   std::pair<std::optional<std::vector<KV>>, StatTracker>
   k_probe_approx(int64_t k, const Vect &q, Component c, size_t adj) const {
+    auto found = k_probe_approx_ids(k, q, c, adj);
+    // if everything was searched, and at least one thing was found, return
+    // success, if everything was searched and nothing was found, then the
+    // search failed.
+    if (found.first.empty())
+      return {std::nullopt, found.second};
+    return {result_to_kvs<KV>(found.first,
+                              [this](int64_t id) { return lookup(id); }),
+            found.second};
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, Component c, size_t adj) const {
+    return k_probe_approx_ids(k, context(q, adj), c);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const QueryContext<Vect> &ctx,
+                     Component c) const {
+    VisitedPool::Lease visited = scratch.take();
+    return k_probe_approx_ids(k, ctx.query, ctx.hashes.at(0), c, *visited);
+  }
+
+  std::pair<ProbeResult<Component>, StatTracker>
+  k_probe_approx_ids(int64_t k, const Vect &q, const HashedQuery<Vect> &hashed,
+                     Component c, VisitedSet &visited) const {
     if (k < 0) {
       throw std::runtime_error(
           "tables::k_probe_approx. k must be non-negative");
     }
     StatTracker table_tracker;
 
-    size_t idx = hash.hash_max(q, num_buckets);
-    auto rankings = sub_tables_rankings(idx, adj);
-
-    std::vector<KV> vects(0);
-    for (size_t col = 0; col < adj; ++col) {
-      for (size_t t = 0; t < rankings.size(); ++t) {
+    ProbeResult<Component> found_ids;
+    found_ids.reserve(k);
+    for (const int64_t bucket : hashed.probe_sequence) {
+      for (size_t t = 0; t < tables.size(); ++t) {
 
-        auto found = tables[t].look_in_until(rankings.at(t).at(col), q, c,
-                                             k - vects.size());
+        auto found = tables[t].look_in_until_ids(
+            bucket, q, c, k - found_ids.size(), visited);
 
         table_tracker += found.second; // add partitions' stats together
 
-        if (found.first) {
-          // append vects from bucket to the ones already found.
-          std::vector<KV> from_bucket = found.first.value();
-          vects.insert(vects.end(), from_bucket.begin(), from_bucket.end());
+        // append ids from bucket to the ones already found.
+        for (size_t i = 0; i < found.first.size(); ++i) {
+          found_ids.push_back(found.first.ids.at(i), found.first.scores.at(i));
         }
-        if (vects.size() == static_cast<size_t>(k)) {
+        if (found_ids.size() == static_cast<size_t>(k)) {
           // look_in_until stops when it finds k - vects.size things, so
           // checking for equality is safe.
           // if k things found, return success immediately.
-          return {vects, table_tracker};
+          return {found_ids, table_tracker};
         }
       }
     }
-    // if everything was searched, and at least one thing was found, return
-    // success, if everything was searched and nothing was found, then the
-    // search failed.
-    if (vects.size() == 0)
-      return {std::nullopt, table_tracker};
-    return {vects, table_tracker};
+    return {found_ids, table_tracker};
+  }
+
+  const Vect &lookup(int64_t id) const {
+    /*
+     * returns the vector with the given id from whichever partition has it.
+     */
+    for (const auto &table : tables) {
+      if (table.has_id(id))
+        return table.lookup(id);
+    }
+    throw std::out_of_range("Tables::lookup(id) id not in any partition.");
   }
 
   bool contains(const Vect &q) {
     /*
      * Check if any partitions contain q.
      */
-    auto any_true = [q](bool accum, const Table<Vect> &x) {
+    auto any_true = [q](bool accum, const Partition &x) {
       return accum || x.contains(q);
     };
     return std::accumulate(tables.begin(), tables.end(), false, any_true);
@@ -225,19 +501,19 @@ public:
     }
   }
 
-  const Table<Vect> &at(size_t idx) const {
+  const Partition &at(size_t idx) const {
     if (!(idx < size())) {
       throw std::out_of_range("Tables::at(idx) idx out of bounds.");
     }
     return (*this)[idx];
   }
 
-  const Table<Vect> &operator[](size_t idx) const { return tables[idx]; }
+  const Partition &operator[](size_t idx) const { return tables[idx]; }
 
   size_t size() const { return tables.size(); }
 
-  typename std::vector<Table<Vect>>::iterator begin() { return tables.begin(); }
-  typename std::vector<Table<Vect>>::iterator end() { return tables.end(); }
+  typename std::vector<Partition>::iterator begin() { return tables.begin(); }
+  typename std::vector<Partition>::iterator end() { return tables.end(); }
 };
 
 } // namespace nr
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "numa.hpp"
+
+/*
+ * Small work-stealing thread pool.
+ * Every worker has its own deque. Tasks are handed out round robin, a worker
+ * runs the newest task in its own deque and steals the oldest task from the
+ * others when it runs out. The pool is created once and reused, so a query
+ * does not pay for starting threads or an OpenMP parallel region.
+ * Workers can be pinned to CPUs, e.g. the CPUs of one NUMA node, so they
+ * stay near the memory they scan.
+ */
+
+namespace nr {
+
+class ThreadPool {
+private:
+  using Task = std::function<void()>;
+
+  struct Queue {
+    std::deque<Task> tasks;
+    std::mutex lock;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> pending{0}; // tasks submitted but not started.
+  std::atomic<size_t> next_queue{0};
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  bool pop(size_t home, Task &task) {
+    /*
+     * takes the newest task from queue home, or steals the oldest task from
+     * any other queue.
+     */
+    {
+      Queue &own = *queues.at(home);
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --pending;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+      Queue &other = *queues.at((home + i) % queues.size());
+      std::lock_guard<std::mutex> guard(other.lock);
+      if (!other.tasks.empty()) {
+        task = std::move(other.tasks.front());
+        other.tasks.pop_front();
+        --pending;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(size_t home) {
+    while (true) {
+      Task task;
+      if (pop(home, task)) {
+        task();
+        continue;
+      }
+      std::unique_lock<std::mutex> guard(sleep_lock);
+      wake.wait(guard, [this] { return stopping || pending > 0; });
+      if (stopping && pending == 0)
+        return;
+    }
+  }
+
+  void start(size_t num_threads, const std::vector<int> &cpus) {
+    // worker i is pinned to cpus[i], if there is one.
+    const size_t n = std::max<size_t>(num_threads, 1);
+    for (size_t i = 0; i < n; ++i) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < n; ++i) {
+      const int cpu = i < cpus.size() ? cpus.at(i) : -1;
+      workers.emplace_back([this, i, cpu] {
+        if (cpu >= 0)
+          pin_current_thread({cpu});
+        work(i);
+      });
+    }
+  }
+
+public:
+  explicit ThreadPool(
+      size_t num_threads = std::max(1u, std::thread::hardware_concurrency())) {
+    start(num_threads, {});
+  }
+
+  explicit ThreadPool(const std::vector<int> &cpus) {
+    /*
+     * one worker pinned to each of cpus, e.g. numa_nodes().at(node).
+     */
+    if (cpus.empty())
+      throw std::runtime_error("ThreadPool, no cpus to pin to");
+    start(cpus.size(), cpus);
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(sleep_lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  size_t size() const { return workers.size(); }
+
+  void submit(Task task) {
+    const size_t home = next_queue++ % queues.size();
+    {
+      // incremented under sleep_lock so a worker can't miss the wake up, and
+      // before the task is published so a pop can't take pending below 0.
+      std::lock_guard<std::mutex> guard(sleep_lock);
+      ++pending;
+    }
+    {
+      Queue &queue = *queues.at(home);
+      std::lock_guard<std::mutex> guard(queue.lock);
+      queue.tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  bool run_one() {
+    /*
+     * runs a queued task on the calling thread, if there is one. Lets a
+     * thread that is waiting on tasks help finish them.
+     */
+    Task task;
+    if (!pop(next_queue % queues.size(), task))
+      return false;
+    task();
+    return true;
+  }
+
+  template <typename Fn>
+  void parallel_for(size_t n, size_t max_parallelism, Fn fn) {
+    /*
+     * calls fn(i) for every i in [0, n) using at most max_parallelism
+     * threads, including the calling thread, and returns once all calls are
+     * done. Indices are claimed one at a time, so a slow index doesn't hold
+     * up the others. The first exception thrown by fn is rethrown here.
+     */
+    struct Shared {
+      std::atomic<size_t> next{0};
+      std::atomic<size_t> helpers_running{0};
+      std::mutex error_lock;
+      std::exception_ptr error;
+    };
+    auto shared = std::make_shared<Shared>();
+    auto claim = [shared, n, &fn] {
+      size_t i;
+      while ((i = shared->next++) < n) {
+        try {
+          fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> guard(shared->error_lock);
+          if (!shared->error)
+            shared->error = std::current_exception();
+        }
+      }
+    };
+
+    const size_t threads = std::min({n, std::max<size_t>(max_parallelism, 1),
+                                      size() + 1});
+    shared->helpers_running = threads > 0 ? threads - 1 : 0;
+    for (size_t t = 1; t < threads; ++t) {
+      submit([shared, claim] {
+        claim();
+        --shared->helpers_running;
+      });
+    }
+    claim();
+    // helpers reference fn, so wait until every one of them has finished.
+    while (shared->helpers_running > 0) {
+      if (!run_one())
+        std::this_thread::yield();
+    }
+    if (shared->error)
+      std::rethrow_exception(shared->error);
+  }
+
+  static ThreadPool &shared() {
+    // one pool for the whole process, started the first time it is used.
+    static ThreadPool pool;
+    return pool;
+  }
+};
+
+} // namespace nr
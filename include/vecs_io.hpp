@@ -0,0 +1,219 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+/*
+ * Readers and writers for dataset files.
+ *   fvecs: each vector is its dimension as an int32, then its components as
+ *          float32. SIFT1M, GIST1M and most exported embeddings use it.
+ *   ivecs: the same with int32 components, e.g. ground truth neighbours.
+ *   bvecs: the same with uint8 components, e.g. SIFT1B.
+ *   f32 matrix: the 8 bytes "NRF32MAT", the number of rows and of columns
+ *          as uint64, then the rows as float32, one after another.
+ * The readers memory map the file and return MappedRows over it, so fill,
+ * fill_streaming and contexts read the vectors in place. The dimension in
+ * front of each vecs vector just becomes part of the stride between rows.
+ * Everything is little endian, as written by the tools that make them.
+ */
+
+namespace nr {
+
+using VectorXu8 = Eigen::Matrix<uint8_t, Eigen::Dynamic, 1>;
+
+constexpr char f32_matrix_magic[8] = {'N', 'R', 'F', '3', '2', 'M', 'A', 'T'};
+constexpr size_t f32_matrix_header =
+    sizeof(f32_matrix_magic) + 2 * sizeof(uint64_t);
+
+template <typename Vect> MappedRows<Vect> read_vecs(const std::string &path) {
+  /*
+   * maps a fvecs, ivecs or bvecs file. Vect's components must be the type
+   * stored in the file. Every vector must have the same dimension.
+   */
+  using Component = typename Vect::value_type;
+  static_assert(sizeof(int32_t) % sizeof(Component) == 0,
+                "read_vecs, components must be 1, 2 or 4 bytes");
+  MappedFile file(path);
+  if (file.size() < sizeof(int32_t))
+    throw std::runtime_error("read_vecs, " + path + " is empty");
+  int32_t dim = 0;
+  std::memcpy(&dim, file.data(), sizeof(dim));
+  if (dim <= 0)
+    throw std::runtime_error("read_vecs, bad dimension in " + path);
+  const size_t record = sizeof(int32_t) + dim * sizeof(Component);
+  if (file.size() % record != 0)
+    throw std::runtime_error("read_vecs, " + path +
+                             " is not a whole number of vectors");
+  // checking the last vector as well catches most files with mixed
+  // dimensions, without reading every page.
+  int32_t last_dim = 0;
+  std::memcpy(&last_dim, file.data() + file.size() - record, sizeof(last_dim));
+  if (last_dim != dim)
+    throw std::runtime_error("read_vecs, vectors in " + path +
+                             " have different dimensions");
+  return MappedRows<Vect>(std::move(file), dim, sizeof(int32_t),
+                          record / sizeof(Component));
+}
+
+template <typename Vect = Eigen::VectorXf>
+MappedRows<Vect> read_fvecs(const std::string &path) {
+  static_assert(std::is_same<typename Vect::value_type, float>::value,
+                "read_fvecs, fvecs holds floats");
+  return read_vecs<Vect>(path);
+}
+
+inline MappedRows<Eigen::VectorXi> read_ivecs(const std::string &path) {
+  static_assert(sizeof(int) == sizeof(int32_t), "ivecs holds int32");
+  return read_vecs<Eigen::VectorXi>(path);
+}
+
+inline MappedRows<VectorXu8> read_bvecs(const std::string &path) {
+  return read_vecs<VectorXu8>(path);
+}
+
+template <typename Stored, typename Cont>
+void write_vecs(const std::string &path, const Cont &rows) {
+  /*
+   * writes each row of rows as a Stored vector. rows can be anything with
+   * size() and at(i), where at(i) has size() and operator[], like a
+   * std::vector of Eigen vectors or of std::vectors.
+   */
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    throw std::runtime_error("write_vecs, can't open " + path);
+  std::vector<Stored> components(0);
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const auto &row = rows.at(i);
+    const int32_t dim = static_cast<int32_t>(row.size());
+    components.resize(dim);
+    for (int32_t j = 0; j < dim; ++j) {
+      if constexpr (std::is_same<Stored, uint8_t>::value) {
+        if (row[j] < 0 || row[j] > std::numeric_limits<uint8_t>::max())
+          throw std::runtime_error("write_vecs, component out of range");
+      }
+      components.at(j) = static_cast<Stored>(row[j]);
+    }
+    file.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+    file.write(reinterpret_cast<const char *>(components.data()),
+               dim * sizeof(Stored));
+  }
+  if (!file)
+    throw std::runtime_error("write_vecs, can't write " + path);
+}
+
+template <typename Cont>
+void write_fvecs(const std::string &path, const Cont &rows) {
+  write_vecs<float>(path, rows);
+}
+
+template <typename Cont>
+void write_ivecs(const std::string &path, const Cont &rows) {
+  write_vecs<int32_t>(path, rows);
+}
+
+template <typename Cont>
+void write_bvecs(const std::string &path, const Cont &rows) {
+  write_vecs<uint8_t>(path, rows);
+}
+
+template <typename Vect = Eigen::VectorXf>
+MappedRows<Vect> read_f32_matrix(const std::string &path) {
+  static_assert(std::is_same<typename Vect::value_type, float>::value,
+                "read_f32_matrix, the matrix holds floats");
+  MappedFile file(path);
+  if (file.size() < f32_matrix_header ||
+      std::memcmp(file.data(), f32_matrix_magic, sizeof(f32_matrix_magic)))
+    throw std::runtime_error("read_f32_matrix, " + path +
+                             " is not an f32 matrix");
+  uint64_t num_rows = 0;
+  uint64_t num_cols = 0;
+  std::memcpy(&num_rows, file.data() + sizeof(f32_matrix_magic),
+              sizeof(num_rows));
+  std::memcpy(&num_cols,
+              file.data() + sizeof(f32_matrix_magic) + sizeof(num_rows),
+              sizeof(num_cols));
+  // checked by dividing, so a corrupt header can't overflow a product.
+  const uint64_t payload = file.size() - f32_matrix_header;
+  const bool matches =
+      num_cols != 0 &&
+      (num_rows == 0 ? payload == 0
+                     : num_cols <= payload / sizeof(float) &&
+                           payload % (num_cols * sizeof(float)) == 0 &&
+                           payload / (num_cols * sizeof(float)) == num_rows);
+  if (!matches)
+    throw std::runtime_error("read_f32_matrix, " + path +
+                             " does not match its header");
+  return MappedRows<Vect>(std::move(file), num_cols, f32_matrix_header);
+}
+
+template <typename Cont>
+void write_f32_matrix(const std::string &path, const Cont &rows,
+                      uint64_t dim = 0) {
+  /*
+   * writes rows, which must all have the same size, as an f32 matrix.
+   * An empty rows has no size to take, so its dimension must be passed as
+   * dim. Otherwise dim, if given, must be the size of the rows.
+   */
+  const uint64_t num_rows = rows.size();
+  const uint64_t num_cols = num_rows == 0 ? dim : rows.at(0).size();
+  if (num_cols == 0 || (dim != 0 && dim != num_cols))
+    throw std::runtime_error("write_f32_matrix, needs a positive dim that "
+                             "matches the rows");
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    throw std::runtime_error("write_f32_matrix, can't open " + path);
+  file.write(f32_matrix_magic, sizeof(f32_matrix_magic));
+  file.write(reinterpret_cast<const char *>(&num_rows), sizeof(num_rows));
+  file.write(reinterpret_cast<const char *>(&num_cols), sizeof(num_cols));
+  std::vector<float> components(num_cols);
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const auto &row = rows.at(i);
+    if (static_cast<uint64_t>(row.size()) != num_cols)
+      throw std::runtime_error("write_f32_matrix, rows differ in size");
+    for (uint64_t j = 0; j < num_cols; ++j) {
+      components.at(j) = static_cast<float>(row[j]);
+    }
+    file.write(reinterpret_cast<const char *>(components.data()),
+               num_cols * sizeof(float));
+  }
+  if (!file)
+    throw std::runtime_error("write_f32_matrix, can't write " + path);
+}
+
+template <typename Vect, typename Rows> class CastRows {
+private:
+  const Rows &rows;
+
+public:
+  using value_type = Vect;
+
+  explicit CastRows(const Rows &rows) : rows(rows) {}
+
+  size_t size() const { return rows.size(); }
+
+  Vect at(size_t i) const {
+    // converted one row at a time, so the whole dataset is never copied.
+    return rows.at(i).template cast<typename Vect::value_type>();
+  }
+};
+
+template <typename Vect, typename Rows>
+CastRows<Vect, Rows> cast_rows(const Rows &rows) {
+  /*
+   * rows with their components converted, e.g. to fill a float table from
+   * bvecs. rows must outlive the CastRows.
+   */
+  return CastRows<Vect, Rows>(rows);
+}
+
+} // namespace nr
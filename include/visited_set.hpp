@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+ * Tracks which item ids have already been scored during a query.
+ * Every id gets a stamp. An id is visited if its stamp equals the current
+ * epoch, so starting a new query is just incrementing the epoch rather than
+ * clearing the whole array.
+ * Indexes with several tables, like NR_MultiProbe and
+ * LSH_MultiProbe_MultiTable, store every id in every table, so a query
+ * shares one set across its tables and each id is scored once.
+ * A set belongs to one query at a time. Indexes hand them out from a
+ * VisitedPool, so queries running at the same time have their own.
+ * It also stamps bucket lists, so a list shared by several buckets (see
+ * Table::resize_buckets) is scanned once per query.
+ */
+
+namespace nr {
+
+class VisitedSet {
+private:
+  std::vector<uint32_t> stamps;
+  std::vector<uint32_t> list_stamps;
+  uint32_t epoch = 1;
+
+public:
+  VisitedSet() : stamps(0), list_stamps(0) {}
+
+  explicit VisitedSet(size_t num_ids) : stamps(num_ids, 0), list_stamps(0) {}
+
+  void resize(size_t num_ids) { stamps.resize(num_ids, 0); }
+
+  void clear() {
+    /*
+     * forget every visited id. Only touches the stamps when the epoch
+     * wraps around.
+     */
+    ++epoch;
+    if (epoch == 0) {
+      std::fill(stamps.begin(), stamps.end(), 0);
+      std::fill(list_stamps.begin(), list_stamps.end(), 0);
+      epoch = 1;
+    }
+  }
+
+  bool visit(int64_t id) {
+    /*
+     * marks id as visited. Returns true if it was not visited before.
+     * grows if id is larger than any id seen so far.
+     */
+    const size_t idx = static_cast<size_t>(id);
+    if (idx >= stamps.size())
+      stamps.resize(idx + 1, 0);
+    if (stamps[idx] == epoch)
+      return false;
+    stamps[idx] = epoch;
+    return true;
+  }
+
+  bool visited(int64_t id) const {
+    const size_t idx = static_cast<size_t>(id);
+    return idx < stamps.size() && stamps[idx] == epoch;
+  }
+
+  bool visit_list(size_t list) {
+    /*
+     * marks list as scanned. Returns true if it was not scanned before.
+     * Lists are numbered per index, see Tables::number_lists.
+     */
+    if (list >= list_stamps.size())
+      list_stamps.resize(list + 1, 0);
+    if (list_stamps[list] == epoch)
+      return false;
+    list_stamps[list] = epoch;
+    return true;
+  }
+
+  bool list_visited(size_t list) const {
+    return list < list_stamps.size() && list_stamps[list] == epoch;
+  }
+
+  size_t size() const { return stamps.size(); }
+};
+
+class VisitedPool {
+private:
+  mutable std::mutex lock;
+  std::vector<std::unique_ptr<VisitedSet>> free_sets;
+  size_t num_ids = 0; // size of a new set.
+
+  void give_back(std::unique_ptr<VisitedSet> set) {
+    std::lock_guard<std::mutex> guard(lock);
+    free_sets.push_back(std::move(set));
+  }
+
+public:
+  class Lease {
+    // a set taken from a pool, returned to it when the lease ends.
+  private:
+    VisitedPool *pool;
+    std::unique_ptr<VisitedSet> set;
+
+  public:
+    Lease(VisitedPool &pool, std::unique_ptr<VisitedSet> set)
+        : pool(&pool), set(std::move(set)) {}
+
+    Lease(const Lease &other) = delete;
+    Lease &operator=(const Lease &other) = delete;
+    Lease(Lease &&other) = default;
+    Lease &operator=(Lease &&other) = delete;
+
+    ~Lease() {
+      if (set)
+        pool->give_back(std::move(set));
+    }
+
+    VisitedSet &operator*() const { return *set; }
+    VisitedSet *operator->() const { return set.get(); }
+  };
+
+  VisitedPool() = default;
+
+  // a copy starts without sets of its own. Sets are only scratch space.
+  VisitedPool(const VisitedPool &other) : num_ids(other.ids()) {}
+
+  VisitedPool &operator=(const VisitedPool &other) {
+    if (this != &other) {
+      const size_t other_ids = other.ids();
+      std::lock_guard<std::mutex> guard(lock);
+      free_sets.clear();
+      num_ids = other_ids;
+    }
+    return *this;
+  }
+
+  Lease take() {
+    /*
+     * a cleared set for one query. Sets are reused, so after the first
+     * queries this neither allocates nor touches the stamps.
+     */
+    std::unique_ptr<VisitedSet> set;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!free_sets.empty()) {
+        set = std::move(free_sets.back());
+        free_sets.pop_back();
+      }
+    }
+    if (!set)
+      set = std::make_unique<VisitedSet>(ids());
+    set->clear();
+    return Lease(*this, std::move(set));
+  }
+
+  void resize(size_t ids) {
+    // every set, now and later, has room for ids ids.
+    std::lock_guard<std::mutex> guard(lock);
+    num_ids = ids;
+    for (auto &set : free_sets) {
+      set->resize(ids);
+    }
+  }
+
+  size_t ids() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return num_ids;
+  }
+
+  size_t idle() const {
+    // sets not taken by a query right now.
+    std::lock_guard<std::mutex> guard(lock);
+    return free_sets.size();
+  }
+};
+
+} // namespace nr
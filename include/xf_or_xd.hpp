@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <Eigen/Core>
@@ -8,20 +7,32 @@
  * Helper classes to determine if something should use Xd or Xf based on
  * the component type. These could probably be combined into one that takes a
  * matrix or vector parameter, but I think this is more readable
+ *
+ * The dimensions default to Eigen::Dynamic. Passing a fixed dimension, e.g.
+ * VectorXf_or_Xd<float, 128>, gives a fixed size type that lives on the
+ * stack and whose loops Eigen unrolls for that size.
  */
 
 namespace nr {
 
-template <typename Component>
-class VectorXf_or_Xd : public std::conditional<
-                           /*if*/ std::is_same<Component, double>::value,
-                           /*then*/ Eigen::VectorXd,
-                           /*else*/ Eigen::VectorXf> {};
+template <typename Component, int Dim = Eigen::Dynamic>
+class VectorXf_or_Xd
+    : public std::conditional<
+          /*if*/ std::is_same<Component, double>::value,
+          /*then*/ Eigen::Matrix<double, Dim, 1>,
+          /*else*/ Eigen::Matrix<float, Dim, 1>> {};
+
+template <typename Component, int Rows = Eigen::Dynamic,
+          int Cols = Eigen::Dynamic>
+class MatrixXf_or_Xd
+    : public std::conditional<
+          /*if*/ std::is_same<Component, double>::value,
+          /*then*/ Eigen::Matrix<double, Rows, Cols>,
+          /*else*/ Eigen::Matrix<float, Rows, Cols>> {};
 
-template <typename Component>
-class MatrixXf_or_Xd : public std::conditional<
-                           /*if*/ std::is_same<Component, double>::value,
-                           /*then*/ Eigen::MatrixXd,
-                           /*else*/ Eigen::MatrixXf> {};
+constexpr int plus_one(int dim) {
+  // dimension after appending one component, e.g. by SimpleLSH's P.
+  return dim == Eigen::Dynamic ? Eigen::Dynamic : dim + 1;
+}
 
 } // namespace nr
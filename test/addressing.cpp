@@ -0,0 +1,67 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "../include/addressing.hpp"
+#include "../include/lsh.hpp"
+#include "../include/lsh_multi.hpp"
+#include "../include/nr_multiprobe.hpp"
+#include "../include/popcount.hpp"
+
+using namespace nr;
+
+TEST_CASE("address bits", "addressing") {
+  REQUIRE(is_power_of_two(1));
+  REQUIRE(is_power_of_two(64));
+  REQUIRE(!is_power_of_two(0));
+  REQUIRE(!is_power_of_two(12));
+
+  REQUIRE(address_bits(8, Addressing::LowBits) == 3);
+  REQUIRE(address_bits(1, Addressing::LowBits) == 0);
+  REQUIRE(address_bits(8, Addressing::Modulo) == 4);
+  REQUIRE(address_bits(10, Addressing::Modulo) == 4);
+}
+
+TEST_CASE("low bits addressing is validated", "addressing") {
+  REQUIRE_THROWS(check_addressing(12, 10, Addressing::LowBits, "test"));
+  REQUIRE_THROWS(check_addressing(2048, 10, Addressing::LowBits, "test"));
+  REQUIRE_NOTHROW(check_addressing(1024, 10, Addressing::LowBits, "test"));
+  REQUIRE_NOTHROW(check_addressing(12, 2, Addressing::Modulo, "test"));
+
+  REQUIRE_THROWS(
+      LSH_MultiProbe<Eigen::VectorXf>(5, 3, 12, Addressing::LowBits));
+  REQUIRE_THROWS(LSH_MultiProbe_MultiTable<Eigen::VectorXf>(
+      2, 5, 3, 64, Addressing::LowBits));
+  REQUIRE_THROWS(
+      NR_MultiProbe<Eigen::VectorXf>(1, 2, 5, 3, 10, Addressing::LowBits));
+}
+
+TEST_CASE("low bits probing flips only bucket bits", "addressing") {
+  LSH_MultiProbe_MultiTable<Eigen::VectorXf> lsh(1, 10, 3, 8,
+                                                 Addressing::LowBits);
+  Eigen::VectorXf q(3);
+  q << .3, -.1, .2;
+  const auto ctx = lsh.context(q, 1);
+  const auto &hashed = ctx.hashes.at(0);
+  // the bucket and everything within 2 of its 3 bits.
+  REQUIRE(hashed.probe_sequence.size() == 7);
+  REQUIRE(hashed.probe_sequence.at(0) == static_cast<int64_t>(hashed.bucket));
+  for (const int64_t bucket : hashed.probe_sequence) {
+    REQUIRE(bucket < 8);
+    REQUIRE(popcount(bucket ^ hashed.bucket) <= 2);
+  }
+}
+
+TEST_CASE("low bits ranking in one table", "addressing") {
+  LSH_MultiProbe<Eigen::VectorXf> lsh(6, 3, 16, Addressing::LowBits);
+  Eigen::VectorXf q(3);
+  q << .3, -.1, .2;
+  const auto ctx = lsh.context(q, 5);
+  const auto &hashed = ctx.hashes.at(0);
+  REQUIRE(hashed.probe_sequence.at(0) == static_cast<int64_t>(hashed.bucket));
+  // the next four differ from the bucket in one bit.
+  for (size_t i = 1; i < 5; ++i) {
+    REQUIRE(popcount(hashed.probe_sequence.at(i) ^ hashed.bucket) == 1);
+  }
+}
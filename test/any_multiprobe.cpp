@@ -0,0 +1,66 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "../include/any_multiprobe.hpp"
+#include "../include/hamming_rank.hpp"
+#include "../include/lsh.hpp"
+#include "../include/lsh_forest.hpp"
+#include "../include/lsh_multi.hpp"
+#include "../include/nr_multiprobe.hpp"
+#include "../include/p_stable_lsh.hpp"
+#include "../include/sign_lsh.hpp"
+#include "../include/simple_lsh.hpp"
+
+using namespace Eigen;
+
+TEST_CASE("hash families meet the static interface", "any_multiprobe") {
+  REQUIRE(nr::is_lsh_family<nr::SignLSH<float>, VectorXf>::value);
+  REQUIRE(nr::is_lsh_family<nr::SimpleLSH<double>, VectorXd>::value);
+  REQUIRE(nr::is_lsh_family<nr::PStableLSH<float>, VectorXf>::value);
+  REQUIRE(nr::is_lsh_family<nr::SignLSH<float, 8>, Matrix<float, 8, 1>>::value);
+  REQUIRE_FALSE(nr::is_lsh_family<VectorXf, VectorXf>::value);
+  // none of them pay for a vtable.
+  REQUIRE_FALSE(std::is_polymorphic<nr::SimpleLSH<float>>::value);
+}
+
+TEST_CASE("tables meet the static interface", "any_multiprobe") {
+  REQUIRE(nr::is_multiprobe<nr::NR_MultiProbe<VectorXf>, VectorXf>::value);
+  REQUIRE(nr::is_multiprobe<nr::LSH_MultiProbe<VectorXf>, VectorXf>::value);
+  REQUIRE(nr::is_multiprobe<nr::LSH_MultiProbe_MultiTable<VectorXd>,
+                            VectorXd>::value);
+  REQUIRE(nr::is_multiprobe<nr::HammingRankIndex<VectorXf>, VectorXf>::value);
+  REQUIRE(nr::is_multiprobe<nr::LSH_Forest<VectorXf>, VectorXf>::value);
+  REQUIRE_FALSE(nr::is_multiprobe<nr::SignLSH<float>, VectorXf>::value);
+  REQUIRE_FALSE(std::is_polymorphic<nr::NR_MultiProbe<VectorXf>>::value);
+}
+
+TEST_CASE("any multiprobe forwards to the wrapped table", "any_multiprobe") {
+  std::vector<VectorXf> data(20, VectorXf(4));
+  for (auto &v : data) {
+    v = VectorXf::Random(4);
+  }
+  std::vector<nr::AnyMultiProbe<VectorXf>> tables;
+  tables.push_back(
+      nr::AnyMultiProbe<VectorXf>::make<nr::NR_MultiProbe<VectorXf>>(2, 2, 3,
+                                                                      4, 4));
+  tables.push_back(
+      nr::AnyMultiProbe<VectorXf>::make<nr::LSH_Forest<VectorXf>>(2, 8, 4));
+  for (auto &table : tables) {
+    table.fill(data, false);
+    REQUIRE(table.num_tables() == 2);
+    REQUIRE(table.lookup(3).isApprox(data.at(3)));
+    auto ctx = table.context(data.at(5), 4);
+    auto from_ctx = table.k_probe_ids(3, ctx);
+    auto from_q = table.k_probe_ids(3, data.at(5), 4);
+    REQUIRE(from_ctx.first.ids == from_q.first.ids);
+  }
+
+  auto *nr_table = tables.at(0).target<nr::NR_MultiProbe<VectorXf>>();
+  REQUIRE(nr_table != nullptr);
+  REQUIRE(tables.at(0).target<nr::LSH_Forest<VectorXf>>() == nullptr);
+  auto direct = nr_table->k_probe_ids(3, data.at(5), 4);
+  auto wrapped = tables.at(0).k_probe_ids(3, data.at(5), 4);
+  REQUIRE(direct.first.ids == wrapped.first.ids);
+}
@@ -0,0 +1,100 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "../include/async_prober.hpp"
+#include "../include/lsh_multi.hpp"
+#include "../include/nr_multiprobe.hpp"
+
+using namespace Eigen;
+
+std::vector<VectorXf> async_data() {
+  std::vector<VectorXf> data(30, VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << std::cos(.7 * i), std::sin(.3 * i), .05 * i;
+  }
+  return data;
+}
+
+TEST_CASE("batched k probe matches single queries", "async_prober") {
+  nr::NR_MultiProbe<VectorXf> probe(3, 2, 4, 3, 4);
+  auto data = async_data();
+  probe.fill(data, false);
+
+  auto batch = probe.k_probe_ids_batch(3, data, 2);
+  REQUIRE(batch.size() == data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto single = probe.k_probe_ids(3, data.at(i), 2);
+    REQUIRE(batch.at(i).first.ids == single.first.ids);
+  }
+
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(3, 8, 3, 8);
+  lsh.fill(data);
+  auto lsh_batch = lsh.k_probe_ids_batch(2, data, 2);
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto single = lsh.k_probe_ids(2, data.at(i), 2);
+    REQUIRE(lsh_batch.at(i).first.scores == single.first.scores);
+  }
+}
+
+TEST_CASE("async prober answers every submitted query", "async_prober") {
+  nr::NR_MultiProbe<VectorXf> probe(3, 2, 4, 3, 4);
+  auto data = async_data();
+  probe.fill(data, false);
+
+  std::vector<std::pair<nr::ProbeResult<float>, nr::StatTracker>> expected;
+  for (const auto &q : data) {
+    expected.push_back(probe.k_probe_ids(3, q, 2));
+  }
+
+  nr::AsyncProber<nr::NR_MultiProbe<VectorXf>> prober(
+      probe, 3, 2, 8, std::chrono::microseconds(2000));
+  std::vector<std::future<std::pair<nr::ProbeResult<float>, nr::StatTracker>>>
+      futures(data.size());
+  // submit from several threads at once.
+  std::vector<std::thread> clients;
+  for (size_t c = 0; c < 3; ++c) {
+    clients.emplace_back([&, c] {
+      for (size_t i = c; i < data.size(); i += 3) {
+        futures.at(i) = prober.submit(data.at(i));
+      }
+    });
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(futures.at(i).get().first.ids == expected.at(i).first.ids);
+  }
+  // how queries are grouped depends on timing, but every query went out in
+  // exactly one batch of at most max_batch.
+  REQUIRE(prober.queries_sent() == data.size());
+  REQUIRE(prober.batches_sent() >= (data.size() + 7) / 8);
+  REQUIRE(prober.batches_sent() <= data.size());
+}
+
+TEST_CASE("async prober flushes a partial batch", "async_prober") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 8, 3, 8);
+  auto data = async_data();
+  lsh.fill(data);
+
+  nr::AsyncProber<nr::LSH_MultiProbe_MultiTable<VectorXf>> prober(
+      lsh, 1, 2, 64, std::chrono::microseconds(100));
+  auto found = prober.submit(data.at(4)).get();
+  REQUIRE(found.first.size() == 1);
+  REQUIRE(found.first.scores.at(0) == Approx(0));
+  // the lone query went out without waiting for the batch to fill.
+  REQUIRE(prober.queries_sent() == 1);
+  REQUIRE(prober.batches_sent() == prober.queries_sent());
+}
+
+TEST_CASE("async prober rejects bad settings", "async_prober") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 8, 3, 8);
+  using Prober = nr::AsyncProber<nr::LSH_MultiProbe_MultiTable<VectorXf>>;
+  REQUIRE_THROWS_AS(Prober(lsh, 0, 2), std::runtime_error);
+  REQUIRE_THROWS_AS(Prober(lsh, 1, 2, 0), std::runtime_error);
+}
@@ -0,0 +1,62 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+#include "../include/dispatch.hpp"
+#include "../include/popcount.hpp"
+#include "../include/sign_lsh.hpp"
+
+using namespace Eigen;
+
+TEST_CASE("dispatch reports a target", "dispatch") {
+  const std::string target = nr::dispatch_target();
+  REQUIRE((target == "avx512f" || target == "avx2" || target == "default"));
+}
+
+TEST_CASE("dispatched dot and distance match eigen", "dispatch") {
+  // sizes around the partial sum width, to cover the tails.
+  for (int n : {1, 3, 15, 16, 17, 40, 100}) {
+    VectorXf x = VectorXf::Random(n);
+    VectorXf y = VectorXf::Random(n);
+    REQUIRE(nr::dot(x, y) == Approx(x.dot(y)).margin(1e-5));
+    REQUIRE(nr::distance(x, y) == Approx((x - y).norm()).margin(1e-5));
+    VectorXd xd = x.cast<double>();
+    VectorXd yd = y.cast<double>();
+    REQUIRE(nr::dot(xd, yd) == Approx(xd.dot(yd)));
+    REQUIRE(nr::distance(xd, yd) == Approx((xd - yd).norm()));
+  }
+}
+
+TEST_CASE("dispatched sign packing matches bit by bit packing", "dispatch") {
+  for (int bits : {1, 20, 64, 65, 130}) {
+    VectorXf projections = VectorXf::Random(bits);
+    projections(0) = 0; // zero counts as positive.
+    std::vector<uint64_t> words(nr::code_words(bits) + 1, ~uint64_t(0));
+    nr::pack_signs(projections, words.data(), words.size());
+    for (int i = 0; i < bits; ++i) {
+      const bool set = (words.at(i / 64) >> (i % 64)) & 1;
+      REQUIRE(set == (projections(i) >= 0));
+    }
+    REQUIRE(words.back() == 0); // unused words are cleared.
+  }
+}
+
+TEST_CASE("sign lsh code matches bits_to_num", "dispatch") {
+  nr::SignLSH<float> sign(130, 5);
+  for (int i = 0; i < 20; ++i) {
+    VectorXf x = VectorXf::Random(5);
+    const VectorXf projections = sign.project(x);
+    REQUIRE(sign.code(projections) ==
+            sign.bits_to_num(sign.numerals_to_bits(projections)));
+  }
+}
+
+TEST_CASE("dispatched hamming distances", "dispatch") {
+  std::vector<uint64_t> codes{0, ~uint64_t(0), 0xF0F0, 1, 3, 7};
+  const uint64_t query[2] = {0, 1};
+  std::vector<uint32_t> out(3, 0);
+  nr::hamming_distances(query, codes.data(), 2, 3, out.data());
+  REQUIRE(out == std::vector<uint32_t>{63, 8, 4});
+}
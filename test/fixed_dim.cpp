@@ -0,0 +1,95 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "../include/dispatch.hpp"
+#include "../include/lsh_multi.hpp"
+#include "../include/nr_multiprobe.hpp"
+#include "../include/simple_lsh.hpp"
+#include "../include/xf_or_xd.hpp"
+
+using namespace Eigen;
+using Vector16f = Matrix<float, 16, 1>;
+using Vector64f = Matrix<float, 64, 1>;
+using Vector128d = Matrix<double, 128, 1>;
+
+TEST_CASE("xf_or_xd takes a dimension", "fixed_dim") {
+  REQUIRE(std::is_same<nr::VectorXf_or_Xd<float>::type, VectorXf>::value);
+  REQUIRE(std::is_same<nr::VectorXf_or_Xd<float, 64>::type, Vector64f>::value);
+  REQUIRE(std::is_same<nr::MatrixXf_or_Xd<double, 3, 2>::type,
+                       Matrix<double, 3, 2>>::value);
+  REQUIRE(nr::plus_one(64) == 65);
+  REQUIRE(nr::plus_one(Dynamic) == Dynamic);
+}
+
+TEST_CASE("fixed size dot and distance match eigen", "fixed_dim") {
+  Vector64f x = Vector64f::Random();
+  Vector64f y = Vector64f::Random();
+  REQUIRE(nr::dot(x, y) == Approx(x.dot(y)).margin(1e-5));
+  REQUIRE(nr::distance(x, y) == Approx((x - y).norm()).margin(1e-5));
+  Vector128d xd = Vector128d::Random();
+  Vector128d yd = Vector128d::Random();
+  REQUIRE(nr::dot(xd, yd) == Approx(xd.dot(yd)));
+  REQUIRE(nr::distance(xd, yd) == Approx((xd - yd).norm()));
+}
+
+TEST_CASE("fixed size hash families", "fixed_dim") {
+  nr::SimpleLSH<float, 64> simple(20, 64);
+  REQUIRE(simple.dimension() == 64);
+  Vector64f x = Vector64f::Random().normalized() / 2;
+  REQUIRE(simple.P(x).size() == 65);
+  REQUIRE(simple.hash(x) == simple.code(simple.project(x)));
+
+  // the batch path gives the same codes as one query at a time.
+  MatrixXf batch(64, 3);
+  batch.col(0) = x;
+  batch.col(1) = -x;
+  batch.col(2) = Vector64f::Random().normalized() / 3;
+  const MatrixXf projections = simple.project_batch(batch);
+  for (Index j = 0; j < batch.cols(); ++j) {
+    REQUIRE(simple.code(projections.col(j)) ==
+            simple.hash(Vector64f(batch.col(j))));
+  }
+
+  REQUIRE_THROWS(nr::SignLSH<float, 64>(8, 63));
+  REQUIRE_THROWS(nr::SimpleLSH<float, 64>(8, 65));
+}
+
+TEST_CASE("NR multiprobe with fixed size vectors", "fixed_dim") {
+  nr::NR_MultiProbe<Vector16f> probe(2, 2, 4, 16, 4);
+  std::vector<Vector16f> data(50);
+  for (Vector16f &v : data) {
+    v = Vector16f::Random();
+  }
+  probe.fill(data, false);
+
+  Vector16f query = Vector16f::Random();
+  // probing every bucket finds the exact top 3.
+  auto out = probe.k_probe_ids(3, query, 4);
+  std::vector<float> scores(0);
+  for (const Vector16f &v : data) {
+    scores.push_back(v.dot(query));
+  }
+  std::sort(scores.begin(), scores.end());
+  REQUIRE(out.first.size() == 3);
+  REQUIRE(out.first.scores.back() == Approx(scores.back()));
+  REQUIRE(probe.lookup(out.first.ids.back()).dot(query) ==
+          Approx(scores.back()));
+}
+
+TEST_CASE("lsh multi table with fixed size vectors", "fixed_dim") {
+  nr::LSH_MultiProbe_MultiTable<Vector16f> lsh(2, 6, 16, 8);
+  std::vector<Vector16f> data(30);
+  for (Vector16f &v : data) {
+    v = Vector16f::Random();
+  }
+  lsh.fill(data);
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto found = lsh.probe_ids(data.at(i), 1);
+    REQUIRE(found.first.size() == 1);
+    REQUIRE(found.first.scores.front() == Approx(0).margin(1e-5));
+  }
+}
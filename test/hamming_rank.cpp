@@ -0,0 +1,103 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../include/hamming_rank.hpp"
+#include "../include/popcount.hpp"
+#include "../include/sign_lsh.hpp"
+
+using namespace nr;
+
+TEST_CASE("popcount", "hamming_rank") {
+  REQUIRE(popcount(0) == 0);
+  REQUIRE(popcount(0b1011) == 3);
+  REQUIRE(popcount(~uint64_t(0)) == 64);
+}
+
+TEST_CASE("hamming distance over several words", "hamming_rank") {
+  std::vector<uint64_t> x{0b1111, 0, ~uint64_t(0)};
+  std::vector<uint64_t> y{0b0101, 1, 0};
+  REQUIRE(hamming_distance(x.data(), y.data(), 3) == 2 + 1 + 64);
+
+  std::vector<uint32_t> out(2, 0);
+  std::vector<uint64_t> codes{0b1111, 0, 0, 0b0101, 1, 0};
+  hamming_distances(x.data(), codes.data(), 3, 2, out.data());
+  REQUIRE(out.at(0) == 0 + 0 + 64);
+  REQUIRE(out.at(1) == 2 + 1 + 64);
+}
+
+TEST_CASE("packed signs match SignLSH codes", "hamming_rank") {
+  SignLSH<float> hash(70, 5);
+  Eigen::VectorXf x(5);
+  x << .1, -.2, .3, -.4, .5;
+  const auto packed = pack_signs(hash.project(x));
+  REQUIRE(packed.size() == 2);
+  const mp::cpp_int code = hash.hash(x);
+  for (size_t i = 0; i < 70; ++i) {
+    const bool bit = mp::bit_test(code, i);
+    REQUIRE(bit == static_cast<bool>((packed.at(i / 64) >> (i % 64)) & 1));
+  }
+}
+
+TEST_CASE("hamming rank orders by distance", "hamming_rank") {
+  HammingRankIndex<Eigen::VectorXf> index(16, 3);
+  std::vector<Eigen::VectorXf> data(4, Eigen::VectorXf(3));
+  data.at(0) << .1, .2, .3;
+  data.at(1) << -.3, -.2, -.1;
+  data.at(2) << .2, .1, .3;
+  data.at(3) << .1, .2, .3;
+  index.fill(data);
+
+  // items 0 and 3 are identical, so they have the same code.
+  REQUIRE(hamming_distance(index.code(0), index.code(3),
+                           index.words_per_code()) == 0);
+  const auto ctx = index.context(data.at(0), 4);
+  const auto &ranked = ctx.hashes.at(0).probe_sequence;
+  REQUIRE(ranked.size() == 4);
+  // ties are broken by id, and item 0 is at distance 0.
+  REQUIRE(ranked.at(0) == 0);
+  REQUIRE(ranked.back() == 1);
+  const auto query_code = pack_signs(ctx.hashes.at(0).projections);
+  for (size_t i = 1; i < ranked.size(); ++i) {
+    REQUIRE(hamming_distance(query_code.data(), index.code(ranked.at(i - 1)),
+                             index.words_per_code()) <=
+            hamming_distance(query_code.data(), index.code(ranked.at(i)),
+                             index.words_per_code()));
+  }
+}
+
+TEST_CASE("hamming rank k probe rescores candidates", "hamming_rank") {
+  HammingRankIndex<Eigen::VectorXd, SignLSH<double>> index(8, 2);
+  std::vector<Eigen::VectorXd> data(3, Eigen::VectorXd(2));
+  data.at(0) << 1, 0;
+  data.at(1) << 2, 0;
+  data.at(2) << 0, 1;
+  index.fill(data);
+
+  Eigen::VectorXd q(2);
+  q << 1, 0;
+  // rescoring every item is exact.
+  auto found = index.k_probe_ids(2, q, 3);
+  REQUIRE(found.first.ids == std::vector<int64_t>{0, 1});
+  REQUIRE(found.first.scores == std::vector<double>{1, 2});
+  REQUIRE(found.second.get_stats() == std::make_tuple(3, 0, 0, 0, 0));
+
+  auto best = index.probe(q, 3);
+  REQUIRE(best.first);
+  REQUIRE(best.first->second == 1);
+  REQUIRE(index.lookup(2) == data.at(2));
+  REQUIRE_THROWS(index.lookup(3));
+
+  auto approx = index.k_probe_approx_ids(5, q, 0.5, 3);
+  REQUIRE(approx.first.ids == std::vector<int64_t>{0, 1});
+
+  // like the other MIPS indexes, an inner product equal to c is not enough.
+  auto strict = index.k_probe_approx_ids(5, q, 1, 3);
+  REQUIRE(strict.first.ids == std::vector<int64_t>{1});
+  auto first = index.probe_approx_ids(q, 1, 3);
+  REQUIRE(first.first.ids == std::vector<int64_t>{1});
+  REQUIRE(index.probe_approx_ids(q, 2, 3).first.empty());
+}
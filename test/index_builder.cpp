@@ -240,3 +240,67 @@ TEST_CASE("hash 3 ten element partitions", "index_builder") {
   }
   REQUIRE(hash(norm.at(2).at(3)) == idx.at(2).at(3));
 }
+
+TEST_CASE("selection partitions match sorted partitions", "index_builder") {
+  std::vector<Eigen::VectorXf> data(103, Eigen::VectorXf(4));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(4);
+  }
+  const auto norms = ib.norms(data);
+  nr::ThreadPool pool(3);
+  for (int64_t m : {1, 2, 3, 7, 16}) {
+    auto sorted = ib.partitioner(data, m);
+    auto selected = ib.select_partitions(norms, m);
+    auto parallel = ib.select_partitions(ib.norms(data, &pool), m, &pool);
+    REQUIRE(selected.size() == static_cast<size_t>(m));
+    for (int64_t p = 0; p < m; ++p) {
+      std::sort(sorted.at(p).begin(), sorted.at(p).end());
+      std::sort(selected.at(p).begin(), selected.at(p).end());
+      std::sort(parallel.at(p).begin(), parallel.at(p).end());
+      REQUIRE(selected.at(p) == sorted.at(p));
+      REQUIRE(parallel.at(p) == sorted.at(p));
+    }
+  }
+}
+
+TEST_CASE("log norm partitions have equal log widths", "index_builder") {
+  std::vector<float> norms{1, 2.5, 3, 5, 7, 8, 0, 8};
+  // log2 of the norms is spread over [0, 3], one unit per partition.
+  auto parts = ib.log_norm_partitions(norms, 3);
+  REQUIRE(parts.size() == 3);
+  REQUIRE(parts.at(0) == std::vector<int64_t>{0, 6});
+  REQUIRE(parts.at(1) == std::vector<int64_t>{1, 2});
+  REQUIRE(parts.at(2) == std::vector<int64_t>{3, 4, 5, 7});
+
+  // with no range, everything goes in the first partition, like zero norms.
+  const std::vector<int64_t> all{0, 1, 2};
+  auto same = ib.log_norm_partitions(std::vector<float>{2, 2, 2}, 2);
+  REQUIRE(same.at(0) == all);
+  REQUIRE(same.at(1).empty());
+  auto zeros = ib.log_norm_partitions(std::vector<float>{0, 0, 0}, 2);
+  REQUIRE(zeros.at(0) == all);
+  REQUIRE(zeros.at(1).empty());
+  auto mixed = ib.log_norm_partitions(std::vector<float>{0, 2, 2}, 2);
+  REQUIRE(mixed.at(0) == all);
+  REQUIRE(mixed.at(1).empty());
+}
+
+TEST_CASE("build with log norm partitions", "index_builder") {
+  std::vector<Eigen::VectorXf> data(30, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) = Eigen::VectorXf::Random(3) * (i < 25 ? 1 : 100);
+  }
+  nr::SimpleLSH<float> hash(4, 3);
+  auto built = ib.build(data, 4, 8, hash, nr::Partitioning::LogNorm);
+  auto &parts = std::get<0>(built);
+  auto &normalizers = std::get<2>(built);
+  size_t total = 0;
+  for (size_t p = 0; p < parts.size(); ++p) {
+    total += parts.at(p).size();
+    REQUIRE(normalizers.at(p) > 0);
+    for (int64_t id : parts.at(p)) {
+      REQUIRE(data.at(id).norm() <= normalizers.at(p));
+    }
+  }
+  REQUIRE(total == data.size());
+}
@@ -0,0 +1,123 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <cmath>
+#include <vector>
+
+#include "../include/interleave.hpp"
+#include "../include/lsh_multi.hpp"
+#include "../include/nr_multiprobe.hpp"
+
+using namespace Eigen;
+
+TEST_CASE("interleave steps every query to completion", "interleave") {
+  // query i needs i + 1 steps.
+  const size_t n = 7;
+  std::vector<size_t> steps(n, 0);
+  std::vector<int> slot_of(n, -1);
+  std::vector<int> in_use(3, -1);
+  nr::interleave(
+      n, 3,
+      [&](size_t query, size_t slot) {
+        REQUIRE(in_use.at(slot) == -1);
+        in_use.at(slot) = query;
+        slot_of.at(query) = slot;
+      },
+      [&](size_t query, size_t slot) {
+        REQUIRE(slot_of.at(query) == static_cast<int>(slot));
+        ++steps.at(query);
+        if (steps.at(query) == query + 1) {
+          in_use.at(slot) = -1;
+          return false;
+        }
+        return true;
+      });
+  for (size_t query = 0; query < n; ++query) {
+    REQUIRE(steps.at(query) == query + 1);
+  }
+
+  size_t calls = 0;
+  nr::interleave(0, 4, [&](size_t, size_t) { ++calls; },
+                 [&](size_t, size_t) {
+                   ++calls;
+                   return false;
+                 });
+  REQUIRE(calls == 0);
+}
+
+std::vector<VectorXf> interleave_data() {
+  std::vector<VectorXf> data(60, VectorXf(4));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << std::cos(.4 * i), std::sin(.9 * i), .02 * i,
+        std::cos(1.3 * i) / 2;
+  }
+  return data;
+}
+
+TEST_CASE("NR interleaved batch matches single queries", "interleave") {
+  nr::NR_MultiProbe<VectorXf> probe(3, 3, 4, 4, 8);
+  auto data = interleave_data();
+  probe.fill(data, false);
+  auto ctxs = probe.contexts(data, 3);
+
+  for (size_t width : {1, 3, 8}) {
+    probe.set_batch_width(width);
+    auto batch = probe.k_probe_ids_batch(4, ctxs);
+    REQUIRE(batch.size() == data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+      auto single = probe.k_probe_ids(4, ctxs.at(i));
+      REQUIRE(batch.at(i).first.ids == single.first.ids);
+      nr::Tracked b = batch.at(i).second.tracked_stats();
+      nr::Tracked s = single.second.tracked_stats();
+      REQUIRE(b.comparisons == s.comparisons);
+      REQUIRE(b.buckets_probed == s.buckets_probed);
+      REQUIRE(b.tables_probed == s.tables_probed);
+    }
+  }
+}
+
+TEST_CASE("lsh multi interleaved batch matches single queries", "interleave") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(3, 8, 4, 16);
+  auto data = interleave_data();
+  lsh.fill(data);
+  auto ctxs = lsh.contexts(data, 2);
+
+  for (size_t width : {1, 4, 16}) {
+    lsh.set_batch_width(width);
+    auto batch = lsh.k_probe_ids_batch(3, ctxs);
+    REQUIRE(batch.size() == data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+      auto single = lsh.k_probe_ids(3, ctxs.at(i));
+      REQUIRE(batch.at(i).first.ids == single.first.ids);
+      REQUIRE(batch.at(i).first.scores == single.first.scores);
+      nr::Tracked b = batch.at(i).second.tracked_stats();
+      nr::Tracked s = single.second.tracked_stats();
+      REQUIRE(b.comparisons == s.comparisons);
+      REQUIRE(b.duplicates_skipped == s.duplicates_skipped);
+      REQUIRE(b.buckets_probed == s.buckets_probed);
+    }
+  }
+}
+
+TEST_CASE("NR bucket major batch matches single queries", "interleave") {
+  nr::NR_MultiProbe<VectorXf> probe(3, 3, 4, 4, 8);
+  auto data = interleave_data();
+  probe.fill(data, false);
+  // the data doubles as queries, so many queries share buckets.
+  auto ctxs = probe.contexts(data, 3);
+
+  auto by_bucket = probe.k_probe_ids_by_bucket(4, ctxs);
+  REQUIRE(by_bucket.size() == data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto single = probe.k_probe_ids(4, ctxs.at(i));
+    REQUIRE(by_bucket.at(i).first.ids == single.first.ids);
+    for (size_t r = 0; r < single.first.size(); ++r) {
+      REQUIRE(by_bucket.at(i).first.scores.at(r) ==
+              Approx(single.first.scores.at(r)));
+    }
+    nr::Tracked b = by_bucket.at(i).second.tracked_stats();
+    nr::Tracked s = single.second.tracked_stats();
+    REQUIRE(b.buckets_probed == s.buckets_probed);
+    REQUIRE(b.tables_probed == s.tables_probed);
+  }
+}
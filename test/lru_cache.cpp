@@ -0,0 +1,77 @@
+#include "catch.hpp"
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../include/lru_cache.hpp"
+
+using namespace nr;
+
+TEST_CASE("lru cache get and put", "lru_cache") {
+  LRUCache<int, std::vector<int>> cache(2);
+  REQUIRE(!cache.get(1));
+  cache.put(1, {1, 2});
+  REQUIRE(cache.get(1).value() == std::vector<int>{1, 2});
+  cache.put(1, {3});
+  REQUIRE(cache.get(1).value() == std::vector<int>{3});
+  REQUIRE(cache.size() == 1);
+}
+
+TEST_CASE("lru cache evicts least recently used", "lru_cache") {
+  LRUCache<std::pair<int, int>, int> cache(2);
+  cache.put({0, 1}, 1);
+  cache.put({0, 2}, 2);
+  // use {0, 1}, so {0, 2} is the least recently used.
+  REQUIRE(cache.get({0, 1}).value() == 1);
+  cache.put({0, 3}, 3);
+  REQUIRE(cache.size() == 2);
+  REQUIRE(!cache.get({0, 2}));
+  REQUIRE(cache.get({0, 1}).value() == 1);
+  REQUIRE(cache.get({0, 3}).value() == 3);
+}
+
+TEST_CASE("lru cache copy and resize", "lru_cache") {
+  LRUCache<int, int> cache(3);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(3, 3);
+  LRUCache<int, int> copy(cache);
+  REQUIRE(copy.size() == 3);
+  REQUIRE(copy.get(2).value() == 2);
+
+  // shrinking keeps the most recently used.
+  cache.resize(1);
+  REQUIRE(cache.size() == 1);
+  REQUIRE(cache.get(3).value() == 3);
+
+  LRUCache<int, int> none(0);
+  none.put(1, 1);
+  REQUIRE(!none.get(1));
+}
+
+TEST_CASE("lru cache shared by threads", "lru_cache") {
+  LRUCache<int, int> cache(8);
+  std::vector<std::thread> threads(0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t] {
+      for (int i = 0; i < 2000; ++i) {
+        const int key = (i + t) % 16;
+        auto found = cache.get(key);
+        if (!found)
+          cache.put(key, 2 * key);
+        else if (found.value() != 2 * key)
+          cache.put(key, -1); // never happens unless entries get mixed up.
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(cache.size() == 8);
+  for (int key = 0; key < 16; ++key) {
+    auto found = cache.get(key);
+    if (found)
+      REQUIRE(found.value() == 2 * key);
+  }
+}
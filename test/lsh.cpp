@@ -168,3 +168,30 @@ TEST_CASE("lsh table contains", "lsh") {
   not_in << .9, .9, .9;
   REQUIRE(!l.contains(not_in));
 }
+
+TEST_CASE("lsh probe ids and lookup", "lsh") {
+  LSH_MultiProbe<Eigen::VectorXf> l(5, 3, 2);
+  std::vector<Eigen::VectorXf> data{Eigen::VectorXf(3), Eigen::VectorXf(3),
+                                    Eigen::VectorXf(3)};
+  data.at(0) << .1, .1, .1;
+  data.at(1) << .2, .3, .1;
+  data.at(2) << .1, .3, .1;
+  l.fill(data);
+
+  for (size_t id = 0; id < data.size(); ++id) {
+    REQUIRE(l.lookup(id) == data.at(id));
+  }
+
+  // searching both buckets must find the query itself.
+  auto out = l.probe_ids(data.at(0), 2);
+  REQUIRE(out.first.size() == 1);
+  REQUIRE(out.first.ids.at(0) == 0);
+  REQUIRE(out.first.scores.at(0) == Approx(0));
+
+  auto k_out = l.k_probe_ids(3, data.at(0), 2);
+  REQUIRE(k_out.first.size() == 3);
+  // distant to nearest.
+  REQUIRE(k_out.first.ids.at(2) == 0);
+  REQUIRE(k_out.first.scores.at(0) >= k_out.first.scores.at(1));
+  REQUIRE(k_out.first.scores.at(1) >= k_out.first.scores.at(2));
+}
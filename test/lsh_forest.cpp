@@ -0,0 +1,79 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <vector>
+
+#include "../include/lsh_forest.hpp"
+
+using namespace nr;
+
+TEST_CASE("lsh forest needs at most 64 bits", "lsh_forest") {
+  REQUIRE_THROWS(LSH_Forest<Eigen::VectorXf>(2, 65, 3));
+  REQUIRE_THROWS(LSH_Forest<Eigen::VectorXf>(2, 0, 3));
+  LSH_Forest<Eigen::VectorXf> forest(3, 64, 3);
+  REQUIRE(forest.num_tables() == 3);
+}
+
+TEST_CASE("lsh forest collects at least adj candidates", "lsh_forest") {
+  LSH_Forest<Eigen::VectorXf> forest(4, 32, 5);
+  std::vector<Eigen::VectorXf> data(100, Eigen::VectorXf(5));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(5);
+  }
+  forest.fill(data);
+
+  for (int64_t adj : {1, 10, 50, 100}) {
+    const auto ctx = forest.context(data.at(3), adj);
+    std::vector<int64_t> ids(0);
+    for (const auto &hashed : ctx.hashes) {
+      ids.insert(ids.end(), hashed.probe_sequence.begin(),
+                 hashed.probe_sequence.end());
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    REQUIRE(ids.size() >= static_cast<size_t>(adj));
+    // the query is an item, so it shares its whole code in every tree.
+    for (const auto &hashed : ctx.hashes) {
+      REQUIRE(std::find(hashed.probe_sequence.begin(),
+                        hashed.probe_sequence.end(),
+                        3) != hashed.probe_sequence.end());
+    }
+  }
+  REQUIRE(forest.contains(data.at(3)));
+}
+
+TEST_CASE("lsh forest k probe over everything is exact", "lsh_forest") {
+  LSH_Forest<Eigen::VectorXf> forest(2, 16, 4);
+  std::vector<Eigen::VectorXf> data(60, Eigen::VectorXf(4));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(4);
+  }
+  forest.fill(data);
+
+  const Eigen::VectorXf q = Eigen::VectorXf::Random(4);
+  std::vector<float> dists(0);
+  for (const auto &x : data) {
+    dists.push_back((q - x).norm());
+  }
+  std::sort(dists.begin(), dists.end());
+
+  auto found = forest.k_probe_ids(5, q, 60);
+  REQUIRE(found.first.size() == 5);
+  // ordered distant to nearest.
+  for (size_t i = 0; i < 5; ++i) {
+    REQUIRE(found.first.scores.at(i) == Approx(dists.at(4 - i)));
+  }
+  REQUIRE(found.second.get_stats() == std::make_tuple(60, 0, 0, 2, 60));
+
+  auto nearest = forest.probe(q, 60);
+  REQUIRE(nearest.first);
+  REQUIRE(nearest.first->first == forest.lookup(nearest.first->second));
+  REQUIRE((q - nearest.first->first).norm() == Approx(dists.at(0)));
+
+  auto approx = forest.k_probe_approx_ids(3, q, dists.at(10), 60);
+  REQUIRE(approx.first.size() == 3);
+  for (float dist : approx.first.scores) {
+    REQUIRE(dist <= dists.at(10));
+  }
+}
@@ -2,6 +2,9 @@
 #include "catch.hpp"
 
 #include <Eigen/Core>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "../include/lsh_multi.hpp"
 
@@ -106,3 +109,113 @@ TEST_CASE("lsh multi table contains", "lsh_multi") {
   not_in << .9, .9, .9;
   REQUIRE(!lsh.contains(not_in));
 }
+
+TEST_CASE("lsh multi k probe ids", "lsh_multi") {
+  // 2 buckets, so the probe sequence covers every bucket.
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 10, 3, 2);
+  auto data(make_data());
+  lsh.fill(data);
+
+  VectorXf query(3);
+  query << .3, -1, .4;
+  auto out = lsh.k_probe_ids(2, query, 2);
+  REQUIRE(out.first.size() == 2);
+  REQUIRE(out.first.ids.size() == out.first.scores.size());
+  // distant to nearest, same as k_probe.
+  REQUIRE(out.first.ids.at(1) == 1);
+  REQUIRE(out.first.ids.at(0) == 2);
+  REQUIRE(out.first.scores.at(1) == Approx(0));
+  REQUIRE(out.first.scores.at(0) == Approx((query - data.at(2)).norm()));
+}
+
+TEST_CASE("lsh multi lookup by id", "lsh_multi") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 10, 3, 10);
+  auto data(make_data());
+  lsh.fill(data);
+
+  for (size_t id = 0; id < data.size(); ++id) {
+    REQUIRE(lsh.lookup(id) == data.at(id));
+  }
+
+  auto out = lsh.probe_ids(data.at(1), 1);
+  REQUIRE(out.first.size() == 1);
+  REQUIRE(lsh.lookup(out.first.ids.at(0)) == data.at(1));
+}
+
+TEST_CASE("lsh multi scores each id once", "lsh_multi") {
+  // 2 buckets, so the probe sequence covers every bucket of both tables.
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 10, 3, 2);
+  auto data(make_data());
+  lsh.fill(data);
+
+  VectorXf query(3);
+  query << .3, -1, .4;
+  auto out = lsh.k_probe_ids(3, query, 2);
+  nr::Tracked t = out.second.tracked_stats();
+  REQUIRE(t.comparisons == data.size());
+  REQUIRE(t.duplicates_skipped == data.size());
+
+  // no id is returned twice.
+  auto approx = lsh.k_probe_approx_ids(10, query, 100, 2);
+  REQUIRE(approx.first.size() == data.size());
+  std::vector<int64_t> ids = approx.first.ids;
+  std::sort(ids.begin(), ids.end());
+  REQUIRE(std::unique(ids.begin(), ids.end()) == ids.end());
+}
+
+TEST_CASE("lsh multi parallel scan matches serial", "lsh_multi") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(8, 10, 3, 8);
+  auto data(make_data());
+  lsh.fill(data);
+
+  VectorXf query(3);
+  query << .3, -1, .4;
+  auto serial = lsh.k_probe_ids(4, query, 2);
+  lsh.set_parallelism(4);
+  auto parallel = lsh.k_probe_ids(4, query, 2);
+  REQUIRE(parallel.first.size() == serial.first.size());
+  // distances are the same. Rows 3 and 4 are equal, so ids tied with the
+  // most distant result can differ; only ids closer than it are compared.
+  REQUIRE(parallel.first.scores == serial.first.scores);
+  auto inside_cutoff = [](const nr::ProbeResult<float> &result) {
+    std::vector<int64_t> ids(0);
+    for (size_t i = 0; i < result.size(); ++i) {
+      if (result.scores.at(i) != result.scores.front())
+        ids.push_back(result.ids.at(i));
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  };
+  REQUIRE(inside_cutoff(parallel.first) == inside_cutoff(serial.first));
+  nr::Tracked t = parallel.second.tracked_stats();
+  REQUIRE(t.tables_probed == 8);
+}
+
+TEST_CASE("lsh multi probes concurrently", "lsh_multi") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(4, 10, 3, 8);
+  auto data(make_data());
+  lsh.fill(data);
+  const nr::LSH_MultiProbe_MultiTable<VectorXf> &index = lsh;
+
+  std::vector<std::vector<int64_t>> expected(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    expected.at(i) = index.k_probe_approx_ids(3, data.at(i), 1, 2).first.ids;
+  }
+  std::vector<int> mismatches(4, 0);
+  std::vector<std::thread> threads(0);
+  for (size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 50; ++round) {
+        for (size_t i = 0; i < data.size(); ++i) {
+          auto found = index.k_probe_approx_ids(3, data.at(i), 1, 2);
+          if (found.first.ids != expected.at(i))
+            ++mismatches.at(t);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(mismatches == std::vector<int>(4, 0));
+}
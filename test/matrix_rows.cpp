@@ -0,0 +1,72 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <vector>
+
+#include "../include/lsh_multi.hpp"
+#include "../include/matrix_rows.hpp"
+#include "../include/nr_multiprobe.hpp"
+
+using namespace Eigen;
+using RowMatrixXf = Matrix<float, Dynamic, Dynamic, RowMajor>;
+
+TEST_CASE("matrix rows views each row", "matrix_rows") {
+  RowMatrixXf data(3, 2);
+  data << 1, 2, 3, 4, 5, 6;
+  auto rows = nr::matrix_rows<VectorXf>(data);
+  REQUIRE(rows.size() == 3);
+  VectorXf second = rows.at(1);
+  REQUIRE(second == Vector2f(3, 4));
+  REQUIRE(rows.at(2).norm() == Approx(Vector2f(5, 6).norm()));
+  REQUIRE_THROWS_AS(rows.at(3), std::out_of_range);
+
+  std::vector<VectorXf> copied(0);
+  for (const auto &row : rows) {
+    copied.push_back(row);
+  }
+  REQUIRE(copied.size() == 3);
+  REQUIRE(copied.at(0) == Vector2f(1, 2));
+
+  REQUIRE_THROWS(nr::matrix_rows<Vector3f>(data));
+}
+
+TEST_CASE("NR multiprobe fills from a row-major matrix", "matrix_rows") {
+  RowMatrixXf data = RowMatrixXf::Random(40, 5);
+  nr::NR_MultiProbe<VectorXf> probe(2, 2, 3, 5, 4);
+  probe.fill(data, false);
+  for (Index i = 0; i < data.rows(); ++i) {
+    REQUIRE(probe.lookup(i).isApprox(data.row(i).transpose()));
+  }
+
+  // a query mapped over a buffer probes the same as a copy of it.
+  std::vector<float> buffer{.3f, -.2f, .9f, .1f, -.5f};
+  Map<const VectorXf> mapped(buffer.data(), buffer.size());
+  const VectorXf copy = mapped;
+  auto from_map = probe.k_probe_ids(5, mapped, 4);
+  auto from_copy = probe.k_probe_ids(5, copy, 4);
+  REQUIRE(from_map.first.ids == from_copy.first.ids);
+  REQUIRE(from_map.first.scores == from_copy.first.scores);
+
+  // probing every bucket finds the best row.
+  Index best = 0;
+  (data * copy).maxCoeff(&best);
+  REQUIRE(from_map.first.ids.back() == best);
+
+  REQUIRE_THROWS(probe.fill(RowMatrixXf::Random(40, 4), false));
+}
+
+TEST_CASE("lsh multi fills from a matrix and takes row queries",
+          "matrix_rows") {
+  // column major too: each row is then a strided view.
+  MatrixXf data = MatrixXf::Random(30, 4);
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(2, 5, 4, 8);
+  lsh.fill(data);
+  for (Index i = 0; i < data.rows(); ++i) {
+    auto found = lsh.probe_ids(data.row(i).transpose(), 1);
+    REQUIRE(found.first.size() == 1);
+    REQUIRE(found.first.scores.front() == Approx(0).margin(1e-5));
+    const auto ctx = lsh.context(data.row(i).transpose(), 1);
+    REQUIRE(ctx.query == VectorXf(data.row(i).transpose()));
+  }
+}
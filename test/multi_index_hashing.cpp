@@ -0,0 +1,89 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../include/multi_index_hashing.hpp"
+#include "../include/popcount.hpp"
+
+using namespace nr;
+
+namespace {
+
+std::vector<size_t>
+brute_distances(const MultiIndexHashing<Eigen::VectorXf> &mih,
+                const std::vector<uint64_t> &code) {
+  std::vector<size_t> dists(0);
+  for (size_t i = 0; i < mih.size(); ++i) {
+    dists.push_back(
+        hamming_distance(code.data(), mih.code(i), mih.words_per_code()));
+  }
+  return dists;
+}
+
+} // namespace
+
+TEST_CASE("multi index hashing needs valid substrings", "mih") {
+  REQUIRE_THROWS(MultiIndexHashing<Eigen::VectorXf>(128, 5, 0));
+  REQUIRE_THROWS(MultiIndexHashing<Eigen::VectorXf>(256, 5, 2));
+  MultiIndexHashing<Eigen::VectorXf> mih(130, 5, 3);
+  REQUIRE(mih.num_substrings() == 3);
+  REQUIRE(mih.words_per_code() == 3);
+}
+
+TEST_CASE("multi index radius search is exact", "mih") {
+  MultiIndexHashing<Eigen::VectorXf> mih(128, 8, 16);
+  std::vector<Eigen::VectorXf> data(200, Eigen::VectorXf(8));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(8);
+  }
+  mih.fill(data);
+
+  const auto code = mih.hash_code(data.at(7));
+  const auto dists = brute_distances(mih, code);
+  for (size_t radius : {0, 5, 20, 40}) {
+    auto found = mih.radius_search(code, radius);
+    std::vector<int64_t> expected(0);
+    for (size_t i = 0; i < dists.size(); ++i) {
+      if (dists.at(i) <= radius)
+        expected.push_back(i);
+    }
+    std::vector<int64_t> ids(0);
+    for (const auto &id_dist : found.first) {
+      REQUIRE(id_dist.second == dists.at(id_dist.first));
+      ids.push_back(id_dist.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    REQUIRE(ids == expected);
+  }
+  // the item itself is at distance 0.
+  REQUIRE(mih.radius_search(code, 0).first.at(0).first == 7);
+}
+
+TEST_CASE("multi index k nearest is exact", "mih") {
+  MultiIndexHashing<Eigen::VectorXf> mih(96, 6, 12);
+  std::vector<Eigen::VectorXf> data(150, Eigen::VectorXf(6));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(6);
+  }
+  mih.fill(data);
+
+  const Eigen::VectorXf q = Eigen::VectorXf::Random(6);
+  const auto code = mih.hash_code(q);
+  auto dists = brute_distances(mih, code);
+  std::sort(dists.begin(), dists.end());
+
+  auto found = mih.k_nearest(10, q);
+  REQUIRE(found.first.size() == 10);
+  for (size_t i = 0; i < 10; ++i) {
+    REQUIRE(found.first.at(i).second == dists.at(i));
+  }
+  REQUIRE(mih.k_nearest(500, code).first.size() == 150);
+
+  auto scored = mih.k_probe_ids(3, q, 20);
+  REQUIRE(scored.first.size() == 3);
+  REQUIRE(std::is_sorted(scored.first.scores.begin(),
+                         scored.first.scores.end()));
+}
@@ -1,5 +1,9 @@
 
+#include <Eigen/Core>
+#include <algorithm>
 #include <cmath>
+#include <thread>
+#include <vector>
 
 #include "../include/nr_gen.hpp"
 #include "catch.hpp"
@@ -25,3 +29,142 @@ TEST_CASE("sets sizes based on probability", "NR-LSH tests") {
 
   REQUIRE(sizes.second > 1);
 }
+
+TEST_CASE("NR multiprobe scores each id once", "NR-LSH tests") {
+  // 2 tables, 2 partitions, 2 buckets. probing 2 buckets scans everything.
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(2, 2, 2, 3, 2);
+  std::vector<Eigen::VectorXf> data(10, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.05 * i, .3;
+  }
+  probe.fill(data, false);
+
+  Eigen::VectorXf query(3);
+  query << 1, 0, 0;
+  // k is large enough that the topk is never full, so nothing is pruned.
+  auto out = probe.k_probe_ids(10, query, 2);
+  nr::Tracked t = out.second.tracked_stats();
+  REQUIRE(t.comparisons == data.size());
+  REQUIRE(t.duplicates_skipped == data.size());
+  REQUIRE(out.first.ids.back() == 9);
+
+  auto approx = probe.k_probe_approx_ids(10, query, -100, 2);
+  REQUIRE(approx.first.size() == data.size());
+  std::vector<int64_t> ids = approx.first.ids;
+  std::sort(ids.begin(), ids.end());
+  REQUIRE(std::unique(ids.begin(), ids.end()) == ids.end());
+}
+
+TEST_CASE("NR multiprobe bucket cap bounds scans", "NR-LSH tests") {
+  // 1 table, 2 partitions, 1 bucket: every partition is one bucket.
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(1, 2, 2, 3, 1);
+  std::vector<Eigen::VectorXf> data(10, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.05 * i, .3;
+  }
+  probe.fill(data, false);
+  probe.set_bucket_cap(2);
+
+  Eigen::VectorXf query(3);
+  query << 1, 0, 0;
+  auto out = probe.k_probe_ids(1, query, 1);
+  nr::Tracked t = out.second.tracked_stats();
+  REQUIRE(t.buckets_probed == 2);
+  REQUIRE(t.comparisons == 4);
+  // the largest norm item is kept, and it has the largest inner product.
+  REQUIRE(out.first.ids.back() == 9);
+}
+
+TEST_CASE("NR multiprobe norm pruning keeps the exact topk", "NR-LSH tests") {
+  // probing every bucket, so the result must be exact even when buckets
+  // are cut short by the norm bound.
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(2, 2, 2, 3, 2);
+  std::vector<Eigen::VectorXf> data(10, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.05 * i, .3;
+  }
+  probe.fill(data, false);
+
+  Eigen::VectorXf query(3);
+  query << 1, 0, 0;
+  auto out = probe.k_probe_ids(3, query, 2);
+  REQUIRE(out.first.ids == std::vector<int64_t>{7, 8, 9});
+  nr::Tracked t = out.second.tracked_stats();
+  REQUIRE(t.comparisons <= data.size());
+}
+
+TEST_CASE("NR multiprobe parallel scan matches serial", "NR-LSH tests") {
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(8, 2, 4, 3, 4);
+  std::vector<Eigen::VectorXf> data(40, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.05 * i, .3 * std::sin(i);
+  }
+  probe.fill(data, false);
+
+  Eigen::VectorXf query(3);
+  query << 1, -.2, .5;
+  auto serial = probe.k_probe_ids(5, query, 2);
+  probe.set_parallelism(3);
+  REQUIRE(probe.get_parallelism() == 3);
+  auto parallel = probe.k_probe_ids(5, query, 2);
+  REQUIRE(parallel.first.ids == serial.first.ids);
+  REQUIRE(parallel.first.scores == serial.first.scores);
+  nr::Tracked t = parallel.second.tracked_stats();
+  REQUIRE(t.tables_probed == 8);
+}
+
+TEST_CASE("NR multiprobe probes concurrently", "NR-LSH tests") {
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(4, 2, 4, 3, 4);
+  std::vector<Eigen::VectorXf> data(40, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.05 * i, .3 * std::sin(i);
+  }
+  probe.fill(data, false);
+  const nr::NR_MultiProbe<Eigen::VectorXf> &index = probe;
+
+  // each query borrows its own visited set, so threads can share the index.
+  std::vector<std::vector<int64_t>> expected(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    expected.at(i) = index.k_probe_approx_ids(5, data.at(i), 0, 4).first.ids;
+  }
+  std::vector<int> mismatches(4, 0);
+  std::vector<std::thread> threads(0);
+  for (size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 20; ++round) {
+        for (size_t i = 0; i < data.size(); ++i) {
+          auto found = index.k_probe_approx_ids(5, data.at(i), 0, 4);
+          if (found.first.ids != expected.at(i))
+            ++mismatches.at(t);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(mismatches == std::vector<int>(4, 0));
+
+  // the tasks of a parallel scan also take their sets per query.
+  probe.set_parallelism(2);
+  std::vector<std::vector<float>> expected_scores(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    expected_scores.at(i) = index.k_probe_ids(5, data.at(i), 4).first.scores;
+  }
+  threads.clear();
+  for (size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 20; ++round) {
+        for (size_t i = 0; i < data.size(); ++i) {
+          auto found = index.k_probe_ids(5, data.at(i), 4);
+          if (found.first.scores != expected_scores.at(i))
+            ++mismatches.at(t);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(mismatches == std::vector<int>(4, 0));
+}
@@ -0,0 +1,106 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../include/nr_multiprobe.hpp"
+#include "../include/numa.hpp"
+#include "../include/thread_pool.hpp"
+
+using namespace Eigen;
+
+TEST_CASE("parse kernel cpu lists", "numa") {
+  REQUIRE(nr::parse_cpu_list("0") == std::vector<int>{0});
+  REQUIRE(nr::parse_cpu_list("0-3,8,10-11") ==
+          std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+  REQUIRE(nr::parse_cpu_list("") == std::vector<int>{});
+  REQUIRE_THROWS_AS(nr::parse_cpu_list("3-1"), std::runtime_error);
+}
+
+TEST_CASE("numa nodes cover the cpus", "numa") {
+  const auto nodes = nr::numa_nodes();
+  REQUIRE(nodes.size() >= 1);
+  for (const auto &cpus : nodes) {
+    REQUIRE(!cpus.empty());
+  }
+  // the calling thread can be pinned to the cpus it may already use.
+  REQUIRE(nr::pin_current_thread(nr::all_cpus()));
+}
+
+TEST_CASE("pinned thread pool runs tasks", "numa") {
+  nr::ThreadPool pool(nr::all_cpus());
+  REQUIRE(pool.size() == nr::all_cpus().size());
+  std::atomic<int> count(0);
+  pool.parallel_for(16, 4, [&](size_t) { ++count; });
+  REQUIRE(count == 16);
+  REQUIRE_THROWS_AS(nr::ThreadPool(std::vector<int>{}), std::runtime_error);
+}
+
+TEST_CASE("numa replicas are built per node", "numa") {
+  std::vector<VectorXf> data(20, VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << std::cos(.5 * i), std::sin(.5 * i), .1 * i;
+  }
+  using Index = nr::NR_MultiProbe<VectorXf>;
+  // pretend there are two nodes sharing the available cpus.
+  const std::vector<std::vector<int>> nodes{nr::all_cpus(), nr::all_cpus()};
+  size_t builds = 0;
+  nr::NumaReplicas<Index> replicas(
+      [&] {
+        ++builds;
+        auto index = std::make_unique<Index>(2, 2, 4, 3, 4);
+        index->fill(data, false);
+        return index;
+      },
+      nodes);
+  REQUIRE(builds == 2);
+  REQUIRE(replicas.num_nodes() == 2);
+  REQUIRE(replicas.current_node() < 2);
+  for (size_t node = 0; node < replicas.num_nodes(); ++node) {
+    REQUIRE(replicas.on_node(node).lookup(3) == data.at(3));
+  }
+  auto found = replicas.local().k_probe_ids(2, data.at(5), 4);
+  REQUIRE(found.first.size() == 2);
+
+  // threads on a node share its replica.
+  std::vector<int> mismatches(4, 0);
+  std::vector<std::thread> threads(0);
+  for (size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (int round = 0; round < 50; ++round) {
+        auto again = replicas.local().k_probe_ids(2, data.at(5), 4);
+        if (again.first.scores != found.first.scores)
+          ++mismatches.at(t);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(mismatches == std::vector<int>(4, 0));
+
+  // a failed build is reported to the caller.
+  auto fails = []() -> std::unique_ptr<Index> {
+    throw std::runtime_error("build failed");
+  };
+  REQUIRE_THROWS_AS(nr::NumaReplicas<Index>(fails), std::runtime_error);
+}
+
+TEST_CASE("parallel scans can use a given pool", "numa") {
+  std::vector<VectorXf> data(20, VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << std::cos(.5 * i), std::sin(.5 * i), .1 * i;
+  }
+  nr::NR_MultiProbe<VectorXf> probe(4, 2, 4, 3, 4);
+  probe.fill(data, false);
+  auto serial = probe.k_probe_ids(3, data.at(2), 2);
+  nr::ThreadPool pool(nr::numa_nodes().at(0));
+  probe.set_thread_pool(pool);
+  probe.set_parallelism(2);
+  auto parallel = probe.k_probe_ids(3, data.at(2), 2);
+  REQUIRE(parallel.first.ids == serial.first.ids);
+}
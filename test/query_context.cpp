@@ -0,0 +1,124 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "../include/lsh_multi.hpp"
+#include "../include/p_stable_lsh.hpp"
+#include "../include/query_context.hpp"
+#include "../include/sign_lsh.hpp"
+#include "../include/simple_lsh.hpp"
+#include "../include/tables.hpp"
+
+using namespace Eigen;
+
+std::vector<VectorXf> context_data() {
+  std::vector<VectorXf> data(10, VectorXf(3));
+  data[0] << .3, .3, .3;
+  data[1] << 0, .2, .9;
+  data[2] << -.3, .3, -.78;
+  data[3] << -.28, -.69, -.45;
+  data[4] << .67, -.42, -.66;
+  data[5] << .45, -.1, .345;
+  data[6] << .2, .21, -.363;
+  data[7] << -.3, -.3, -.324;
+  data[8] << .1, -.78, -.3;
+  data[9] << .5, .9, -.67;
+  return data;
+}
+
+TEST_CASE("hashing in steps matches hash", "query_context") {
+  nr::SignLSH<float> sign(20, 3);
+  nr::SimpleLSH<float> simple(20, 3);
+  nr::PStableLSH<float> p_stable(.5, 3);
+  for (const auto &x : context_data()) {
+    REQUIRE(sign.code(sign.project(x)) == sign.hash(x));
+    REQUIRE(sign.code_max(sign.hash(x), 7) == sign.hash_max(x, 7));
+    // SimpleLSH needs norm <= 1.
+    const VectorXf y = x / 2;
+    REQUIRE(simple.code(simple.project(y)) == simple.hash(y));
+    REQUIRE(simple.code_max(simple.hash(y), 7) == simple.hash_max(y, 7));
+    REQUIRE(p_stable.code(p_stable.project(x)) == p_stable.hash(x));
+    REQUIRE(p_stable.code_max(p_stable.hash(x), 7) == p_stable.hash_max(x, 7));
+  }
+}
+
+TEST_CASE("batch projection matches projecting each query", "query_context") {
+  nr::SignLSH<float> sign(20, 3);
+  nr::SimpleLSH<float> simple(20, 3);
+  nr::PStableLSH<float> p_stable(.5, 3);
+  const auto data = context_data();
+  MatrixXf columns(3, data.size());
+  for (size_t j = 0; j < data.size(); ++j) {
+    columns.col(j) = data.at(j) / 2;
+  }
+  const MatrixXf sign_batch = sign.project_batch(columns);
+  const MatrixXf simple_batch = simple.project_batch(columns);
+  const MatrixXf p_stable_batch = p_stable.project_batch(columns);
+  for (size_t j = 0; j < data.size(); ++j) {
+    const VectorXf x = columns.col(j);
+    REQUIRE(sign_batch.col(j).isApprox(sign.project(x)));
+    REQUIRE(simple_batch.col(j).isApprox(simple.project(x)));
+    REQUIRE(p_stable_batch(0, j) == Approx(p_stable.project(x)(0)));
+  }
+
+  auto hashed = nr::hash_queries<VectorXf>(sign, columns, 16);
+  REQUIRE(hashed.size() == data.size());
+  for (size_t j = 0; j < data.size(); ++j) {
+    const VectorXf x = columns.col(j);
+    REQUIRE(hashed.at(j).code == sign.hash(x));
+    REQUIRE(hashed.at(j).bucket == sign.hash_max(x, 16));
+  }
+}
+
+TEST_CASE("context normalizes the query", "query_context") {
+  VectorXf q(3);
+  q << 3, 0, 4;
+  nr::QueryContext<VectorXf> ctx(q);
+  REQUIRE(ctx.query == q);
+  REQUIRE(ctx.norm == Approx(5));
+  REQUIRE(ctx.normalized().norm() == Approx(1));
+  REQUIRE(ctx.hashes.size() == 0);
+
+  nr::SignLSH<float> sign(8, 3);
+  auto hashed = nr::hash_query(sign, q, 16);
+  REQUIRE(hashed.code == sign.hash(q));
+  REQUIRE(hashed.bucket == sign.hash_max(q, 16));
+}
+
+TEST_CASE("tables probe with a context", "query_context") {
+  nr::Tables<VectorXf> tables(2, 4, 3, 16);
+  auto data = context_data();
+  tables.fill(data, false);
+
+  VectorXf q(3);
+  q << .1, .2, .9;
+  auto ctx = tables.context(q, 4);
+  REQUIRE(ctx.hashes.size() == 1);
+  REQUIRE(ctx.hashes.at(0).probe_sequence.size() == 4);
+  REQUIRE(ctx.hashes.at(0).probe_sequence == tables.rank_around_query(q, 4));
+
+  // probing with the context is the same as probing with the query.
+  auto with_ctx = tables.probe_ids(ctx);
+  auto with_q = tables.probe_ids(q, 4);
+  REQUIRE(with_ctx.first.ids == with_q.first.ids);
+  REQUIRE(with_ctx.first.scores == with_q.first.scores);
+
+  // the same context can be used again.
+  auto approx_ctx = tables.k_probe_approx_ids(3, ctx, 0);
+  auto approx_q = tables.k_probe_approx_ids(3, q, 0, 4);
+  REQUIRE(approx_ctx.first.ids == approx_q.first.ids);
+}
+
+TEST_CASE("lsh multi table probe with a context", "query_context") {
+  nr::LSH_MultiProbe_MultiTable<VectorXf> lsh(3, 10, 3, 10);
+  auto data = context_data();
+  lsh.fill(data);
+
+  auto ctx = lsh.context(data.at(4), 2);
+  REQUIRE(ctx.hashes.size() == 3);
+  auto with_ctx = lsh.k_probe_ids(3, ctx);
+  auto with_q = lsh.k_probe_ids(3, data.at(4), 2);
+  REQUIRE(with_ctx.first.ids == with_q.first.ids);
+  REQUIRE(lsh.probe_ids(ctx).first.ids.at(0) == 4);
+}
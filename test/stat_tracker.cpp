@@ -89,3 +89,15 @@ TEST_CASE("add StatTrackers", "stat_tracker") {
   s1 += s2;
   REQUIRE(get_comps(s1) == 8);
 }
+
+TEST_CASE("track duplicates skipped", "stat_tracker") {
+  StatTracker s1;
+  StatTracker s2;
+  s1.incr_duplicates_skipped();
+  s2.incr_duplicates_skipped();
+  s2.incr_duplicates_skipped();
+  s1 += s2;
+  REQUIRE(std::get<4>(s1.get_stats()) == 3);
+  REQUIRE(s1.tracked_stats().duplicates_skipped == 3);
+  REQUIRE(s1.tracked_stats().comparisons == 0);
+}
@@ -1,11 +1,15 @@
 
 #include "catch.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <list>
+#include <numeric>
+#include <random>
 #include <utility>
 #include <vector>
 
+#include "../include/stats/quantile_sketch.hpp"
 #include "../include/stats/stats.hpp"
 //#include "../include/nr_lsh.hpp"
 
@@ -351,3 +355,21 @@ TEST_CASE("lower median = upper median with odd # of elements", "stats") {
   std::vector<int> c{5, 4, -9, 1, 2, 3, 11, 10, 22, 15, -1, 23, 99, 50, 51};
   CHECK(nr::stats::lower_median(c) == nr::stats::upper_median(c));
 }
+
+TEST_CASE("quantile sketch", "stats") {
+  nr::stats::QuantileSketch<double> sketch(64);
+  REQUIRE_THROWS(sketch.quantile(.5));
+  std::vector<double> items(10000);
+  std::iota(items.begin(), items.end(), 0);
+  std::shuffle(items.begin(), items.end(), std::mt19937(3));
+  for (double x : items) {
+    sketch.insert(x);
+  }
+  REQUIRE(sketch.size() == 10000);
+  REQUIRE(sketch.quantile(0) == 0);
+  REQUIRE(sketch.quantile(1) == 9999);
+  // rank error is a few percent with 64 items per level.
+  for (double q : {.1, .25, .5, .75, .9}) {
+    REQUIRE(sketch.quantile(q) == Approx(q * 10000).margin(500));
+  }
+}
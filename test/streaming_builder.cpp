@@ -0,0 +1,181 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "../include/mapped_file.hpp"
+#include "../include/nr_multiprobe.hpp"
+#include "../include/streaming_builder.hpp"
+#include "../include/tables.hpp"
+
+using namespace Eigen;
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string scratch_dir() {
+  const fs::path dir = fs::temp_directory_path() / "nr_streaming_builder";
+  fs::create_directories(dir);
+  return dir.string();
+}
+
+std::vector<VectorXf> write_rows(const std::string &path, size_t n,
+                                 int64_t dim) {
+  // n random rows, stored as raw floats one row after another.
+  std::vector<VectorXf> data(n, VectorXf(dim));
+  std::ofstream file(path, std::ios::binary);
+  for (size_t i = 0; i < n; ++i) {
+    data.at(i) = VectorXf::Random(dim) * (1 + i % 7);
+    file.write(reinterpret_cast<const char *>(data.at(i).data()),
+               dim * sizeof(float));
+  }
+  return data;
+}
+
+size_t spill_dirs(const std::string &dir) {
+  // directories left behind by spills in dir.
+  size_t count = 0;
+  for (const auto &entry : fs::directory_iterator(dir)) {
+    if (entry.path().filename().string().rfind("nr_spill_", 0) == 0)
+      ++count;
+  }
+  return count;
+}
+
+} // namespace
+
+TEST_CASE("mapped rows view a raw file", "streaming_builder") {
+  const std::string path = scratch_dir() + "/rows.bin";
+  const auto data = write_rows(path, 10, 3);
+  nr::MappedRows<VectorXf> rows(nr::MappedFile(path), 3);
+  REQUIRE(rows.size() == 10);
+  REQUIRE(rows.dimension() == 3);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(VectorXf(rows.at(i)) == data.at(i));
+  }
+  REQUIRE_THROWS_AS(rows.at(10), std::out_of_range);
+  REQUIRE(VectorXf(rows.matrix().row(4).transpose()) == data.at(4));
+  rows.release(0, rows.size());
+  REQUIRE(VectorXf(rows.at(9)) == data.at(9));
+
+  REQUIRE_THROWS(nr::MappedRows<Vector4f>(nr::MappedFile(path), 3));
+  REQUIRE_THROWS(nr::MappedFile(scratch_dir() + "/missing.bin"));
+}
+
+TEST_CASE("norm boundaries split the rows evenly", "streaming_builder") {
+  const std::string path = scratch_dir() + "/norms.bin";
+  const auto data = write_rows(path, 400, 4);
+  nr::MappedRows<VectorXf> rows(nr::MappedFile(path), 4);
+  auto boundaries = nr::StreamingBuilder::norm_boundaries(rows, 4, 64);
+  REQUIRE(boundaries.size() == 4);
+  REQUIRE(std::is_sorted(boundaries.begin(), boundaries.end()));
+
+  float max_norm = 0;
+  std::vector<size_t> counts(4, 0);
+  for (const auto &x : data) {
+    max_norm = std::max(max_norm, x.norm());
+    ++counts.at(nr::StreamingBuilder::partition_of(x.norm(), boundaries));
+  }
+  REQUIRE(boundaries.back() == max_norm);
+  for (size_t count : counts) {
+    REQUIRE(count > 50);
+    REQUIRE(count < 150);
+  }
+}
+
+TEST_CASE("tables fill from a stream", "streaming_builder") {
+  const std::string dir = scratch_dir();
+  const std::string path = dir + "/tables.bin";
+  const auto data = write_rows(path, 60, 4);
+  nr::MappedRows<VectorXf> rows(nr::MappedFile(path), 4);
+
+  nr::Tables<VectorXf> tables(3, 4, 4, 8);
+  tables.fill_streaming(rows, dir, false, 16);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(tables.lookup(i).isApprox(data.at(i)));
+  }
+  // the bucket files and their directory are gone once loaded.
+  REQUIRE(spill_dirs(dir) == 0);
+
+  VectorXf q = VectorXf::Random(4);
+  int64_t best = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (q.dot(data.at(i)) > q.dot(data.at(best)))
+      best = i;
+  }
+  REQUIRE(tables.probe_ids(q, 8).first.ids.at(0) == best);
+}
+
+TEST_CASE("NR multiprobe fills from a stream", "streaming_builder") {
+  const std::string dir = scratch_dir();
+  const std::string path = dir + "/nr.bin";
+  const auto data = write_rows(path, 50, 5);
+  nr::MappedRows<VectorXf> rows(nr::MappedFile(path), 5);
+
+  nr::NR_MultiProbe<VectorXf> streamed(2, 3, 4, 5, 8);
+  streamed.fill_streaming(rows, dir, false, 7);
+  nr::MappedRows<VectorXf> narrow(nr::MappedFile(path), 4);
+  REQUIRE_THROWS(streamed.fill_streaming(narrow, dir, false, 7));
+
+  VectorXf q = VectorXf::Random(5);
+  std::vector<int64_t> order(data.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int64_t x, int64_t y) {
+    return q.dot(data.at(x)) > q.dot(data.at(y));
+  });
+  auto found = streamed.k_probe_ids(4, q, 8).first.ids;
+  std::reverse(found.begin(), found.end());
+  REQUIRE(found == std::vector<int64_t>(order.begin(), order.begin() + 4));
+}
+
+TEST_CASE("spill files are unique and cleaned up", "streaming_builder") {
+  const std::string dir = scratch_dir();
+  std::string kept;
+  try {
+    nr::SpillFiles first(dir, 2);
+    nr::SpillFiles second(dir, 2);
+    // builds sharing dir write to different files.
+    REQUIRE(first.dir() != second.dir());
+    REQUIRE(first.path(0) != second.path(0));
+    std::ofstream(first.path(1)) << "partial";
+    kept = first.path(1);
+    throw std::runtime_error("build failed");
+  } catch (const std::runtime_error &) {
+  }
+  REQUIRE_FALSE(fs::exists(kept));
+  REQUIRE(spill_dirs(dir) == 0);
+}
+
+TEST_CASE("streaming fill follows the partitioning", "streaming_builder") {
+  const std::string dir = scratch_dir();
+  const std::string path = dir + "/log_norm.bin";
+  const auto data = write_rows(path, 80, 4);
+  nr::MappedRows<VectorXf> rows(nr::MappedFile(path), 4);
+
+  nr::Tables<VectorXf> tables(3, 4, 4, 8);
+  tables.set_partitioning(nr::Partitioning::LogNorm);
+  const auto boundaries = tables.streaming_boundaries(rows, 16);
+  std::vector<float> norms(0);
+  for (const auto &x : data) {
+    norms.push_back(x.norm());
+  }
+  // the same ranges as an in memory build.
+  const auto parts = nr::IndexBuilder::log_norm_partitions(norms, 3);
+  for (size_t p = 0; p < parts.size(); ++p) {
+    for (const int64_t id : parts.at(p)) {
+      REQUIRE(nr::StreamingBuilder::partition_of(norms.at(id), boundaries) ==
+              p);
+    }
+  }
+
+  tables.fill_streaming(rows, dir, false, 16);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(tables.lookup(i).isApprox(data.at(i)));
+  }
+  REQUIRE_THROWS(tables.fill_streaming(rows, {1, 2}, dir, false, 16));
+}
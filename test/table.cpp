@@ -2,6 +2,7 @@
 #include "catch.hpp"
 
 #include <Eigen/Core>
+#include <algorithm>
 
 #include "../include/table.hpp"
 
@@ -98,3 +99,59 @@ TEST_CASE("Test table ranking", "table") {
 
   REQUIRE(t.probe_ranking(2, 3) == std::vector<int64_t>{2, 0, 1});
 }
+
+TEST_CASE("Table bucket cap scans the highest norms", "table") {
+  nr::SimpleLSH<float> hash(3, 2);
+  nr::Table<Eigen::VectorXf> t(hash, 2);
+  std::vector<Eigen::VectorXf> partition(5, Eigen::VectorXf(2));
+  partition[0] << .1, 0;
+  partition[1] << .5, 0;
+  partition[2] << .2, 0;
+  partition[3] << .4, 0;
+  partition[4] << .3, 0;
+  // everything in bucket 0.
+  std::vector<int64_t> indices{0, 0, 0, 0, 0};
+  std::vector<int64_t> ids{0, 1, 2, 3, 4};
+  t.fill(partition, indices, ids, 1, true);
+
+  t.set_bucket_cap(2);
+  REQUIRE(t.scan_limit(0) == 2);
+  REQUIRE(t.scan_limit(1) == 0);
+
+  Eigen::VectorXf q(2);
+  q << 1, 0;
+  auto found = t.look_in_until_ids(0, q, -1, 10);
+  REQUIRE(found.first.ids == std::vector<int64_t>{1, 3});
+  REQUIRE(std::get<0>(found.second.get_stats()) == 2);
+  // items past the cap are still stored.
+  REQUIRE(t.lookup(0) == partition[0]);
+
+  t.set_bucket_cap(0);
+  REQUIRE(t.look_in_until_ids(0, q, -1, 10).first.size() == 5);
+}
+
+TEST_CASE("Table buckets are sorted by norm", "table") {
+  nr::SimpleLSH<float> hash(3, 2);
+  nr::Table<Eigen::VectorXf> t(hash, 2);
+  std::vector<Eigen::VectorXf> partition(4, Eigen::VectorXf(2));
+  partition[0] << .1, 0;
+  partition[1] << .5, 0;
+  partition[2] << .2, 0;
+  partition[3] << .4, 0;
+  std::vector<int64_t> indices{0, 0, 0, 0};
+  std::vector<int64_t> ids{0, 1, 2, 3};
+  t.fill(partition, indices, ids, 1, true);
+
+  REQUIRE(t.max_norm(0) == Approx(.5));
+  REQUIRE(t.max_norm(1) == 0);
+  const auto &norms = t.bucket_norms(0);
+  REQUIRE(std::is_sorted(norms.rbegin(), norms.rend()));
+  REQUIRE(t.at(0).front().second == 1);
+
+  // only .5 and .4 can have an inner product above .3 with q.
+  Eigen::VectorXf q(2);
+  q << 1, 0;
+  auto found = t.look_in_until_ids(0, q, .3, 10);
+  REQUIRE(found.first.ids == std::vector<int64_t>{1, 3});
+  REQUIRE(std::get<0>(found.second.get_stats()) == 2);
+}
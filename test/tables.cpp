@@ -1,9 +1,13 @@
 
 #include "catch.hpp"
 
+#include "../include/nr_multiprobe.hpp"
+#include "../include/p_stable_lsh.hpp"
+#include "../include/sign_lsh.hpp"
 #include "../include/tables.hpp"
 
 #include <Eigen/Core>
+#include <algorithm>
 
 TEST_CASE("sub tables rankings", "tables") {
   // 2 partitions, 2 bits, 3 dim, 2 buckets.
@@ -56,3 +60,369 @@ TEST_CASE("tables contains", "tables") {
     REQUIRE(tables.contains(datum));
   }
 }
+
+TEST_CASE("tables probe ids", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(2, 2, 3, 2);
+
+  std::vector<Eigen::VectorXf> data(10, Eigen::VectorXf(3));
+  data[0] << .3, .3, .3;
+  data[1] << 0, .2, .9;
+  data[2] << -.3, .3, -.78;
+  data[3] << -.28, -.69, -.45;
+  data[4] << .67, -.42, -.66;
+  data[5] << .45, -.1, .345;
+  data[6] << .2, .21, -.363;
+  data[7] << -.3, -.3, -.324;
+  data[8] << .1, -.78, -.3;
+  data[9] << .5, .9, -.67;
+
+  tables.fill(data, false);
+
+  for (size_t id = 0; id < data.size(); ++id) {
+    REQUIRE(tables.lookup(id).isApprox(data.at(id)));
+  }
+
+  // probing every bucket is exact MIPS.
+  Eigen::VectorXf query(3);
+  query << .1, .2, .9;
+  auto found = tables.probe_ids(query, 2);
+  REQUIRE(found.first.size() == 1);
+  REQUIRE(found.first.ids.at(0) == 1);
+  REQUIRE(found.first.scores.at(0) == Approx(query.dot(data.at(1))));
+
+  auto approx = tables.k_probe_approx_ids(3, query, 0, 2);
+  REQUIRE(approx.first.size() == 3);
+  for (size_t i = 0; i < approx.first.size(); ++i) {
+    const int64_t id = approx.first.ids.at(i);
+    REQUIRE(approx.first.scores.at(i) > 0);
+    REQUIRE(approx.first.scores.at(i) == Approx(query.dot(data.at(id))));
+  }
+}
+
+TEST_CASE("partitions share one ranking", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(3, 4, 3, 16);
+
+  std::vector<Eigen::VectorXf> data(12, Eigen::VectorXf(3));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) << .1 * i, -.2, .05 * i;
+  }
+  tables.fill(data, false);
+
+  for (int64_t idx = 0; idx < 16; ++idx) {
+    std::vector<int64_t> shared = tables.shared_ranking(idx, 5);
+    // cached rankings are the same as recomputing them.
+    REQUIRE(tables.shared_ranking(idx, 5) == shared);
+    for (size_t t = 0; t < tables.size(); ++t) {
+      REQUIRE(tables.at(t).probe_ranking(idx, 5) == shared);
+    }
+  }
+}
+
+TEST_CASE("cached rankings are shared, not copied", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(2, 4, 3, 16);
+  std::vector<Eigen::VectorXf> data(12, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+
+  const nr::ProbeSequence first = tables.shared_ranking(3, 5);
+  REQUIRE(tables.shared_ranking(3, 5).shares_with(first));
+  // a query in the same bucket probes the cached ranking itself.
+  const auto ctx = tables.context(data.at(0), 5);
+  const int64_t bucket = ctx.hashes.at(0).bucket;
+  REQUIRE(ctx.hashes.at(0).probe_sequence.shares_with(
+      tables.shared_ranking(bucket, 5)));
+
+  // appending to a shared ranking copies it first.
+  nr::ProbeSequence grown = first;
+  grown.push_back(99);
+  REQUIRE(!grown.shares_with(first));
+  REQUIRE(first.size() == 5);
+  REQUIRE(grown.size() == 6);
+}
+
+TEST_CASE("queries are hashed by their direction", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(2, 4, 3, 16);
+  std::vector<Eigen::VectorXf> data(12, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+
+  // q is hashed as [q / ||q||; 0], so any positive multiple of q, including
+  // ones with ||q|| > 1, probes the same buckets in the same order.
+  for (int i = 0; i < 20; ++i) {
+    Eigen::VectorXf q = Eigen::VectorXf::Random(3);
+    q *= .3 / q.norm();
+    const auto ctx = tables.context(q, 6);
+    for (float scale : {.1f, 1.f, 3.f, 50.f}) {
+      const auto scaled = tables.context(Eigen::VectorXf(scale * q), 6);
+      REQUIRE(scaled.hashes.at(0).bucket == ctx.hashes.at(0).bucket);
+      REQUIRE(scaled.hashes.at(0).probe_sequence ==
+              ctx.hashes.at(0).probe_sequence);
+    }
+  }
+}
+
+TEST_CASE("tables with a sign hash", "tables") {
+  nr::Tables<Eigen::VectorXf, nr::SignLSH<float>> tables(
+      2, 4, 3, 16, nr::Addressing::LowBits);
+
+  std::vector<Eigen::VectorXf> data(20, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(tables.lookup(i).isApprox(data.at(i)));
+  }
+
+  // the default bucket_sim ranks the query's own bucket first.
+  REQUIRE(tables.shared_ranking(5, 3).front() == 5);
+
+  // probing every bucket finds the largest inner product.
+  Eigen::VectorXf q(3);
+  q << .2, -.7, .4;
+  int64_t best = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (q.dot(data.at(i)) > q.dot(data.at(best)))
+      best = i;
+  }
+  REQUIRE(tables.probe_ids(q, 16).first.ids.at(0) == best);
+}
+
+TEST_CASE("tables rank p-stable buckets by distance", "tables") {
+  nr::PStableLSH<float> hash(.5, 3);
+  nr::Tables<Eigen::VectorXf, nr::PStableLSH<float>> tables(2, hash, 8);
+
+  std::vector<Eigen::VectorXf> data(10, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+
+  // neighbouring slots come right after the query's own.
+  std::vector<int64_t> rank = tables.shared_ranking(3, 3);
+  REQUIRE(rank.size() == 3);
+  REQUIRE(rank.front() == 3);
+  std::sort(rank.begin() + 1, rank.end());
+  REQUIRE(rank.at(1) == 2);
+  REQUIRE(rank.at(2) == 4);
+}
+
+TEST_CASE("NR multiprobe with one hash per table", "tables") {
+  std::vector<nr::PStableLSH<float>> hashes{nr::PStableLSH<float>(.5, 4),
+                                            nr::PStableLSH<float>(.5, 4)};
+  nr::NR_MultiProbe<Eigen::VectorXf, nr::PStableLSH<float>> probe(2, hashes,
+                                                                  4);
+  REQUIRE(probe.num_tables() == 2);
+
+  std::vector<Eigen::VectorXf> data(30, Eigen::VectorXf(4));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(4);
+  }
+  probe.fill(data, false);
+
+  Eigen::VectorXf q = Eigen::VectorXf::Random(4);
+  std::vector<int64_t> order(data.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int64_t x, int64_t y) {
+    return q.dot(data.at(x)) > q.dot(data.at(y));
+  });
+
+  // every bucket is probed, so the top 3 are exact.
+  auto found = probe.k_probe_ids(3, q, 4).first.ids;
+  std::reverse(found.begin(), found.end());
+  REQUIRE(found == std::vector<int64_t>(order.begin(), order.begin() + 3));
+}
+
+TEST_CASE("tables move without copying the data", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(2, 4, 3, 16);
+  std::vector<Eigen::VectorXf> data(12, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+  const float *stored = tables.lookup(4).data();
+
+  nr::Tables<Eigen::VectorXf> moved(std::move(tables));
+  REQUIRE(moved.lookup(4).data() == stored);
+  nr::Tables<Eigen::VectorXf> assigned(1, 4, 3, 16);
+  assigned = std::move(moved);
+  REQUIRE(assigned.size() == 2);
+  REQUIRE(assigned.lookup(4).data() == stored);
+  REQUIRE(assigned.lookup(4).isApprox(data.at(4)));
+
+  // a copy owns its own vectors.
+  nr::Tables<Eigen::VectorXf> copied(assigned);
+  REQUIRE(copied.lookup(4).data() != stored);
+  REQUIRE(copied.lookup(4) == assigned.lookup(4));
+}
+
+TEST_CASE("table fill moves the partition in", "tables") {
+  nr::SimpleLSH<float> hash(3, 3);
+  nr::Table<Eigen::VectorXf> t(hash, 2);
+  std::vector<Eigen::VectorXf> partition(2, Eigen::VectorXf(3));
+  partition[0] << .3, .3, .3;
+  partition[1] << 0, 0, 1;
+  const float *first = partition[0].data();
+
+  t.fill(std::move(partition), {0, 1}, {7, 8}, 2, false);
+  REQUIRE(t.lookup(7).data() == first);
+  REQUIRE(t.lookup(7) == Eigen::Vector3f(.6, .6, .6));
+}
+
+TEST_CASE("NR multiprobe with log norm partitions", "tables") {
+  std::vector<Eigen::VectorXf> data(40, Eigen::VectorXf(4));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data.at(i) = Eigen::VectorXf::Random(4) * (1 + i % 5);
+  }
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(2, 3, 4, 4, 8);
+  probe.set_partitioning(nr::Partitioning::LogNorm, true);
+  probe.fill(data, false);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(probe.lookup(i).isApprox(data.at(i)));
+  }
+
+  Eigen::VectorXf q = Eigen::VectorXf::Random(4);
+  int64_t best = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (q.dot(data.at(i)) > q.dot(data.at(best)))
+      best = i;
+  }
+  REQUIRE(probe.k_probe_ids(1, q, 8).first.ids.at(0) == best);
+}
+
+TEST_CASE("table buckets share lists when resized", "tables") {
+  nr::SimpleLSH<float> hash(3, 3);
+  nr::Table<Eigen::VectorXf> t(hash, 8);
+  REQUIRE_THROWS(t.resize_buckets(3));
+  REQUIRE_THROWS(t.resize_buckets(16));
+  t.resize_buckets(2);
+  REQUIRE(t.size() == 8);
+  REQUIRE(t.num_slots() == 2);
+
+  std::vector<Eigen::VectorXf> partition(3, Eigen::VectorXf(3));
+  partition[0] << .3, .3, .3;
+  partition[1] << 0, 0, 1;
+  partition[2] << .1, 0, 0;
+  t.fill(std::move(partition), {1, 3, 6}, {7, 8, 9}, 1, false);
+  // buckets 1 and 3 agree on their low bit.
+  REQUIRE(&t.at(1) == &t.at(3));
+  REQUIRE(t.at(3).size() == 2);
+  REQUIRE(t.scan_limit(6) == 1);
+  REQUIRE(t.max_norm(1) == Approx(1));
+  REQUIRE(t.lookup(9) == Eigen::Vector3f(.1, 0, 0));
+}
+
+TEST_CASE("shared lists are scanned once per query", "tables") {
+  nr::SimpleLSH<float> hash(3, 3);
+  nr::Table<Eigen::VectorXf> t(hash, 8);
+  t.resize_buckets(2);
+  std::vector<Eigen::VectorXf> partition(3, Eigen::VectorXf(3));
+  partition[0] << .3, .3, .3;
+  partition[1] << 0, 0, 1;
+  partition[2] << .1, 0, 0;
+  t.fill(std::move(partition), {1, 3, 6}, {7, 8, 9}, 1, false);
+  REQUIRE(t.list_of(1) == t.list_of(3));
+  Eigen::VectorXf q(3);
+  q << -1, -1, -1;
+
+  // buckets 1 and 3 share a list, so probing both scans it once.
+  nr::VisitedSet visited(10);
+  nr::Tracked ranked =
+      t.probe_ranked_ids(q, {1, 3}, visited).second.tracked_stats();
+  REQUIRE(ranked.comparisons == 2);
+  REQUIRE(ranked.duplicates_skipped == 0);
+
+  visited.clear();
+  nr::Tracked first = t.look_in_until_ids(1, q, -10, 5, visited)
+                          .second.tracked_stats();
+  nr::Tracked second = t.look_in_until_ids(3, q, -10, 5, visited)
+                           .second.tracked_stats();
+  REQUIRE(first.comparisons == 2);
+  REQUIRE(second.comparisons == 0);
+  REQUIRE(second.duplicates_skipped == 0);
+
+  // the cap is per list, so buckets sharing a list share it.
+  t.set_bucket_cap(1);
+  visited.clear();
+  nr::Tracked capped =
+      t.probe_ranked_ids(q, {1, 3}, visited).second.tracked_stats();
+  REQUIRE(capped.comparisons == 1);
+  REQUIRE(t.scan_limit(3) == 1);
+}
+
+TEST_CASE("NR multiprobe batches score shared lists once", "tables") {
+  std::vector<Eigen::VectorXf> data(24, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(2, 2, 4, 3, 16);
+  probe.set_bucket_occupancy(4);
+  probe.fill(data, false);
+
+  // probing every bucket is exhaustive, and every id is offered once per
+  // probe table even though its list holds several of the buckets.
+  std::vector<Eigen::VectorXf> qs(3, Eigen::VectorXf(3));
+  for (auto &q : qs) {
+    q = Eigen::VectorXf::Random(3);
+  }
+  auto by_bucket = probe.k_probe_ids_by_bucket(2, qs, 16);
+  for (size_t j = 0; j < qs.size(); ++j) {
+    const auto serial = probe.k_probe_ids(2, qs.at(j), 16);
+    REQUIRE(by_bucket.at(j).first.scores == serial.first.scores);
+    nr::Tracked t = by_bucket.at(j).second.tracked_stats();
+    REQUIRE(t.comparisons == 2 * data.size());
+  }
+}
+
+TEST_CASE("tables size partitions for an occupancy", "tables") {
+  nr::Tables<Eigen::VectorXf> tables(2, 4, 3, 16);
+  REQUIRE_THROWS(tables.set_bucket_occupancy(-1));
+  tables.set_bucket_occupancy(2);
+  std::vector<Eigen::VectorXf> data(12, Eigen::VectorXf(3));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(3);
+  }
+  tables.fill(data, false);
+  // 6 items per partition at 2 per list.
+  for (size_t p = 0; p < tables.size(); ++p) {
+    REQUIRE(tables.at(p).num_slots() == 4);
+    REQUIRE(tables.at(p).size() == 16);
+  }
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(tables.lookup(i).isApprox(data.at(i)));
+  }
+
+  // probing every bucket is still exhaustive.
+  Eigen::VectorXf q = Eigen::VectorXf::Random(3);
+  int64_t best = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (q.dot(data.at(i)) > q.dot(data.at(best)))
+      best = i;
+  }
+  REQUIRE(tables.probe_ids(q, 16).first.ids.at(0) == best);
+}
+
+TEST_CASE("NR multiprobe with sized partitions", "tables") {
+  std::vector<Eigen::VectorXf> data(40, Eigen::VectorXf(4));
+  for (auto &x : data) {
+    x = Eigen::VectorXf::Random(4);
+  }
+  nr::NR_MultiProbe<Eigen::VectorXf> probe(2, 3, 4, 4, 16);
+  probe.set_bucket_occupancy(4);
+  probe.fill(data, false);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(probe.lookup(i).isApprox(data.at(i)));
+  }
+
+  Eigen::VectorXf q = Eigen::VectorXf::Random(4);
+  int64_t best = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (q.dot(data.at(i)) > q.dot(data.at(best)))
+      best = i;
+  }
+  REQUIRE(probe.k_probe_ids(1, q, 16).first.ids.at(0) == best);
+}
@@ -0,0 +1,67 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/thread_pool.hpp"
+#include "catch.hpp"
+
+TEST_CASE("thread pool runs every index once", "thread_pool") {
+  nr::ThreadPool pool(4);
+  REQUIRE(pool.size() == 4);
+  std::vector<std::atomic<int>> counts(100);
+  for (auto &count : counts) {
+    count = 0;
+  }
+  pool.parallel_for(counts.size(), 4, [&](size_t i) { ++counts.at(i); });
+  for (const auto &count : counts) {
+    REQUIRE(count == 1);
+  }
+}
+
+TEST_CASE("thread pool is reused across calls", "thread_pool") {
+  nr::ThreadPool pool(2);
+  std::atomic<size_t> total(0);
+  for (size_t call = 0; call < 50; ++call) {
+    pool.parallel_for(10, 3, [&](size_t i) { total += i; });
+  }
+  REQUIRE(total == 50 * 45);
+}
+
+TEST_CASE("thread pool caps parallelism", "thread_pool") {
+  nr::ThreadPool pool(4);
+  std::atomic<int> running(0);
+  std::atomic<int> most(0);
+  pool.parallel_for(64, 2, [&](size_t) {
+    const int now = ++running;
+    int seen = most;
+    while (now > seen && !most.compare_exchange_weak(seen, now)) {
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    --running;
+  });
+  REQUIRE(most <= 2);
+}
+
+TEST_CASE("thread pool rethrows task exceptions", "thread_pool") {
+  nr::ThreadPool pool(2);
+  auto throws = [](size_t i) {
+    if (i == 3)
+      throw std::runtime_error("task failed");
+  };
+  REQUIRE_THROWS_AS(pool.parallel_for(8, 2, throws), std::runtime_error);
+  // the pool still works after a task threw.
+  std::atomic<int> count(0);
+  pool.parallel_for(8, 2, [&](size_t) { ++count; });
+  REQUIRE(count == 8);
+}
+
+TEST_CASE("thread pool submit runs tasks", "thread_pool") {
+  std::atomic<int> count(0);
+  {
+    nr::ThreadPool pool(3);
+    for (int i = 0; i < 20; ++i) {
+      pool.submit([&count] { ++count; });
+    }
+  } // the destructor finishes queued tasks before joining.
+  REQUIRE(count == 20);
+}
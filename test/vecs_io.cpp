@@ -0,0 +1,158 @@
+#include "catch.hpp"
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../include/nr_multiprobe.hpp"
+#include "../include/vecs_io.hpp"
+
+using namespace Eigen;
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string scratch_path(const std::string &name) {
+  const fs::path dir = fs::temp_directory_path() / "nr_vecs_io";
+  fs::create_directories(dir);
+  return (dir / name).string();
+}
+
+std::vector<VectorXf> random_rows(size_t n, int64_t dim) {
+  std::vector<VectorXf> rows(n, VectorXf(dim));
+  for (auto &x : rows) {
+    x = VectorXf::Random(dim);
+  }
+  return rows;
+}
+
+} // namespace
+
+TEST_CASE("fvecs round trip", "vecs_io") {
+  const std::string path = scratch_path("data.fvecs");
+  const auto data = random_rows(9, 5);
+  nr::write_fvecs(path, data);
+  REQUIRE(fs::file_size(path) == 9 * (4 + 5 * sizeof(float)));
+
+  auto rows = nr::read_fvecs(path);
+  REQUIRE(rows.size() == 9);
+  REQUIRE(rows.dimension() == 5);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(VectorXf(rows.at(i)) == data.at(i));
+  }
+  // the whole file as one strided matrix, with no copy.
+  REQUIRE(rows.matrix().rows() == 9);
+  REQUIRE(VectorXf(rows.matrix().row(8).transpose()) == data.at(8));
+  REQUIRE(rows.matrix().data() == rows.at(0).data());
+
+  REQUIRE_THROWS(nr::read_fvecs<Matrix<float, 4, 1>>(path));
+}
+
+TEST_CASE("ivecs and bvecs round trip", "vecs_io") {
+  const std::string ipath = scratch_path("truth.ivecs");
+  std::vector<std::vector<int>> truth{{3, 1, 4}, {1, 5, 9}, {2, 6, 5}};
+  nr::write_ivecs(ipath, truth);
+  auto ids = nr::read_ivecs(ipath);
+  REQUIRE(ids.size() == 3);
+  REQUIRE(ids.at(1)(2) == 9);
+
+  const std::string bpath = scratch_path("data.bvecs");
+  std::vector<std::vector<int>> bytes{{0, 255, 7, 8}, {1, 2, 3, 4}};
+  nr::write_bvecs(bpath, bytes);
+  auto rows = nr::read_bvecs(bpath);
+  REQUIRE(rows.size() == 2);
+  REQUIRE(rows.dimension() == 4);
+  REQUIRE(rows.at(0)(1) == 255);
+  REQUIRE(rows.at(1)(3) == 4);
+  auto as_float = nr::cast_rows<VectorXf>(rows);
+  REQUIRE(as_float.at(0) == Vector4f(0, 255, 7, 8));
+
+  REQUIRE_THROWS(nr::write_bvecs(bpath, std::vector<std::vector<int>>{{256}}));
+}
+
+TEST_CASE("vecs readers reject bad files", "vecs_io") {
+  const std::string path = scratch_path("bad.fvecs");
+  nr::write_fvecs(path, std::vector<std::vector<float>>{{1, 2}, {3, 4, 5}});
+  REQUIRE_THROWS(nr::read_fvecs(path));
+  // a truncated file is not a whole number of vectors.
+  nr::write_fvecs(path, random_rows(3, 4));
+  fs::resize_file(path, fs::file_size(path) - 2);
+  REQUIRE_THROWS(nr::read_fvecs(path));
+  REQUIRE_THROWS(nr::read_f32_matrix(path));
+}
+
+TEST_CASE("f32 matrix round trip", "vecs_io") {
+  const std::string path = scratch_path("data.f32");
+  const auto data = random_rows(7, 3);
+  nr::write_f32_matrix(path, data);
+  REQUIRE(fs::file_size(path) == nr::f32_matrix_header + 7 * 3 * 4);
+  auto rows = nr::read_f32_matrix(path);
+  REQUIRE(rows.size() == 7);
+  REQUIRE(rows.dimension() == 3);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(VectorXf(rows.at(i)) == data.at(i));
+  }
+  REQUIRE_THROWS(nr::write_f32_matrix(
+      path, std::vector<std::vector<float>>{{1, 2}, {3}}));
+}
+
+TEST_CASE("empty f32 matrix round trip", "vecs_io") {
+  const std::string path = scratch_path("empty.f32");
+  const std::vector<VectorXf> none(0);
+  // an empty matrix has no rows to take its dimension from.
+  REQUIRE_THROWS(nr::write_f32_matrix(path, none));
+  nr::write_f32_matrix(path, none, 5);
+  REQUIRE(fs::file_size(path) == nr::f32_matrix_header);
+  auto rows = nr::read_f32_matrix(path);
+  REQUIRE(rows.size() == 0);
+  REQUIRE(rows.dimension() == 5);
+  REQUIRE_THROWS(nr::write_f32_matrix(path, random_rows(2, 3), 4));
+}
+
+TEST_CASE("f32 matrix header can't overflow the size check", "vecs_io") {
+  const std::string path = scratch_path("huge.f32");
+  nr::write_f32_matrix(path, random_rows(2, 2));
+  // 2^62 rows of 2^2 floats is 2^66 bytes, which wraps to 0 in 64 bits.
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    const uint64_t num_rows = uint64_t(1) << 62;
+    const uint64_t num_cols = 4;
+    file.seekp(sizeof(nr::f32_matrix_magic));
+    file.write(reinterpret_cast<const char *>(&num_rows), sizeof(num_rows));
+    file.write(reinterpret_cast<const char *>(&num_cols), sizeof(num_cols));
+  }
+  fs::resize_file(path, nr::f32_matrix_header);
+  REQUIRE_THROWS(nr::read_f32_matrix(path));
+}
+
+TEST_CASE("fill and probe from mapped files", "vecs_io") {
+  const std::string data_path = scratch_path("base.fvecs");
+  const std::string query_path = scratch_path("query.fvecs");
+  const auto data = random_rows(40, 6);
+  const auto queries = random_rows(5, 6);
+  nr::write_fvecs(data_path, data);
+  nr::write_fvecs(query_path, queries);
+  auto base = nr::read_fvecs(data_path);
+  auto query = nr::read_fvecs(query_path);
+
+  nr::NR_MultiProbe<VectorXf> mapped(2, 2, 4, 6, 8);
+  mapped.fill(base, false);
+  nr::NR_MultiProbe<VectorXf> from_matrix(2, 2, 4, 6, 8);
+  from_matrix.fill(base.matrix(), false);
+  for (size_t i = 0; i < data.size(); ++i) {
+    REQUIRE(mapped.lookup(i).isApprox(data.at(i)));
+    REQUIRE(from_matrix.lookup(i).isApprox(data.at(i)));
+  }
+
+  // queries go from the file straight into their contexts.
+  auto from_file = mapped.k_probe_ids_batch(3, mapped.contexts(query, 8));
+  auto from_memory = mapped.k_probe_ids_batch(3, queries, 8);
+  REQUIRE(from_file.size() == queries.size());
+  for (size_t j = 0; j < queries.size(); ++j) {
+    REQUIRE(from_file.at(j).first.ids == from_memory.at(j).first.ids);
+  }
+}
@@ -0,0 +1,73 @@
+#include "catch.hpp"
+
+#include "../include/visited_set.hpp"
+
+using namespace nr;
+
+TEST_CASE("visit ids once", "visited_set") {
+  VisitedSet v(5);
+  REQUIRE(v.size() == 5);
+  REQUIRE(!v.visited(3));
+  REQUIRE(v.visit(3));
+  REQUIRE(v.visited(3));
+  // second visit reports a duplicate.
+  REQUIRE(!v.visit(3));
+  REQUIRE(v.visit(4));
+  REQUIRE(!v.visited(0));
+}
+
+TEST_CASE("clear forgets visited ids", "visited_set") {
+  VisitedSet v(3);
+  v.visit(0);
+  v.visit(2);
+  v.clear();
+  REQUIRE(!v.visited(0));
+  REQUIRE(!v.visited(2));
+  REQUIRE(v.visit(0));
+  REQUIRE(!v.visit(0));
+}
+
+TEST_CASE("visited set grows for large ids", "visited_set") {
+  VisitedSet v;
+  REQUIRE(v.size() == 0);
+  REQUIRE(!v.visited(10));
+  REQUIRE(v.visit(10));
+  REQUIRE(v.size() == 11);
+  REQUIRE(!v.visit(10));
+}
+
+TEST_CASE("lists are tracked apart from ids", "visited_set") {
+  VisitedSet v(3);
+  REQUIRE(!v.list_visited(7));
+  REQUIRE(v.visit_list(7));
+  REQUIRE(!v.visit_list(7));
+  // list numbers and ids don't collide.
+  REQUIRE(!v.visited(7));
+  v.clear();
+  REQUIRE(!v.list_visited(7));
+  REQUIRE(v.visit_list(7));
+}
+
+TEST_CASE("visited pool hands each query its own set", "visited_set") {
+  VisitedPool pool;
+  pool.resize(4);
+  {
+    VisitedPool::Lease first = pool.take();
+    VisitedPool::Lease second = pool.take();
+    REQUIRE(&*first != &*second);
+    REQUIRE(first->size() == 4);
+    first->visit(2);
+    REQUIRE(!second->visited(2));
+  }
+  REQUIRE(pool.idle() == 2);
+
+  // a returned set is reused, and starts out cleared.
+  VisitedPool::Lease again = pool.take();
+  REQUIRE(pool.idle() == 1);
+  REQUIRE(!again->visited(2));
+
+  // copies don't share sets.
+  VisitedPool copy(pool);
+  REQUIRE(copy.idle() == 0);
+  REQUIRE(copy.ids() == 4);
+}